@@ -0,0 +1,62 @@
+/*
+    ------------------------------------------------------------------
+
+    This file is part of the Open Ephys GUI
+    Copyright (C) 2020 Open Ephys
+
+    ------------------------------------------------------------------
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __ACQUISITIONCONFIG_H_2C4CBD67__
+#define __ACQUISITIONCONFIG_H_2C4CBD67__
+
+#include <array>
+
+#include "rhythm-api/rhd2000ONIboard.h"
+
+namespace ONIRhythmNode
+{
+
+	/**
+		Settings the acquisition thread needs to decode frames.
+
+		A configuration is never modified once published: the message thread builds
+		a new one and swaps the pointer, and the acquisition thread picks it up at
+		the start of its next batch of frames.
+
+		@see DeviceThread::publishAcquisitionConfig
+	*/
+	struct AcquisitionConfig
+	{
+		bool acquireAux = false;
+		bool acquireAdc = false;
+
+		/** Adds the board-applied TTL outputs to the event word*/
+		bool logTtlOutputs = false;
+
+		int numStreams = 0;
+
+		/** Chip ID and amplifier channel count of each enabled data stream*/
+		std::array<int, MAX_NUM_DATA_STREAMS_USB3> chipId {};
+		std::array<int, MAX_NUM_DATA_STREAMS_USB3> numChannels {};
+
+		/** Converts an ADC code to volts: code * adcScale + adcOffset*/
+		std::array<double, 8> adcScale {};
+		std::array<double, 8> adcOffset {};
+	};
+
+}
+#endif  // __ACQUISITIONCONFIG_H_2C4CBD67__
@@ -0,0 +1,146 @@
+/*
+    ------------------------------------------------------------------
+
+    This file is part of the Open Ephys GUI
+    Copyright (C) 2021 Open Ephys
+
+    ------------------------------------------------------------------
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+#include "AdcThresholdDetector.h"
+
+using namespace ONIRhythmNode;
+
+AdcThresholdDetector::AdcThresholdDetector() :
+    enabledMask(0),
+    fallingMask(0),
+    state(0),
+    outputState(0)
+{
+    for (int adc = 0; adc < NUM_ADC_EVENT_LINES; adc++)
+    {
+        thresholds[adc] = 1.0f;
+        hysteresis[adc] = 0.1f;
+        outputLines[adc] = -1;
+    }
+}
+
+void AdcThresholdDetector::setEnabled(int adc, bool enabled)
+{
+    if (adc < 0 || adc >= NUM_ADC_EVENT_LINES)
+        return;
+
+    if (enabled)
+        enabledMask |= 1u << adc;
+    else
+        enabledMask &= ~(1u << adc);
+}
+
+bool AdcThresholdDetector::isEnabled(int adc) const
+{
+    return adc >= 0 && adc < NUM_ADC_EVENT_LINES && (enabledMask & (1u << adc)) != 0;
+}
+
+void AdcThresholdDetector::setThreshold(int adc, float volts, float hysteresisVolts, bool falling)
+{
+    if (adc < 0 || adc >= NUM_ADC_EVENT_LINES)
+        return;
+
+    thresholds[adc] = volts;
+    hysteresis[adc] = jmax(0.0f, hysteresisVolts);
+
+    if (falling)
+        fallingMask |= 1u << adc;
+    else
+        fallingMask &= ~(1u << adc);
+}
+
+float AdcThresholdDetector::getThreshold(int adc) const
+{
+    return thresholds[jlimit(0, NUM_ADC_EVENT_LINES - 1, adc)];
+}
+
+float AdcThresholdDetector::getHysteresis(int adc) const
+{
+    return hysteresis[jlimit(0, NUM_ADC_EVENT_LINES - 1, adc)];
+}
+
+bool AdcThresholdDetector::isFalling(int adc) const
+{
+    return adc >= 0 && adc < NUM_ADC_EVENT_LINES && (fallingMask & (1u << adc)) != 0;
+}
+
+void AdcThresholdDetector::setOutputLine(int adc, int ttlLine)
+{
+    if (adc < 0 || adc >= NUM_ADC_EVENT_LINES)
+        return;
+
+    outputLines[adc] = (ttlLine >= 0 && ttlLine < NUM_TTL_OUTPUT_LINES) ? ttlLine : -1;
+}
+
+int AdcThresholdDetector::getOutputLine(int adc) const
+{
+    return outputLines[jlimit(0, NUM_ADC_EVENT_LINES - 1, adc)];
+}
+
+void AdcThresholdDetector::reset()
+{
+    state = 0;
+    outputState = 0;
+}
+
+uint32 AdcThresholdDetector::process(const float* adc)
+{
+    const uint32 enabled = enabledMask;
+    const uint32 falling = fallingMask;
+
+    uint32 newState = 0;
+    uint32 newOutputs = 0;
+
+    for (int n = 0; n < NUM_ADC_EVENT_LINES; n++)
+    {
+        const uint32 bit = 1u << n;
+
+        if ((enabled & bit) == 0)
+            continue;
+
+        const float threshold = thresholds[n];
+        const bool high = (state & bit) != 0;
+
+        // the threshold sets the line, the hysteresis band has to be left to clear it
+        bool on;
+
+        if (falling & bit)
+            on = high ? adc[n] < threshold + hysteresis[n] : adc[n] <= threshold;
+        else
+            on = high ? adc[n] > threshold - hysteresis[n] : adc[n] >= threshold;
+
+        if (on)
+        {
+            newState |= bit;
+
+            const int line = outputLines[n];
+
+            if (line >= 0)
+                newOutputs |= 1u << line;
+        }
+    }
+
+    state = newState;
+    outputState = newOutputs;
+
+    return state;
+}
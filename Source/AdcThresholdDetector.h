@@ -0,0 +1,104 @@
+/*
+    ------------------------------------------------------------------
+
+    This file is part of the Open Ephys GUI
+    Copyright (C) 2020 Open Ephys
+
+    ------------------------------------------------------------------
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __ADCTHRESHOLDDETECTOR_H_2C4CBD67__
+#define __ADCTHRESHOLDDETECTOR_H_2C4CBD67__
+
+#include <DataThreadHeaders.h>
+
+#include <array>
+#include <atomic>
+
+#include "DeviceThread.h"
+
+namespace ONIRhythmNode
+{
+
+	/**
+		Turns the board ADC inputs into digital events.
+
+		Each enabled ADC goes high when its voltage reaches the threshold and low
+		once it has fallen below threshold - hysteresis (mirrored for falling
+		detectors). The states are logged on event lines ADC_EVENT_LINE and up, and
+		can drive a TTL output line directly, so the output follows the analog input
+		with the latency of the TTL output writer only.
+
+		Settings can be changed at any time; whether events are logged is decided
+		when the event channel is created.
+
+		@see DeviceThread::updateBuffer
+	*/
+	class AdcThresholdDetector
+	{
+	public:
+
+		/** Constructor*/
+		AdcThresholdDetector();
+
+		/** Enables or disables detection on one ADC (0-7)*/
+		void setEnabled(int adc, bool enabled);
+
+		bool isEnabled(int adc) const;
+
+		/** Returns true if any ADC is enabled*/
+		bool isEnabled() const { return enabledMask != 0; }
+
+		/** Sets the threshold and hysteresis of an ADC, in volts. A falling detector goes high below the threshold.*/
+		void setThreshold(int adc, float volts, float hysteresisVolts, bool falling = false);
+
+		float getThreshold(int adc) const;
+
+		float getHysteresis(int adc) const;
+
+		bool isFalling(int adc) const;
+
+		/** Sets the TTL output line (0-7) driven by an ADC, or -1 for none*/
+		void setOutputLine(int adc, int ttlLine);
+
+		int getOutputLine(int adc) const;
+
+		/** Sets all ADCs low. Must be called before acquisition starts.*/
+		void reset();
+
+		/** Updates the ADC states with one sample of the 8 ADCs (acquisition thread). Returns the state of the ADCs.*/
+		uint32 process(const float* adc);
+
+		/** Returns the TTL output lines driven high by the current ADC states*/
+		uint32 getOutputState() const { return outputState; }
+
+	private:
+
+		std::atomic<uint32> enabledMask;
+		std::atomic<uint32> fallingMask;
+		std::array<std::atomic<float>, NUM_ADC_EVENT_LINES> thresholds;
+		std::array<std::atomic<float>, NUM_ADC_EVENT_LINES> hysteresis;
+		std::array<std::atomic<int>, NUM_ADC_EVENT_LINES> outputLines;
+
+		// acquisition thread only
+		uint32 state;
+		uint32 outputState;
+
+		JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(AdcThresholdDetector);
+	};
+
+}
+#endif  // __ADCTHRESHOLDDETECTOR_H_2C4CBD67__
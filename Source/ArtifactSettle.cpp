@@ -0,0 +1,192 @@
+/*
+    ------------------------------------------------------------------
+
+    This file is part of the Open Ephys GUI
+    Copyright (C) 2021 Open Ephys
+
+    ------------------------------------------------------------------
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+#include "ArtifactSettle.h"
+#include "ImpedanceMonitor.h"
+
+using namespace ONIRhythmNode;
+
+/** AuxCmd3 bank holding the register list with amplifier fast settle enabled (see updateRegisters())*/
+#define FAST_SETTLE_BANK 2
+
+ArtifactSettle::ArtifactSettle(DeviceThread* board_) :
+    board(board_),
+    enabled(false),
+    saturationThreshold(6300.0f),
+    transientThreshold(3000.0f),
+    settleSamples(30),
+    numTriggers(0),
+    active(false),
+    havePrevious(false),
+    holding(false),
+    holdUntil(0),
+    holdSamples(30),
+    blockReadFrames(1),
+    regularBank(1)
+{
+}
+
+void ArtifactSettle::setEnabled(bool enabled_)
+{
+    enabled = enabled_;
+}
+
+void ArtifactSettle::setChannels(const Array<int>& channels_)
+{
+    const ScopedLock lock(channelLock);
+    channels = channels_;
+}
+
+Array<int> ArtifactSettle::getChannels() const
+{
+    const ScopedLock lock(channelLock);
+    return channels;
+}
+
+void ArtifactSettle::setSaturationThreshold(float microvolts)
+{
+    saturationThreshold = jmax(0.0f, microvolts);
+}
+
+void ArtifactSettle::setTransientThreshold(float microvolts)
+{
+    transientThreshold = jmax(0.0f, microvolts);
+}
+
+void ArtifactSettle::setSettleSamples(int samples)
+{
+    settleSamples = jmax(1, samples);
+}
+
+bool ArtifactSettle::prepare()
+{
+    active = false;
+    holding = false;
+    havePrevious = false;
+    numTriggers = 0;
+
+    // with fast settle always on, there is nothing to switch
+    if (!enabled || board->settings.fastSettleEnabled)
+        return false;
+
+    const int numAmplifierChannels = board->getNumDataOutputs(ContinuousChannel::ELECTRODE);
+
+    activeChannels.clear();
+
+    {
+        const ScopedLock lock(channelLock);
+
+        for (int channel : channels)
+        {
+            if (channel >= 0 && channel < numAmplifierChannels)
+                activeChannels.push_back(channel);
+        }
+    }
+
+    if (activeChannels.empty())
+        return false;
+
+    previous.assign(activeChannels.size(), 0.0f);
+    regularBank = 1;
+
+    // the fast settle bit is only written once per pass of the register list
+    Rhd2000Registers registers = board->chipRegisters;
+    std::vector<int> commandList;
+    holdSamples = jmax(int(settleSamples), registers.createCommandListRegisterConfig(commandList, false));
+
+    blockReadFrames = int(board->evalBoard->getBlockReadFrames());
+    active = true;
+
+    LOGD("Artifact fast settle: watching ", (int) activeChannels.size(), " channels");
+
+    return true;
+}
+
+bool ArtifactSettle::processSample(const float* sample, int64 timestamp)
+{
+    if (!active)
+        return false;
+
+    const float saturation = saturationThreshold;
+    const float transient = transientThreshold;
+
+    bool detected = false;
+
+    for (size_t i = 0; i < activeChannels.size(); i++)
+    {
+        const float value = sample[activeChannels[i]];
+
+        if (std::abs(value) >= saturation
+            || (transient > 0.0f && havePrevious && std::abs(value - previous[i]) >= transient))
+            detected = true;
+
+        previous[i] = value;
+    }
+
+    havePrevious = true;
+
+    // Zcheck owns the register lists; the impedance monitor selects the regular bank when done
+    if (board->impedanceMonitorActive && board->impedanceMonitor->isZcheckBankSelected())
+    {
+        holding = false;
+        return false;
+    }
+
+    if (detected)
+    {
+        if (!holding)
+        {
+            selectAuxCmd3Bank(FAST_SETTLE_BANK);
+            numTriggers++;
+            holding = true;
+        }
+
+        // the board is up to one block read ahead of this sample
+        holdUntil = timestamp + blockReadFrames + holdSamples;
+        return true;
+    }
+
+    if (holding && timestamp >= holdUntil)
+    {
+        selectAuxCmd3Bank(regularBank);
+        holding = false;
+    }
+
+    return holding;
+}
+
+void ArtifactSettle::finish()
+{
+    if (active && holding)
+        selectAuxCmd3Bank(regularBank);
+
+    active = false;
+    holding = false;
+}
+
+void ArtifactSettle::selectAuxCmd3Bank(int bank)
+{
+    board->evalBoard->selectAuxCommandBank(Rhd2000ONIBoard::PortA, Rhd2000ONIBoard::AuxCmd3, bank);
+    board->evalBoard->selectAuxCommandBank(Rhd2000ONIBoard::PortB, Rhd2000ONIBoard::AuxCmd3, bank);
+    board->evalBoard->selectAuxCommandBank(Rhd2000ONIBoard::PortC, Rhd2000ONIBoard::AuxCmd3, bank);
+    board->evalBoard->selectAuxCommandBank(Rhd2000ONIBoard::PortD, Rhd2000ONIBoard::AuxCmd3, bank);
+}
@@ -0,0 +1,126 @@
+/*
+    ------------------------------------------------------------------
+
+    This file is part of the Open Ephys GUI
+    Copyright (C) 2020 Open Ephys
+
+    ------------------------------------------------------------------
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __ARTIFACTSETTLE_H_2C4CBD67__
+#define __ARTIFACTSETTLE_H_2C4CBD67__
+
+#include <DataThreadHeaders.h>
+
+#include <atomic>
+#include <vector>
+
+#include "DeviceThread.h"
+
+namespace ONIRhythmNode
+{
+
+	/**
+		Triggers amplifier fast settle when an artifact is detected.
+
+		Selected amplifier channels are checked in every decoded sample for values
+		near saturation or for large jumps between consecutive samples. On detection,
+		all ports switch to the fast settle register list (AuxCmd3 bank 2) for a
+		configurable number of samples, then back to the regular list. The fast settle
+		bit is set when the list next writes Register 0, i.e. within one list period, so
+		the list is held for at least one period. The hold is counted from the first
+		frame recorded after the switch, past the frames of the current block read.
+
+		Nothing is triggered while Zcheck uses the register lists.
+
+		@see DeviceThread::updateRegisters, ImpedanceMonitor
+	*/
+	class ArtifactSettle
+	{
+	public:
+
+		/** Constructor*/
+		ArtifactSettle(DeviceThread* b);
+
+		/** Enables or disables detection (takes effect at the next acquisition start)*/
+		void setEnabled(bool enabled);
+
+		bool isEnabled() const { return enabled; }
+
+		/** Sets the amplifier channels checked for artifacts (takes effect at the next acquisition start)*/
+		void setChannels(const Array<int>& channels);
+
+		Array<int> getChannels() const;
+
+		/** Absolute value at which a channel is considered saturated, in uV*/
+		void setSaturationThreshold(float microvolts);
+
+		float getSaturationThreshold() const { return saturationThreshold; }
+
+		/** Change between two consecutive samples considered an artifact, in uV (0 disables)*/
+		void setTransientThreshold(float microvolts);
+
+		float getTransientThreshold() const { return transientThreshold; }
+
+		/** Number of samples fast settle is held after the last detection (at least one register list period)*/
+		void setSettleSamples(int samples);
+
+		int getSettleSamples() const { return settleSamples; }
+
+		/** Number of times fast settle was triggered since acquisition started*/
+		int64 getNumTriggers() const { return numTriggers; }
+
+		/** Prepares detection. Must be called before the board starts running; returns true if active.*/
+		bool prepare();
+
+		/** Checks one decoded sample (acquisition thread). Returns true while fast settle is held.*/
+		bool processSample(const float* sample, int64 timestamp);
+
+		/** Returns the board to the regular register list. Must be called once the acquisition thread has exited.*/
+		void finish();
+
+	private:
+
+		/** Selects an AuxCmd3 bank on all ports*/
+		void selectAuxCmd3Bank(int bank);
+
+		DeviceThread* board;
+
+		std::atomic<bool> enabled;
+		std::atomic<float> saturationThreshold;
+		std::atomic<float> transientThreshold;
+		std::atomic<int> settleSamples;
+		std::atomic<int64> numTriggers;
+
+		CriticalSection channelLock;
+		Array<int> channels;
+
+		// acquisition thread only
+		bool active;
+		std::vector<int> activeChannels;
+		std::vector<float> previous;
+		bool havePrevious;
+		bool holding;
+		int64 holdUntil;
+		int holdSamples;
+		int blockReadFrames;
+		int regularBank;
+
+		JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(ArtifactSettle);
+	};
+
+}
+#endif  // __ARTIFACTSETTLE_H_2C4CBD67__
@@ -0,0 +1,292 @@
+/*
+    ------------------------------------------------------------------
+
+    This file is part of the Open Ephys GUI
+    Copyright (C) 2021 Open Ephys
+
+    ------------------------------------------------------------------
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "CableDelayCache.h"
+
+using namespace ONIRhythmNode;
+
+namespace
+{
+    // InterProcessLock does not exclude instances within the same process
+    CriticalSection& getFileLock()
+    {
+        static CriticalSection fileLock;
+        return fileLock;
+    }
+}
+
+CableDelayCache::CableDelayCache(const File& file_) :
+    file(file_),
+    fileLock("rhythm-oni-" + file_.getFileName())
+{
+}
+
+String CableDelayCache::makeKey(const String& boardId, int port)
+{
+    return boardId + "/" + String(port);
+}
+
+String CableDelayCache::getBoardId(const String& key)
+{
+    return key.upToLastOccurrenceOf("/", false, false);
+}
+
+bool CableDelayCache::load()
+{
+    const ScopedLock sl(getFileLock());
+    const InterProcessLock::ScopedLockType processLock(fileLock);
+
+    changedBoards.clear();
+
+    if (!readFile(file, ports, memoryStates))
+        return false;
+
+    LOGD("Loaded ", (int) ports.size(), " cached cable delays.");
+
+    return true;
+}
+
+bool CableDelayCache::readFile(const File& file, std::map<String, PortDelay>& ports, std::map<String, int>& memoryStates)
+{
+    ports.clear();
+    memoryStates.clear();
+
+    if (!file.existsAsFile())
+        return false;
+
+    std::unique_ptr<XmlElement> xml = parseXML(file);
+
+    if (xml == nullptr || !xml->hasTagName("CABLE_DELAYS"))
+    {
+        LOGE("Cable delay cache ", file.getFullPathName(), " could not be read.");
+        return false;
+    }
+
+    for (auto* boardXml : xml->getChildWithTagNameIterator("BOARD"))
+    {
+        String boardId = boardXml->getStringAttribute("id");
+
+        if (boardXml->hasAttribute("memory"))
+            memoryStates[boardId] = boardXml->getIntAttribute("memory");
+
+        for (auto* portXml : boardXml->getChildWithTagNameIterator("PORT"))
+        {
+            PortDelay entry;
+            entry.delay = portXml->getIntAttribute("delay", -1);
+
+            StringArray ids;
+            ids.addTokens(portXml->getStringAttribute("chips"), ",", "");
+
+            for (auto& id : ids)
+                entry.chipIds.add(id.getIntValue());
+
+            StringArray rateDelays;
+            rateDelays.addTokens(portXml->getStringAttribute("rates"), ",", "");
+
+            for (auto& delay : rateDelays)
+                entry.sampleRateDelays.add(delay.getIntValue());
+
+            if (entry.delay >= 0)
+                ports[makeKey(boardId, portXml->getIntAttribute("index"))] = entry;
+        }
+    }
+
+    return true;
+}
+
+bool CableDelayCache::save()
+{
+    const ScopedLock sl(getFileLock());
+
+    // other plugin instances save their boards to the same file
+    const InterProcessLock::ScopedLockType processLock(fileLock);
+
+    if (!processLock.isLocked())
+    {
+        LOGE("Could not lock cable delay cache ", file.getFullPathName());
+        return false;
+    }
+
+    std::map<String, PortDelay> storedPorts;
+    std::map<String, int> storedMemoryStates;
+    readFile(file, storedPorts, storedMemoryStates);
+
+    // the stored entries are the latest ones for every board this instance has not changed
+    for (auto& port : ports)
+    {
+        if (changedBoards.count(getBoardId(port.first)) > 0)
+            storedPorts[port.first] = port.second;
+    }
+
+    for (auto it = storedPorts.begin(); it != storedPorts.end();)
+    {
+        if (changedBoards.count(getBoardId(it->first)) > 0 && ports.count(it->first) == 0)
+            it = storedPorts.erase(it);
+        else
+            ++it;
+    }
+
+    for (auto& boardId : changedBoards)
+    {
+        auto it = memoryStates.find(boardId);
+
+        if (it != memoryStates.end())
+            storedMemoryStates[boardId] = it->second;
+        else
+            storedMemoryStates.erase(boardId);
+    }
+
+    ports.swap(storedPorts);
+    memoryStates.swap(storedMemoryStates);
+    changedBoards.clear();
+
+    std::unique_ptr<XmlElement> xml = std::unique_ptr<XmlElement>(new XmlElement("CABLE_DELAYS"));
+
+    std::map<String, XmlElement*> boards;
+
+    for (auto& port : ports)
+    {
+        String boardId = getBoardId(port.first);
+        int index = port.first.fromLastOccurrenceOf("/", false, false).getIntValue();
+
+        if (boards.find(boardId) == boards.end())
+        {
+            boards[boardId] = xml->createNewChildElement("BOARD");
+            boards[boardId]->setAttribute("id", boardId);
+
+            if (memoryStates.find(boardId) != memoryStates.end())
+                boards[boardId]->setAttribute("memory", memoryStates[boardId]);
+        }
+
+        StringArray ids;
+
+        for (int id : port.second.chipIds)
+            ids.add(String(id));
+
+        XmlElement* portXml = boards[boardId]->createNewChildElement("PORT");
+        portXml->setAttribute("index", index);
+        portXml->setAttribute("delay", port.second.delay);
+        portXml->setAttribute("chips", ids.joinIntoString(","));
+
+        if (port.second.sampleRateDelays.size() > 0)
+        {
+            StringArray rateDelays;
+
+            for (int delay : port.second.sampleRateDelays)
+                rateDelays.add(String(delay));
+
+            portXml->setAttribute("rates", rateDelays.joinIntoString(","));
+        }
+    }
+
+    if (!xml->writeTo(file))
+    {
+        LOGE("Could not write cable delay cache ", file.getFullPathName());
+        return false;
+    }
+
+    return true;
+}
+
+bool CableDelayCache::getPort(const String& boardId, int port, int& delay, Array<int>& chipIds) const
+{
+    auto it = ports.find(makeKey(boardId, port));
+
+    if (it == ports.end())
+        return false;
+
+    delay = it->second.delay;
+    chipIds = it->second.chipIds;
+
+    return true;
+}
+
+void CableDelayCache::setPort(const String& boardId, int port, int delay, const Array<int>& chipIds)
+{
+    PortDelay entry;
+    entry.delay = delay;
+    entry.chipIds = chipIds;
+
+    auto it = ports.find(makeKey(boardId, port));
+
+    if (it != ports.end() && it->second.delay == delay && it->second.chipIds == chipIds)
+        entry.sampleRateDelays = it->second.sampleRateDelays;
+
+    ports[makeKey(boardId, port)] = entry;
+    changedBoards.insert(boardId);
+}
+
+bool CableDelayCache::getSampleRateDelays(const String& boardId, int port, Array<int>& delays) const
+{
+    auto it = ports.find(makeKey(boardId, port));
+
+    if (it == ports.end() || it->second.sampleRateDelays.size() == 0)
+        return false;
+
+    delays = it->second.sampleRateDelays;
+
+    return true;
+}
+
+void CableDelayCache::setSampleRateDelays(const String& boardId, int port, const Array<int>& delays)
+{
+    auto it = ports.find(makeKey(boardId, port));
+
+    if (it != ports.end())
+    {
+        it->second.sampleRateDelays = delays;
+        changedBoards.insert(boardId);
+    }
+}
+
+bool CableDelayCache::getMemoryState(const String& boardId, int& memState) const
+{
+    auto it = memoryStates.find(boardId);
+
+    if (it == memoryStates.end())
+        return false;
+
+    memState = it->second;
+
+    return true;
+}
+
+void CableDelayCache::setMemoryState(const String& boardId, int memState)
+{
+    memoryStates[boardId] = memState;
+    changedBoards.insert(boardId);
+}
+
+void CableDelayCache::clearBoard(const String& boardId)
+{
+    for (auto it = ports.begin(); it != ports.end();)
+    {
+        if (getBoardId(it->first) == boardId)
+            it = ports.erase(it);
+        else
+            ++it;
+    }
+
+    memoryStates.erase(boardId);
+    changedBoards.insert(boardId);
+}
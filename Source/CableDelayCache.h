@@ -0,0 +1,122 @@
+/*
+    ------------------------------------------------------------------
+
+    This file is part of the Open Ephys GUI
+    Copyright (C) 2020 Open Ephys
+
+    ------------------------------------------------------------------
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef __CABLEDELAYCACHE_H_2C4CBD67__
+#define __CABLEDELAYCACHE_H_2C4CBD67__
+
+#include <DataThreadHeaders.h>
+
+#include <map>
+#include <set>
+
+namespace ONIRhythmNode
+{
+
+	/**
+		Remembers the last MISO cable delay found for each SPI port, together
+		with the chip IDs that answered on that port, so a port scan can
+		verify the previous result with a single read instead of sweeping
+		all 16 delays.
+
+		With the board memory state and the delays checked at each sample
+		rate, this forms a hardware fingerprint: a chain loaded on a known
+		rig skips the port scan and the per-sample-rate delay checks.
+
+		Entries are keyed by a board identifier (which includes the gateware
+		version) and stored as XML. Several plugin instances share the file:
+		saving merges the boards changed by this instance into the current file.
+	*/
+	class CableDelayCache
+	{
+	public:
+
+		/** Constructor*/
+		CableDelayCache(const File& file);
+
+		/** Destructor*/
+		~CableDelayCache() { }
+
+		/** Reads the cache file. Returns false if it is missing or invalid.*/
+		bool load();
+
+		/** Writes the boards changed since the last load or save to the cache file,
+		    keeping the other boards as currently stored there*/
+		bool save();
+
+		/** Gets the stored delay and chip IDs (one per data source, -1 if none) of a port.
+		    Returns false if nothing is stored.*/
+		bool getPort(const String& boardId, int port, int& delay, Array<int>& chipIds) const;
+
+		/** Stores the delay and chip IDs of a port. The delays stored for other sample rates
+		    are kept only if both are unchanged.*/
+		void setPort(const String& boardId, int port, int delay, const Array<int>& chipIds);
+
+		/** Gets the cable delays of a port at each sample rate (-1 if not checked).
+		    Returns false if nothing is stored.*/
+		bool getSampleRateDelays(const String& boardId, int port, Array<int>& delays) const;
+
+		/** Stores the cable delays of a port at each sample rate*/
+		void setSampleRateDelays(const String& boardId, int port, const Array<int>& delays);
+
+		/** Gets the on-board memory state a board reported when its ports were stored*/
+		bool getMemoryState(const String& boardId, int& memState) const;
+
+		/** Stores the on-board memory state of a board*/
+		void setMemoryState(const String& boardId, int memState);
+
+		/** Removes all stored ports of a board*/
+		void clearBoard(const String& boardId);
+
+	private:
+
+		struct PortDelay
+		{
+			int delay;
+			Array<int> chipIds;
+			Array<int> sampleRateDelays;
+		};
+
+		/** Returns the key of a port entry*/
+		static String makeKey(const String& boardId, int port);
+
+		/** Returns the board identifier of a port entry key*/
+		static String getBoardId(const String& key);
+
+		/** Parses a cache file. Returns false if it is missing or invalid.*/
+		static bool readFile(const File& file, std::map<String, PortDelay>& ports, std::map<String, int>& memoryStates);
+
+		File file;
+
+		std::map<String, PortDelay> ports;
+		std::map<String, int> memoryStates;
+
+		/** Boards changed since the last load or save*/
+		std::set<String> changedBoards;
+
+		InterProcessLock fileLock;
+
+		JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(CableDelayCache);
+	};
+
+}
+#endif  // __CABLEDELAYCACHE_H_2C4CBD67__
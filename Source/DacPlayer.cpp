@@ -0,0 +1,222 @@
+/*
+    ------------------------------------------------------------------
+
+    This file is part of the Open Ephys GUI
+    Copyright (C) 2021 Open Ephys
+
+    ------------------------------------------------------------------
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+#include "DacPlayer.h"
+
+using namespace ONIRhythmNode;
+
+DacPlayer::DacPlayer(DeviceThread* board_) :
+    Thread("DAC Player"),
+    board(board_),
+    queueCounter(0),
+    nextFrame(0),
+    requestedStart(-1),
+    numWritten(0),
+    numLate(0)
+{
+    for (auto& buffer : buffers)
+    {
+        buffer.frames.resize(MAX_WAVEFORM_FRAMES * 8);
+        buffer.state = BUFFER_EMPTY;
+    }
+
+    framePool.fill(nullptr);
+}
+
+DacPlayer::~DacPlayer()
+{
+    stop();
+
+    for (auto& frame : framePool)
+    {
+        if (frame != nullptr)
+            oni_destroy_frame(frame);
+    }
+}
+
+bool DacPlayer::queue(const uint16* frames, int numFrames, double sampleRate, int loops)
+{
+    const ScopedLock lock(controlLock);
+
+    if (numFrames < 1 || numFrames > MAX_WAVEFORM_FRAMES || sampleRate <= 0.0 || loops < 0)
+        return false;
+
+    // every frame is a separate write, timed by a sleeping thread
+    if (sampleRate > MAX_SAMPLE_RATE)
+    {
+        LOGE("DAC player: ", sampleRate, " Hz is above the highest playback rate (", MAX_SAMPLE_RATE, " Hz)");
+        return false;
+    }
+
+    for (auto& buffer : buffers)
+    {
+        if (buffer.state != BUFFER_EMPTY)
+            continue;
+
+        std::copy(frames, frames + numFrames * 8, buffer.frames.begin());
+        buffer.numFrames = numFrames;
+        buffer.sampleRate = sampleRate;
+        buffer.loops = loops;
+        buffer.order = ++queueCounter;
+        buffer.state = BUFFER_READY;
+
+        return true;
+    }
+
+    return false;
+}
+
+bool DacPlayer::start(int64 startSample)
+{
+    const ScopedLock lock(controlLock);
+
+    if (isThreadRunning() || nextReadyBuffer() < 0)
+        return false;
+
+    for (auto& frame : framePool)
+    {
+        if (frame == nullptr)
+            frame = board->evalBoard->createDacFrame();
+
+        if (frame == nullptr)
+            return false;
+    }
+
+    requestedStart = startSample;
+    numWritten = 0;
+    numLate = 0;
+
+    startThread(8);
+
+    return true;
+}
+
+void DacPlayer::stop()
+{
+    const ScopedLock lock(controlLock);
+
+    signalThreadShouldExit();
+
+    if (!stopThread(500))
+        LOGE("DAC player did not exit.");
+
+    for (auto& buffer : buffers)
+        buffer.state = BUFFER_EMPTY;
+}
+
+int DacPlayer::nextReadyBuffer() const
+{
+    int next = -1;
+
+    for (int i = 0; i < int(buffers.size()); i++)
+    {
+        if (buffers[i].state == BUFFER_READY && (next < 0 || buffers[i].order < buffers[next].order))
+            next = i;
+    }
+
+    return next;
+}
+
+bool DacPlayer::waitUntil(int64 ticks)
+{
+    const int64 ticksPerMs = Time::getHighResolutionTicksPerSecond() / 1000;
+
+    for (;;)
+    {
+        if (threadShouldExit())
+            return false;
+
+        const int64 remaining = ticks - Time::getHighResolutionTicks();
+
+        if (remaining <= ticksPerMs / 2)
+            return true;
+
+        // short sleeps keep stop() responsive
+        Thread::sleep(jlimit(1, 10, int(remaining / ticksPerMs)));
+    }
+}
+
+void DacPlayer::writeFrame(const uint16* values)
+{
+    oni_frame_t* frame = framePool[nextFrame];
+    nextFrame = (nextFrame + 1) % FRAME_POOL_SIZE;
+
+    if (board->evalBoard->writeDacFrame(frame, values))
+        numWritten++;
+}
+
+void DacPlayer::run()
+{
+    const double ticksPerSecond = double(Time::getHighResolutionTicksPerSecond());
+    double frameTicks = double(Time::getHighResolutionTicks());
+
+    if (requestedStart >= 0)
+    {
+        int64 clockSample, clockTicks;
+
+        if (board->getSampleClock(clockSample, clockTicks))
+        {
+            const double delay = double(requestedStart - clockSample) / board->settings.boardSampleRate;
+            frameTicks = jmax(frameTicks, double(clockTicks) + delay * ticksPerSecond);
+        }
+    }
+
+    int current = nextReadyBuffer();
+
+    while (current >= 0 && !threadShouldExit())
+    {
+        Waveform& waveform = buffers[current];
+        waveform.state = BUFFER_PLAYING;
+
+        const double framePeriod = ticksPerSecond / waveform.sampleRate;
+
+        for (int loop = 0; waveform.loops == 0 || loop < waveform.loops; loop++)
+        {
+            for (int i = 0; i < waveform.numFrames; i++)
+            {
+                if (!waitUntil(int64(frameTicks)))
+                    break;
+
+                writeFrame(&waveform.frames[i * 8]);
+
+                if (double(Time::getHighResolutionTicks()) - frameTicks > framePeriod && numLate++ == 0)
+                    LOGE("DAC player: frame ", (int64) numWritten, " was written more than one frame period late");
+
+                frameTicks += framePeriod;
+            }
+
+            // a waveform looping forever gives way to the next one
+            if (threadShouldExit() || (waveform.loops == 0 && nextReadyBuffer() >= 0))
+                break;
+        }
+
+        waveform.state = BUFFER_EMPTY;
+        current = nextReadyBuffer();
+    }
+
+    const uint16 midscale[8] = { DAC_MIDSCALE, DAC_MIDSCALE, DAC_MIDSCALE, DAC_MIDSCALE,
+                                 DAC_MIDSCALE, DAC_MIDSCALE, DAC_MIDSCALE, DAC_MIDSCALE };
+    writeFrame(midscale);
+
+    if (numLate > 0)
+        LOGE("DAC player: ", (int64) numLate, " of ", (int64) numWritten, " frames were written late");
+}
@@ -0,0 +1,142 @@
+/*
+    ------------------------------------------------------------------
+
+    This file is part of the Open Ephys GUI
+    Copyright (C) 2020 Open Ephys
+
+    ------------------------------------------------------------------
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __DACPLAYER_H_2C4CBD67__
+#define __DACPLAYER_H_2C4CBD67__
+
+#include <DataThreadHeaders.h>
+
+#include <array>
+#include <atomic>
+#include <vector>
+
+#include "DeviceThread.h"
+
+namespace ONIRhythmNode
+{
+
+	/**
+		Plays analog waveforms on the board's DAC outputs.
+
+		A waveform is a sequence of frames holding one 16-bit code per DAC channel
+		(32768 = 0 V), played at its own rate and optionally looped. Two waveform
+		buffers are preallocated: while one is playing, the next can be queued into
+		the other and follows without a gap (a waveform looping forever is replaced
+		at the end of its current loop).
+
+		Frames are written by a dedicated thread from a pool of ONI frames created
+		once per playback, paced on the host clock. The thread sleeps between frames,
+		so waveform rates are limited to MAX_SAMPLE_RATE; frames written late are
+		counted and reported. Playback can start at a Rhythm sample number, which is
+		converted to host time with the acquisition's sample clock.
+
+		Only DAC channels routed to the manual stream output the waveform,
+		see DeviceThread::setDacPlaybackChannel.
+	*/
+	class DacPlayer : public Thread
+	{
+	public:
+
+		/** Constructor*/
+		DacPlayer(DeviceThread* b);
+
+		/** Destructor*/
+		~DacPlayer();
+
+		/** Copies a waveform into a free buffer. frames holds numFrames x 8 DAC codes;
+		    loops = 0 repeats it until replaced or stopped. Returns false if both buffers are in use
+		    or the rate is above MAX_SAMPLE_RATE.*/
+		bool queue(const uint16* frames, int numFrames, double sampleRate, int loops);
+
+		/** Starts playing the queued waveforms at a sample number (or now if negative)*/
+		bool start(int64 startSample);
+
+		/** Stops playing, discards queued waveforms and sets all outputs to 0 V*/
+		void stop();
+
+		/** Returns true while waveforms are playing*/
+		bool isPlaying() const { return isThreadRunning(); }
+
+		/** Number of frames written since playback started*/
+		int64 getNumFramesWritten() const { return numWritten; }
+
+		/** Number of frames written more than one frame period late*/
+		int64 getNumLateFrames() const { return numLate; }
+
+		/** Writes the waveforms*/
+		void run() override;
+
+		static const int MAX_WAVEFORM_FRAMES = 65536;
+
+		/** Highest waveform rate the host-paced frame writes can follow, in Hz*/
+		static constexpr double MAX_SAMPLE_RATE = 1000.0;
+		static const uint16 DAC_MIDSCALE = 32768;
+
+	private:
+
+		enum BufferState
+		{
+			BUFFER_EMPTY = 0,
+			BUFFER_READY,
+			BUFFER_PLAYING
+		};
+
+		struct Waveform
+		{
+			std::vector<uint16> frames;
+			int numFrames = 0;
+			double sampleRate = 0.0;
+			int loops = 1;
+			uint32 order = 0;
+			std::atomic<int> state;
+		};
+
+		/** Returns the ready buffer queued first, or -1*/
+		int nextReadyBuffer() const;
+
+		/** Sleeps until the high resolution clock reaches ticks (to within half a millisecond)*/
+		bool waitUntil(int64 ticks);
+
+		/** Writes one frame from the pool*/
+		void writeFrame(const uint16* values);
+
+		DeviceThread* board;
+
+		std::array<Waveform, 2> buffers;
+		uint32 queueCounter;
+
+		static const int FRAME_POOL_SIZE = 16;
+		std::array<oni_frame_t*, FRAME_POOL_SIZE> framePool;
+		int nextFrame;
+
+		/** Serializes queue/start/stop*/
+		CriticalSection controlLock;
+
+		std::atomic<int64> requestedStart;
+		std::atomic<int64> numWritten;
+		std::atomic<int64> numLate;
+
+		JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(DacPlayer);
+	};
+
+}
+#endif  // __DACPLAYER_H_2C4CBD67__
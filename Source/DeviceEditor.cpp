@@ -64,7 +64,7 @@ DeviceEditor::DeviceEditor(GenericProcessor* parentNode,
     rescanButton->setRadius(3.0f);
     rescanButton->setBounds(6, 108, 65, 18);
     rescanButton->addListener(this);
-    rescanButton->setTooltip("Check for connected headstages");
+    rescanButton->setTooltip("Check for connected headstages (shift-click to re-detect cable delays)");
     addAndMakeVisible(rescanButton);
 
     // add sample rate selection
@@ -202,13 +202,23 @@ DeviceEditor::DeviceEditor(GenericProcessor* parentNode,
 
     addAndMakeVisible(ledButton);
 
+    board->addChangeListener(this);
+
+    if (board->getInitState() != DeviceThread::INIT_READY)
+        showInitState();
+
+}
+
+DeviceEditor::~DeviceEditor()
+{
+    board->removeChangeListener(this);
 }
 
 
-void DeviceEditor::measureImpedance()
+void DeviceEditor::measureImpedance(const Array<int>& channels)
 {
 
-    board->runImpedanceTest();
+    board->runImpedanceTest(channels);
 
     CoreServices::updateSignalChain(this);
 }
@@ -300,13 +310,28 @@ void DeviceEditor::buttonClicked(Button* button)
 {
     if (button == rescanButton && !acquisitionIsActive)
     {
-        board->scanPorts();
+        if (board->getInitState() == DeviceThread::INIT_FAILED)
+        {
+            board->retryInitialization();
+            return;
+        }
+
+        if (board->getInitState() != DeviceThread::INIT_READY)
+            return;
 
-        for (int i = 0; i < 4; i++)
+        if (board->isScanningPorts())
         {
-            headstageOptionsInterfaces[i]->checkEnabledState();
+            // clicking again stops the scan
+            board->cancelPortScan();
+            return;
         }
-        CoreServices::updateSignalChain(this);
+
+        setConfigurationEnabled(false);
+        rescanButton->setLabel("0%");
+        rescanButton->setTooltip("Click to stop scanning");
+
+        // the signal chain is updated once the scan has finished, see changeListenerCallback()
+        board->scanPortsAsync(ModifierKeys::getCurrentModifiers().isShiftDown());
     }
     else if (button == electrodeButtons[0] || button == electrodeButtons[1])
     {
@@ -335,13 +360,13 @@ void DeviceEditor::buttonClicked(Button* button)
                 button->getScreenBounds(),
                 nullptr);
     }
-    else if (button == auxButton && !acquisitionIsActive)
+    else if (button == auxButton && !acquisitionIsActive && !board->isScanningPorts())
     {
         board->enableAuxs(button->getToggleState());
         LOGD("AUX Button toggled");
         CoreServices::updateSignalChain(this);
     }
-    else if (button == adcButton && !acquisitionIsActive)
+    else if (button == adcButton && !acquisitionIsActive && !board->isScanningPorts())
     {
         board->enableAdcs(button->getToggleState());
         LOGD("ADC Button toggled");
@@ -352,7 +377,7 @@ void DeviceEditor::buttonClicked(Button* button)
     {
         board->setTTLoutputMode(dacTTLButton->getToggleState());
     }
-    else if (button == dspoffsetButton && !acquisitionIsActive)
+    else if (button == dspoffsetButton && !acquisitionIsActive && !board->isScanningPorts())
     {
         LOGD("DSP offset ", button->getToggleState());
         board->setDSPOffset(button->getToggleState());
@@ -364,6 +389,80 @@ void DeviceEditor::buttonClicked(Button* button)
 
 }
 
+void DeviceEditor::changeListenerCallback(ChangeBroadcaster* source)
+{
+    if (board->getInitState() != DeviceThread::INIT_READY)
+    {
+        showInitState();
+        return;
+    }
+
+    // settings loaded while the board was initializing
+    if (pendingParameters != nullptr)
+    {
+        std::unique_ptr<XmlElement> xml = std::move(pendingParameters);
+        loadVisualizerEditorParameters(xml.get());
+    }
+
+    if (board->isScanningPorts())
+    {
+        rescanButton->setLabel(String(roundToInt(board->getPortScanProgress() * 100.0f)) + "%");
+        return;
+    }
+
+    rescanButton->setLabel("RESCAN");
+    rescanButton->setTooltip("Check for connected headstages (shift-click to re-detect cable delays)");
+    setConfigurationEnabled(true);
+
+    for (int i = 0; i < 4; i++)
+    {
+        headstageOptionsInterfaces[i]->checkEnabledState();
+    }
+    CoreServices::updateSignalChain(this);
+}
+
+void DeviceEditor::showInitState()
+{
+    setConfigurationEnabled(false);
+
+    switch (board->getInitState())
+    {
+    case DeviceThread::INIT_OPENING:
+        rescanButton->setLabel("OPEN...");
+        rescanButton->setTooltip("Looking for the acquisition board");
+        break;
+    case DeviceThread::INIT_CALIBRATING:
+        rescanButton->setLabel("INIT...");
+        rescanButton->setTooltip("Calibrating the acquisition board");
+        break;
+    case DeviceThread::INIT_SCANNING:
+        rescanButton->setLabel("SCAN...");
+        rescanButton->setTooltip("Checking for connected headstages");
+        break;
+    case DeviceThread::INIT_FAILED:
+        rescanButton->setLabel("RETRY");
+        rescanButton->setTooltip("Acquisition board not found. Connect one and click to try again.");
+        break;
+    default:
+        break;
+    }
+}
+
+void DeviceEditor::setConfigurationEnabled(bool enabled)
+{
+    auxButton->setEnabledState(enabled);
+    adcButton->setEnabledState(enabled);
+    dspoffsetButton->setEnabledState(enabled);
+
+    // these change the streams or reprogram the board, which the port scan owns
+    for (auto* hsInterface : headstageOptionsInterfaces)
+        hsInterface->setEnabled(enabled);
+
+    sampleRateInterface->setEnabled(enabled);
+    bandwidthInterface->setEnabled(enabled);
+    dspInterface->setEnabled(enabled);
+}
+
 void DeviceEditor::startAcquisition()
 {
     rescanButton->setEnabledState(false);
@@ -387,6 +486,18 @@ void DeviceEditor::stopAcquisition()
 
 void DeviceEditor::saveVisualizerEditorParameters(XmlElement* xml)
 {
+    // keep the loaded settings until they could be applied
+    if (pendingParameters != nullptr)
+    {
+        for (int i = 0; i < pendingParameters->getNumAttributes(); i++)
+            xml->setAttribute(pendingParameters->getAttributeName(i), pendingParameters->getAttributeValue(i));
+
+        for (auto* child : pendingParameters->getChildIterator())
+            xml->addChildElement(new XmlElement(*child));
+
+        return;
+    }
+
     xml->setAttribute("SampleRate", sampleRateInterface->getSelectedId());
     xml->setAttribute("SampleRateString", sampleRateInterface->getText());
     xml->setAttribute("LowCut", bandwidthInterface->getLowerBandwidth());
@@ -403,6 +514,53 @@ void DeviceEditor::saveVisualizerEditorParameters(XmlElement* xml)
     xml->setAttribute("DSPCutoffFreq", dspInterface->getDspCutoffFreq());
     xml->setAttribute("save_impedance_measurements",saveImpedances);
     xml->setAttribute("auto_measure_impedances",measureWhenRecording);
+    xml->setAttribute("background_impedance_monitor", board->isImpedanceMonitorEnabled());
+    xml->setAttribute("artifact_settle", board->isArtifactSettleEnabled());
+    xml->setAttribute("artifact_settle_saturation", board->getArtifactSettleSaturation());
+    xml->setAttribute("artifact_settle_step", board->getArtifactSettleStep());
+    xml->setAttribute("artifact_settle_samples", board->getArtifactSettleSamples());
+
+    {
+        StringArray settleChannels;
+
+        for (int channel : board->getArtifactSettleChannels())
+            settleChannels.add(String(channel));
+
+        xml->setAttribute("artifact_settle_channels", settleChannels.joinIntoString(","));
+    }
+
+    xml->setAttribute("stim_blanking", board->isStimulusBlankingEnabled());
+    xml->setAttribute("stim_blanking_outputs", (int) board->getStimulusBlankingOutputTriggers());
+    xml->setAttribute("stim_blanking_inputs", (int) board->getStimulusBlankingInputTriggers());
+    xml->setAttribute("stim_blanking_samples", board->getStimulusBlankingWindow());
+    xml->setAttribute("stim_blanking_interpolate", board->isStimulusBlankingInterpolated());
+
+    {
+        StringArray blankedChannels;
+
+        for (int channel : board->getStimulusBlankingChannels())
+            blankedChannels.add(String(channel));
+
+        xml->setAttribute("stim_blanking_channels", blankedChannels.joinIntoString(","));
+    }
+
+    for (int adc = 0; adc < 8; adc++)
+    {
+        const String suffix = "_" + String(adc + 1);
+
+        xml->setAttribute("adc_threshold_enabled" + suffix, board->isAdcThresholdEnabled(adc));
+        xml->setAttribute("adc_threshold" + suffix, board->getAdcThreshold(adc));
+        xml->setAttribute("adc_threshold_hysteresis" + suffix, board->getAdcThresholdHysteresis(adc));
+        xml->setAttribute("adc_threshold_falling" + suffix, board->isAdcThresholdFalling(adc));
+        xml->setAttribute("adc_threshold_ttl_out" + suffix, board->getAdcThresholdOutput(adc));
+    }
+
+    xml->setAttribute("hotplug_probe", board->isHotplugProbeEnabled());
+    xml->setAttribute("hotplug_probe_interval", board->getHotplugProbeInterval());
+    xml->setAttribute("hotplug_auto_rescan", board->isHotplugAutoRescanEnabled());
+    xml->setAttribute("fast_restart", board->isFastRestartEnabled());
+    xml->setAttribute("log_ttl_outputs", board->isTtlOutputLoggingEnabled());
+    xml->setAttribute("ttl_command_port", board->getTtlCommandPort());
     xml->setAttribute("LEDs", ledButton->getToggleState());
     xml->setAttribute("ClockDivideRatio", clockInterface->getClockDivideRatio());
 
@@ -428,6 +586,12 @@ void DeviceEditor::saveVisualizerEditorParameters(XmlElement* xml)
 
 void DeviceEditor::loadVisualizerEditorParameters(XmlElement* xml)
 {
+    // applied once the board has been initialized, see changeListenerCallback()
+    if (board->getInitState() != DeviceThread::INIT_READY)
+    {
+        pendingParameters.reset(new XmlElement(*xml));
+        return;
+    }
 
     sampleRateInterface->setSelectedId(xml->getIntAttribute("SampleRate"));
     bandwidthInterface->setLowerBandwidth(xml->getDoubleAttribute("LowCut"));
@@ -443,6 +607,62 @@ void DeviceEditor::loadVisualizerEditorParameters(XmlElement* xml)
     dspInterface->setDspCutoffFreq(xml->getDoubleAttribute("DSPCutoffFreq"));
     saveImpedances = xml->getBoolAttribute("save_impedance_measurements");
     measureWhenRecording = xml->getBoolAttribute("auto_measure_impedances");
+    board->setImpedanceMonitorEnabled(xml->getBoolAttribute("background_impedance_monitor", false));
+    board->setArtifactSettleThresholds(
+        (float) xml->getDoubleAttribute("artifact_settle_saturation", board->getArtifactSettleSaturation()),
+        (float) xml->getDoubleAttribute("artifact_settle_step", board->getArtifactSettleStep()));
+    board->setArtifactSettleSamples(xml->getIntAttribute("artifact_settle_samples", board->getArtifactSettleSamples()));
+
+    {
+        Array<int> settleChannels;
+
+        for (const String& channel : StringArray::fromTokens(xml->getStringAttribute("artifact_settle_channels"), ",", ""))
+        {
+            if (channel.trim().isNotEmpty())
+                settleChannels.add(channel.getIntValue());
+        }
+
+        board->setArtifactSettleChannels(settleChannels);
+    }
+
+    board->setArtifactSettleEnabled(xml->getBoolAttribute("artifact_settle", false));
+
+    board->setStimulusBlankingTriggers((uint32) xml->getIntAttribute("stim_blanking_outputs", 0),
+                                       (uint32) xml->getIntAttribute("stim_blanking_inputs", 0));
+    board->setStimulusBlankingWindow(xml->getIntAttribute("stim_blanking_samples", board->getStimulusBlankingWindow()));
+    board->setStimulusBlankingInterpolation(xml->getBoolAttribute("stim_blanking_interpolate", false));
+
+    {
+        Array<int> blankedChannels;
+
+        for (const String& channel : StringArray::fromTokens(xml->getStringAttribute("stim_blanking_channels"), ",", ""))
+        {
+            if (channel.trim().isNotEmpty())
+                blankedChannels.add(channel.getIntValue());
+        }
+
+        board->setStimulusBlankingChannels(blankedChannels);
+    }
+
+    board->setStimulusBlankingEnabled(xml->getBoolAttribute("stim_blanking", false));
+
+    for (int adc = 0; adc < 8; adc++)
+    {
+        const String suffix = "_" + String(adc + 1);
+
+        board->setAdcThreshold(adc,
+            xml->getBoolAttribute("adc_threshold_enabled" + suffix, false),
+            (float) xml->getDoubleAttribute("adc_threshold" + suffix, board->getAdcThreshold(adc)),
+            (float) xml->getDoubleAttribute("adc_threshold_hysteresis" + suffix, board->getAdcThresholdHysteresis(adc)),
+            xml->getBoolAttribute("adc_threshold_falling" + suffix, false),
+            xml->getIntAttribute("adc_threshold_ttl_out" + suffix, -1));
+    }
+    board->setHotplugProbeInterval(xml->getIntAttribute("hotplug_probe_interval", board->getHotplugProbeInterval()));
+    board->setHotplugAutoRescan(xml->getBoolAttribute("hotplug_auto_rescan", false));
+    board->setHotplugProbeEnabled(xml->getBoolAttribute("hotplug_probe", true));
+    board->setFastRestart(xml->getBoolAttribute("fast_restart", false));
+    board->setTtlOutputLogging(xml->getBoolAttribute("log_ttl_outputs", false));
+    board->setTtlCommandPort(xml->getIntAttribute("ttl_command_port", 0));
     ledButton->setToggleState(xml->getBoolAttribute("LEDs", true),sendNotification);
     clockInterface->setClockDivideRatio(xml->getIntAttribute("ClockDivideRatio"));
 
@@ -532,7 +752,7 @@ BandwidthInterface::~BandwidthInterface()
 void BandwidthInterface::labelTextChanged(Label* label)
 {
 
-    if (!(editor->acquisitionIsActive) && board->foundInputSource())
+    if (!(editor->acquisitionIsActive) && !board->isScanningPorts() && board->foundInputSource())
     {
         if (label == upperBandwidthSelection)
         {
@@ -670,7 +890,7 @@ SampleRateInterface::~SampleRateInterface()
 
 void SampleRateInterface::comboBoxChanged(ComboBox* cb)
 {
-    if (!(editor->acquisitionIsActive) && board->foundInputSource())
+    if (!(editor->acquisitionIsActive) && !board->isScanningPorts() && board->foundInputSource())
     {
         if (cb == rateSelection)
         {
@@ -807,7 +1027,7 @@ void HeadstageOptionsInterface::checkEnabledState()
 void HeadstageOptionsInterface::buttonClicked(Button* button)
 {
 
-    if (!(editor->acquisitionIsActive) && board->foundInputSource())
+    if (!(editor->acquisitionIsActive) && !board->isScanningPorts() && board->foundInputSource())
     {
 
         if ((button == hsButton1) && (board->getChannelsInHeadstage(hsNumber1) == 32))
@@ -1065,7 +1285,7 @@ DSPInterface::~DSPInterface()
 void DSPInterface::labelTextChanged(Label* label)
 {
 
-    if (!(editor->acquisitionIsActive) && board->foundInputSource())
+    if (!(editor->acquisitionIsActive) && !board->isScanningPorts() && board->foundInputSource())
     {
         if (label == dspOffsetSelection)
         {
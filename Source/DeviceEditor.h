@@ -43,6 +43,7 @@ namespace ONIRhythmNode
 	class DeviceEditor : public VisualizerEditor, 
 						 public ComboBox::Listener, 
 						 public Button::Listener,
+						 public ChangeListener,
 					     public PopupChannelSelector::Listener
 
 	{
@@ -52,7 +53,7 @@ namespace ONIRhythmNode
 		DeviceEditor(GenericProcessor* parentNode, DeviceThread* thread);
 
 		/** Destructor*/
-		~DeviceEditor() { }
+		~DeviceEditor();
 
 		/** Respond to combo box changes (e.g. sample rate)*/
 		void comboBoxChanged(ComboBox* comboBox);
@@ -60,14 +61,17 @@ namespace ONIRhythmNode
 		/** Respond to button clicks*/
 		void buttonClicked(Button* button);
 
+		/** Responds to port scan progress and completion*/
+		void changeListenerCallback(ChangeBroadcaster* source) override;
+
 		/** Disable UI during acquisition*/
 		void startAcquisition();
 
 		/** Enable UI after acquisition is finished*/
 		void stopAcquisition();
 
-		/** Runs impedance test*/
-		void measureImpedance();
+		/** Runs impedance test on the given channels (all channels if empty)*/
+		void measureImpedance(const Array<int>& channels = Array<int>());
 
 		/** Saves impedance data to a file*/
 		void saveImpedance(File& file);
@@ -91,6 +95,12 @@ namespace ONIRhythmNode
 
 		void updateAudioChannel(int dacChannel, int channel);
 
+		/** Enables or disables the controls that change the headstage configuration*/
+		void setConfigurationEnabled(bool enabled);
+
+		/** Shows the initialization stage of the board on the rescan button*/
+		void showInitState();
+
 		OwnedArray<HeadstageOptionsInterface> headstageOptionsInterfaces;
 		OwnedArray<ElectrodeButton> electrodeButtons;
 
@@ -113,6 +123,9 @@ namespace ONIRhythmNode
 
 		bool saveImpedances, measureWhenRecording;
 
+		/** Saved parameters waiting for the board initialization to finish*/
+		std::unique_ptr<XmlElement> pendingParameters;
+
 		DeviceThread* board;
 		ChannelCanvas* canvas;
 
@@ -0,0 +1,112 @@
+/*
+    ------------------------------------------------------------------
+
+    This file is part of the Open Ephys GUI
+    Copyright (C) 2021 Open Ephys
+
+    ------------------------------------------------------------------
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "DeviceInitializer.h"
+
+using namespace ONIRhythmNode;
+
+#define INIT_OPEN_ATTEMPTS 5
+#define INIT_RETRY_INTERVAL_MS 1000
+
+DeviceInitializer::DeviceInitializer(DeviceThread* board_) :
+    Thread("Device Initializer"),
+    board(board_)
+{
+}
+
+DeviceInitializer::~DeviceInitializer()
+{
+    if (!stopThread(5000))
+        LOGE("Device initialization did not exit.");
+}
+
+void DeviceInitializer::run()
+{
+    for (int attempt = 1; ; attempt++)
+    {
+        board->setInitState(DeviceThread::INIT_OPENING);
+
+        // a board opened by an earlier attempt is only calibrated again
+        if (board->deviceFound || board->openBoard(attempt == 1))
+            break;
+
+        if (attempt >= INIT_OPEN_ATTEMPTS)
+        {
+            LOGC("Acquisition board not found after ", attempt, " attempts.");
+            board->setInitState(DeviceThread::INIT_FAILED);
+            return;
+        }
+
+        LOGC("  Checking again...");
+
+        wait(INIT_RETRY_INTERVAL_MS);
+
+        if (threadShouldExit())
+            return;
+    }
+
+    board->setInitState(DeviceThread::INIT_CALIBRATING);
+
+    if (!board->prepareBoard())
+    {
+        LOGE("Acquisition board did not respond during initialization.");
+        board->setInitState(DeviceThread::INIT_FAILED);
+        return;
+    }
+
+    if (!waitForBoardMemory())
+        return;
+
+    board->setInitState(DeviceThread::INIT_SCANNING);
+
+    // automatically find connected headstages
+    board->scanPorts(true);
+
+    board->finishInitialization();
+
+    board->setInitState(DeviceThread::INIT_READY);
+}
+
+bool DeviceInitializer::waitForBoardMemory()
+{
+    Rhd2000ONIBoard::BoardMemState memState = board->evalBoard->getBoardMemState();
+
+    if (memState != Rhd2000ONIBoard::BOARDMEM_INIT)
+        return true;
+
+    LOGC("On-board memory still initializing. This might take up to 20 seconds. Please wait.");
+
+    do
+    {
+        wait(500);
+
+        if (threadShouldExit())
+            return false;
+
+        memState = board->evalBoard->getBoardMemState();
+    } while (memState == Rhd2000ONIBoard::BOARDMEM_INIT);
+
+    LOGC("Memory init completed. Resuming plugin initialization.");
+
+    return true;
+}
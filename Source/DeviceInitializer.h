@@ -0,0 +1,68 @@
+/*
+    ------------------------------------------------------------------
+
+    This file is part of the Open Ephys GUI
+    Copyright (C) 2020 Open Ephys
+
+    ------------------------------------------------------------------
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef __DEVICEINITIALIZER_H_2C4CBD67__
+#define __DEVICEINITIALIZER_H_2C4CBD67__
+
+#include <DataThreadHeaders.h>
+
+#include "DeviceThread.h"
+
+namespace ONIRhythmNode
+{
+
+	/**
+		Opens, calibrates and scans the acquisition board in the background
+		when the plugin is created, so the GUI (and other plugins) are not
+		held up.
+
+		Opening is retried a few times before giving up; a failed
+		initialization can be restarted from the editor.
+
+		@see DeviceThread::InitState
+	*/
+	class DeviceInitializer : public Thread
+	{
+	public:
+
+		/** Constructor*/
+		DeviceInitializer(DeviceThread* b);
+
+		/** Destructor*/
+		~DeviceInitializer();
+
+		/** Runs the initialization*/
+		void run() override;
+
+	private:
+
+		/** Waits for the on-board memory to finish initializing. Returns false if the thread should exit.*/
+		bool waitForBoardMemory();
+
+		DeviceThread* board;
+
+		JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(DeviceInitializer);
+	};
+
+}
+#endif  // __DEVICEINITIALIZER_H_2C4CBD67__
@@ -29,6 +29,19 @@
 #include "DeviceEditor.h"
 
 #include "ImpedanceMeter.h"
+#include "PortScanner.h"
+#include "HotplugMonitor.h"
+#include "DeviceInitializer.h"
+#include "TtlOutputWriter.h"
+#include "PulseScheduler.h"
+#include "TtlCommandServer.h"
+#include "PatternSequencer.h"
+#include "DacPlayer.h"
+#include "ImpedanceMonitor.h"
+#include "ArtifactSettle.h"
+#include "StimulusBlanker.h"
+#include "AdcThresholdDetector.h"
+#include "AcquisitionConfig.h"
 #include "Headstage.h"
 
 #include <sstream>
@@ -49,7 +62,8 @@ using namespace ONIRhythmNode;
 //#define DEBUG_EMULATE_HEADSTAGES 8
 //#define DEBUG_EMULATE_64CH
 
-#define INIT_STEP 64
+#define SPI_COMPLETION_TIMEOUT_MS 1000 // a single run of INIT_STEP samples takes a few ms
+#define SCAN_SETTLE_SEQUENCES 2 // command sequences discarded after changing the cable delays during a port scan
 
 //#define DEBUG_OVERRIDE
 //#define SYS_DEBUG
@@ -76,10 +90,42 @@ DeviceThread::DeviceThread(SourceNode* sn) : DataThread(sn),
     isTransmitting(false),
     channelNamingScheme(GLOBAL_INDEX),
     updateSettingsDuringAcquisition(false),
-    commonCommandsSet(false)
+    commonCommandsSet(false),
+    portScanRunning(false),
+    portScanCancelled(false),
+    portScanProgress(0.0f),
+    headstageDigOut(0),
+    lastDigOutLatencyUs(0.0),
+    dacPlaybackChannels(0),
+    sampleClockVersion(0),
+    sampleClockSample(-1),
+    sampleClockTicks(0),
+    initState(INIT_OPENING)
 {
 
     impedanceThread = new ImpedanceMeter(this);
+    impedanceMonitor = new ImpedanceMonitor(this);
+    portScanner = new PortScanner(this);
+    hotplugMonitor = new HotplugMonitor(this);
+    ttlWriter = new TtlOutputWriter(this);
+    pulseScheduler = new PulseScheduler();
+    ttlCommandServer = new TtlCommandServer(this);
+    patternSequencer = new PatternSequencer();
+    dacPlayer = new DacPlayer(this);
+    artifactSettle = new ArtifactSettle(this);
+    stimulusBlanker = new StimulusBlanker(this);
+    adcDetector = new AdcThresholdDetector();
+
+    impedanceHistory = new ImpedanceHistory(
+        CoreServices::getSavedStateDirectory().getChildFile("rhythm-oni-impedance-history.bin"));
+    impedanceHistory->load();
+
+    for (auto& delays : sampleRateDelays)
+        delays.fill(-1);
+
+    cableDelayCache = new CableDelayCache(
+        CoreServices::getSavedStateDirectory().getChildFile("rhythm-oni-cable-delays.xml"));
+    cableDelayCache->load();
 
     memset(auxBuffer, 0, sizeof(auxBuffer));
     memset(auxSamples, 0, sizeof(auxSamples));
@@ -87,6 +133,10 @@ DeviceThread::DeviceThread(SourceNode* sn) : DataThread(sn),
     for (int i = 0; i < 8; i++)
         adcRangeSettings[i] = 0;
 
+    publishedConfig = nullptr;
+    configInUse = nullptr;
+    publishAcquisitionConfig();
+
     int maxNumHeadstages =  8;
 
     for (int i = 0; i < maxNumHeadstages; i++)
@@ -112,85 +162,112 @@ DeviceThread::DeviceThread(SourceNode* sn) : DataThread(sn),
     dacThresholds = new float[8];
     dacChannelsToUpdate = new bool[8];
 
-    if (openBoard(true))
+    for (int k = 0; k < 8; k++)
     {
-        int minor, major;
-        if (evalBoard->getFirmwareVersion(&major, &minor))
+        dacChannelsToUpdate[k] = true;
+        dacStream[k] = 0;
+        dacChannels[k] = 0;
+        dacThresholds[k] = 0;
+    }
+
+    MAX_NUM_DATA_STREAMS = evalBoard->MAX_NUM_DATA_STREAMS;
+    MAX_NUM_HEADSTAGES = MAX_NUM_DATA_STREAMS / 2;
+
+    // Open, calibrate and scan the board in the background, so the GUI is not held up.
+    // The editor follows the progress through change messages.
+    deviceInitializer = new DeviceInitializer(this);
+    deviceInitializer->startThread();
+}
+
+bool DeviceThread::prepareBoard()
+{
+    int minor, major;
+    if (evalBoard->getFirmwareVersion(&major, &minor))
+    {
+        LOGC("Open Ephys ECP5-ONI FPGA open. Gateware version v", major, ".", minor);
+        if ((major << 8) + minor < 0x0003)
         {
-            LOGC("Open Ephys ECP5-ONI FPGA open. Gateware version v", major, ".", minor);
-            if ((major << 8) + minor < 0x0003)
-            {
-                LOGC("This version of FPGA gateware is not compatible with variable sample rates. Please update it to gain that functionality");
-                varSampleRateCapable = false;
-            }
-            else
-            {
-                varSampleRateCapable = true;
-            }
-            if ((major << 8) + minor <= 0x0004)
-            {
-                regOffset = 1;
-            }
-            else
-            {
-                regOffset = 0;
-            }
+            LOGC("This version of FPGA gateware is not compatible with variable sample rates. Please update it to gain that functionality");
+            varSampleRateCapable = false;
         }
         else
         {
-            LOGE("Could not read fw version");
-            varSampleRateCapable = false;
+            varSampleRateCapable = true;
         }
-        dataBlock = new Rhd2000DataBlock(1, evalBoard->isUSB3());
+        if ((major << 8) + minor <= 0x0004)
+        {
+            regOffset = 1;
+        }
+        else
+        {
+            regOffset = 0;
+        }
+    }
+    else
+    {
+        LOGE("Could not read fw version");
+        varSampleRateCapable = false;
+    }
+    dataBlock = new Rhd2000DataBlock(1, evalBoard->isUSB3());
 
-        // upload bitfile and restore default settings
-        initializeBoard();
+    // upload bitfile and restore default settings
+    if (!initializeBoard())
+        return false;
 
-        if (evalBoard->isUSB3())
-            LOGD("USB3 board mode enabled");
+    if (evalBoard->isUSB3())
+        LOGD("USB3 board mode enabled");
 
-        MAX_NUM_DATA_STREAMS = evalBoard->MAX_NUM_DATA_STREAMS;
-        MAX_NUM_HEADSTAGES = MAX_NUM_DATA_STREAMS / 2;
+    MAX_NUM_DATA_STREAMS = evalBoard->MAX_NUM_DATA_STREAMS;
+    MAX_NUM_HEADSTAGES = MAX_NUM_DATA_STREAMS / 2;
 
-        //std::cout << "MAX NUM STREAMS: " << MAX_NUM_DATA_STREAMS << ", MAX NUM HEADSTAGES: " << MAX_NUM_HEADSTAGES << std::endl;
+    //std::cout << "MAX NUM STREAMS: " << MAX_NUM_DATA_STREAMS << ", MAX NUM HEADSTAGES: " << MAX_NUM_HEADSTAGES << std::endl;
 
-        Rhd2000ONIBoard::BoardMemState memState;
-        memState = evalBoard->getBoardMemState();
-        if (memState != Rhd2000ONIBoard::BOARDMEM_INVALID)
-        {
-            if (memState == Rhd2000ONIBoard::BOARDMEM_INIT)
-            {
-                LOGC("On-board memory still initializing. This might take up to 20 seconds. Please wait.");
-                do
-                {
-                    Thread::sleep(500);
-                    memState = evalBoard->getBoardMemState();
-                } while (memState == Rhd2000ONIBoard::BOARDMEM_INIT);
-                LOGC("Memory init completed. Resuming plugin initialization.")
-            }
-        }
+    return true;
+}
 
-        // automatically find connected headstages
-        scanPorts(true); // things would appear to run more smoothly if this were done after the editor has been created
+void DeviceThread::finishInitialization()
+{
+    for (int k = 0; k < 8; k++)
+        setDACthreshold(k, 65534);
 
-        for (int k = 0; k < 8; k++)
-        {
-            dacChannelsToUpdate[k] = true;
-            dacStream[k] = 0;
-            setDACthreshold(k, 65534);
-            dacChannels[k] = 0;
-            dacThresholds[k] = 0;
-        }
+    // ensure DSP settings are initialized
+    setDspCutoffFreq(settings.dsp.cutoffFreq);
+    setDSPOffset(settings.dsp.enabled);
+}
+
+void DeviceThread::setInitState(InitState state)
+{
+    initState = state;
+
+    // posted to the message thread, where the editor follows the progress
+    sendChangeMessage();
 
-        // ensure DSP settings are initialized
-        setDspCutoffFreq(settings.dsp.cutoffFreq);
-        setDSPOffset(settings.dsp.enabled);
+    if (state == INIT_READY)
+    {
+        // watch for headstages being plugged in while idle
+        hotplugMonitor->resume();
     }
 }
 
+void DeviceThread::retryInitialization()
+{
+    if (initState != INIT_FAILED || deviceInitializer->isThreadRunning())
+        return;
+
+    deviceInitializer->startThread();
+}
+
 DeviceThread::~DeviceThread()
 {
     LOGD( "RHD2000 interface destroyed." );
+    portScanCancelled = true;
+    deviceInitializer = nullptr;
+    ttlCommandServer = nullptr;
+    patternSequencer = nullptr;
+    dacPlayer = nullptr;
+    ttlWriter = nullptr;
+    hotplugMonitor = nullptr;
+    portScanner = nullptr;
  //   const ScopedLock lock(oniLock);
     delete[] dacStream;
     delete[] dacChannels;
@@ -234,63 +311,350 @@ void DeviceThread::handleBroadcastMessage(String msg)
         {
             String command = parts[1];
 
-            if (command.equalsIgnoreCase("TRIGGER"))
+            if (command.equalsIgnoreCase("PATTERN"))
+            {
+                handlePatternMessage(parts);
+                return;
+            }
+
+            if (command.equalsIgnoreCase("HSDIGOUT"))
             {
+                // ACQBOARD HSDIGOUT <port A-D> <0|1>
                 if (parts.size() == 4)
                 {
-                    int ttlLine = parts[2].getIntValue() - 1;
+                    const int port = parts[2].toUpperCase()[0] - 'A';
 
-                    if (ttlLine < 0 || ttlLine > 7)
-                        return;
+                    if (port < 0 || port > 3
+                        || !setHeadstageDigOut(static_cast<Rhd2000ONIBoard::BoardPort>(port), parts[3].getIntValue() != 0))
+                        LOGE("Headstage digital output command rejected: ", msg);
+                }
+                return;
+            }
 
+            // string forms of the TTL commands, see executeTtlCommand()
+            TtlCommand ttl;
+
+            if (command.equalsIgnoreCase("TRIGGER"))
+            {
+                // ACQBOARD TRIGGER <line> <ms>
+                if (parts.size() == 4)
+                {
                     int eventDurationMs = parts[3].getIntValue();
 
                     if (eventDurationMs < 10 || eventDurationMs > 5000)
                         return;
 
-                    DigitalOutputCommand command;
-                    command.ttlLine = ttlLine;
-                    command.state = true;
+                    ttl.type = TTL_PULSE;
+                    ttl.timeUnit = TTL_MICROSECONDS;
+                    ttl.duration = int64(eventDurationMs) * 1000;
+                }
+            }
+            else if (command.equalsIgnoreCase("PULSE"))
+            {
+                // ACQBOARD PULSE <line> <start sample> <samples>
+                if (parts.size() == 5)
+                {
+                    ttl.type = TTL_PULSE;
+                    ttl.start = parts[3].getLargeIntValue();
+                    ttl.duration = parts[4].getLargeIntValue();
+                }
+            }
+            else if (command.equalsIgnoreCase("TRAIN"))
+            {
+                // ACQBOARD TRAIN <line> <start sample> <samples> <period samples> <count>
+                if (parts.size() == 7)
+                {
+                    ttl.type = TTL_PULSE_TRAIN;
+                    ttl.start = parts[3].getLargeIntValue();
+                    ttl.duration = parts[4].getLargeIntValue();
+                    ttl.period = parts[5].getLargeIntValue();
+                    ttl.count = uint32(jmax(0, parts[6].getIntValue()));
+                }
+            }
+            else if (command.equalsIgnoreCase("LEVEL"))
+            {
+                // ACQBOARD LEVEL <line> <0|1> [start sample]
+                if (parts.size() == 4 || parts.size() == 5)
+                {
+                    ttl.type = TTL_LEVEL;
+                    ttl.level = parts[3].getIntValue() != 0 ? 1 : 0;
+                    ttl.start = parts.size() == 5 ? parts[4].getLargeIntValue() : -1;
+                }
+            }
+            else
+            {
+                return;
+            }
 
-                    digitalOutputCommands.push(command);
+            if (ttl.duration == 0 && ttl.type != TTL_LEVEL)
+                return;
 
-                    DigitalOutputTimer* timer = new DigitalOutputTimer(this, ttlLine, eventDurationMs);
-                    
-                    digitalOutputTimers.add(timer);
+            // lines are numbered 1-8; a missing or non-numeric line is rejected
+            const String line = parts[2];
 
-                }
+            if (line.isEmpty() || !line.containsOnly("0123456789")
+                || line.getIntValue() < 1 || line.getIntValue() > NUM_TTL_OUTPUT_LINES)
+            {
+                LOGE("TTL command rejected, invalid line: ", msg);
+                return;
             }
+
+            ttl.line = uint8(line.getIntValue() - 1);
+
+            if (!executeTtlCommand(ttl))
+                LOGE("TTL command rejected: ", msg);
         }
     }
 
 }
 
 
-void DeviceThread::addDigitalOutputCommand(DigitalOutputTimer* timerToDelete, int ttlLine, bool state)
+bool DeviceThread::executeTtlCommand(const TtlCommand& command)
 {
-    DigitalOutputCommand command;
-    command.ttlLine = ttlLine;
-    command.state = state;
+    if (!isTransmitting)
+        return false;
+
+    auto toSamples = [&](int64 value) -> int64
+    {
+        if (command.timeUnit == TTL_MICROSECONDS)
+            return (value * int64(settings.boardSampleRate) + 500000) / 1000000;
 
-    digitalOutputCommands.push(command);
+        return value;
+    };
 
-    digitalOutputTimers.removeObject(timerToDelete);
+    switch (command.type)
+    {
+    case TTL_PULSE:
+    {
+        int64 start = command.start;
+        int64 clockSample, clockTicks;
+
+        // The scheduler only raises the line when the acquisition thread reaches the next sample,
+        // up to one block read from now, so the line is raised right away. The falling edge is
+        // scheduled from the sample being acquired now, so the pulse keeps its length.
+        if (start < 0 && getSampleClock(clockSample, clockTicks))
+        {
+            const double elapsed = Time::highResolutionTicksToSeconds(Time::getHighResolutionTicks() - clockTicks);
+            start = clockSample + int64(elapsed * settings.boardSampleRate);
+        }
+
+        if (!pulseScheduler->schedule(command.line, start, jmax(int64(1), toSamples(command.duration))))
+            return false;
+
+        if (command.start < 0)
+            ttlWriter->push(1u << command.line, 1u << command.line);
+
+        return true;
+    }
+    case TTL_PULSE_TRAIN:
+        return pulseScheduler->schedule(command.line, command.start, jmax(int64(1), toSamples(command.duration)),
+                                        toSamples(command.period), int(jmin(command.count, uint32(std::numeric_limits<int>::max()))));
+    case TTL_LEVEL:
+        return pulseScheduler->setLevel(command.line, command.level != 0, command.start);
+    case TTL_PATTERN_START:
+        return patternSequencer->start(command.start);
+    case TTL_PATTERN_STOP:
+        patternSequencer->stop();
+        return true;
+    case TTL_PATTERN_ABORT:
+        patternSequencer->abort();
+        return true;
+    default:
+        return false;
+    }
 }
 
-DeviceThread::DigitalOutputTimer::DigitalOutputTimer(DeviceThread* board_, int ttlLine_, int eventDurationMs)
-    : board(board_)
+void DeviceThread::handlePatternMessage(const StringArray& parts)
 {
+    const String action = parts[2];
 
-    tllOutputLine = ttlLine_;
+    if (action.equalsIgnoreCase("LOAD"))
+    {
+        // ACQBOARD PATTERN LOAD <repetitions> <interval samples> <line>:<on sample>:<off sample> ...
+        Array<TtlPatternPulse> pulses;
 
-    startTimer(eventDurationMs);
+        for (int i = 5; i < parts.size(); i++)
+        {
+            StringArray fields = StringArray::fromTokens(parts[i], ":", "");
+
+            if (fields.size() != 3)
+            {
+                LOGE("Invalid TTL pattern pulse: ", parts[i]);
+                return;
+            }
+
+            pulses.add({ fields[0].getIntValue() - 1, fields[1].getLargeIntValue(), fields[2].getLargeIntValue() });
+        }
+
+        if (!loadTtlPattern(pulses, parts[3].getIntValue(), parts[4].getLargeIntValue()))
+            LOGE("TTL pattern rejected");
+    }
+    else if (action.equalsIgnoreCase("START"))
+    {
+        // ACQBOARD PATTERN START [start sample]
+        if (!startTtlPattern(parts.size() > 3 ? parts[3].getLargeIntValue() : -1))
+            LOGE("Could not start TTL pattern");
+    }
+    else if (action.equalsIgnoreCase("STOP"))
+    {
+        stopTtlPattern();
+    }
+    else if (action.equalsIgnoreCase("ABORT"))
+    {
+        abortTtlPattern();
+    }
+}
+
+bool DeviceThread::loadTtlPattern(const Array<TtlPatternPulse>& pulses, int repetitions, int64 interval, int64 trainLength)
+{
+    return patternSequencer->load(pulses, repetitions, interval, trainLength);
+}
+
+bool DeviceThread::startTtlPattern(int64 startSample)
+{
+    if (!isTransmitting)
+        return false;
+
+    return patternSequencer->start(startSample);
+}
+
+void DeviceThread::stopTtlPattern()
+{
+    patternSequencer->stop();
+}
+
+void DeviceThread::abortTtlPattern()
+{
+    patternSequencer->abort();
+}
+
+bool DeviceThread::isTtlPatternPlaying() const
+{
+    return patternSequencer->isPlaying();
+}
+
+void DeviceThread::addTtlPatternListener(TtlPatternListener* listener)
+{
+    patternSequencer->addListener(listener);
+}
+
+void DeviceThread::removeTtlPatternListener(TtlPatternListener* listener)
+{
+    patternSequencer->removeListener(listener);
+}
+
+bool DeviceThread::queueDacWaveform(const uint16* frames, int numFrames, double sampleRate, int loops)
+{
+    return dacPlayer->queue(frames, numFrames, sampleRate, loops);
+}
+
+bool DeviceThread::startDacPlayback(int64 startSample)
+{
+    if (!isTransmitting)
+        return false;
+
+    return dacPlayer->start(startSample);
+}
+
+void DeviceThread::stopDacPlayback()
+{
+    dacPlayer->stop();
+}
+
+bool DeviceThread::isDacPlaying() const
+{
+    return dacPlayer->isPlaying();
+}
+
+void DeviceThread::setDacPlaybackChannel(int dacOutput, bool enabled)
+{
+    if (dacOutput < 0 || dacOutput > 7)
+        return;
+
+    if (enabled)
+        dacPlaybackChannels |= 1 << dacOutput;
+    else
+        dacPlaybackChannels &= ~(1 << dacOutput);
+
+    dacChannelsToUpdate[dacOutput] = true;
+    updateSettingsDuringAcquisition = true;
+}
+
+bool DeviceThread::setHeadstageDigOut(Rhd2000ONIBoard::BoardPort port, bool high)
+{
+    if (!deviceFound || initState != INIT_READY || port > Rhd2000ONIBoard::PortD)
+        return false;
+
+    const int64 startTicks = Time::getHighResolutionTicks();
+
+    const ScopedLock lock(digOutLock);
+
+    if (high)
+        headstageDigOut |= 1 << int(port);
+    else
+        headstageDigOut &= ~(1 << int(port));
+
+    // while Zcheck owns AuxCmd1, the impedance meter or monitor restores the new bank when it is done
+    if (!impedanceThread->isZcheckBankSelected()
+        && (!impedanceMonitorActive || !impedanceMonitor->isZcheckBankSelected()))
+    {
+        const ScopedLock oniScopedLock(oniLock);
+        evalBoard->selectAuxCommandBank(port, Rhd2000ONIBoard::AuxCmd1, getDigOutBank(port));
+    }
+
+    const double writeUs = Time::highResolutionTicksToSeconds(Time::getHighResolutionTicks() - startTicks) * 1.0e6;
+    lastDigOutLatencyUs = writeUs + 1.0e6 / settings.boardSampleRate;
+
+    LOGD("Headstage digital output on port ", String::charToString('A' + int(port)), " set ",
+         high ? "high" : "low", " (", lastDigOutLatencyUs.load(), " us)");
+
+    return true;
 }
 
-void DeviceThread::DigitalOutputTimer::timerCallback()
+bool DeviceThread::getHeadstageDigOut(Rhd2000ONIBoard::BoardPort port) const
 {
-    stopTimer();
+    return (headstageDigOut & (1 << int(port))) != 0;
+}
 
-    board->addDigitalOutputCommand(this, tllOutputLine, false);
+int DeviceThread::getDigOutBank(Rhd2000ONIBoard::BoardPort port) const
+{
+    return getHeadstageDigOut(port) ? AUXCMD1_DIGOUT_HIGH_BANK : AUXCMD1_DIGOUT_LOW_BANK;
+}
+
+bool DeviceThread::getSampleClock(int64& sampleNumber, int64& ticks) const
+{
+    uint32 version;
+
+    do
+    {
+        version = sampleClockVersion;
+        sampleNumber = sampleClockSample;
+        ticks = sampleClockTicks;
+    } while ((version & 1) != 0 || version != sampleClockVersion);
+
+    return sampleNumber >= 0;
+}
+
+void DeviceThread::setTtlCommandPort(int port)
+{
+    ttlCommandServer->setPort(port);
+}
+
+int DeviceThread::getTtlCommandPort() const
+{
+    return ttlCommandServer->getPort();
+}
+
+int64 DeviceThread::getCurrentSampleNumber() const
+{
+    return pulseScheduler->getLastSampleNumber();
+}
+
+void DeviceThread::setTtlOutputLogging(bool enabled)
+{
+    settings.logTtlOutputs = enabled;
+
+    publishAcquisitionConfig();
 }
 
 void DeviceThread::setDACthreshold(int dacOutput, float threshold)
@@ -373,37 +737,21 @@ bool DeviceThread::openBoard(bool displayInfo)
     }
     else   // board could not be opened
     {
-
-        LOGC("No ONI device found. Is one connected?")
-
-        bool response = AlertWindow::showOkCancelBox(AlertWindow::NoIcon,
-                                                     "Acquisition board not found.",
-                                                     "An acquisition board could not be found. Please connect one now.",
-                                                     "OK", "Cancel", 0, 0);
-
-        if (response)
-        {
-            LOGC("  Checking again...");
-            openBoard(); // call recursively
-        }
-        else
-        {
-            LOGC("  User canceled device search.");
-            deviceFound = false;
-        }
-
+        LOGC("No ONI device found. Is one connected?");
+        deviceFound = false;
     }
 
     return deviceFound;
 
 }
 
-void DeviceThread::initializeBoard()
+bool DeviceThread::initializeBoard()
 {
     // Initialize the board
     LOGD("Initializing RHD2000 board.");
     SLOGD("DBG: 0");
     evalBoard->initialize();
+    uploadedRegisterConfig = String();
     // This applies the following settings:
     //  - sample rate to 30 kHz
     //  - aux command banks to zero
@@ -439,9 +787,15 @@ void DeviceThread::initializeBoard()
     evalBoard->run();
     SLOGD("DBG: D");
     // Wait for the 60-sample run to complete
-    while (evalBoard->isRunning())
+    Rhd2000ONIBoard::WaitStatus status = evalBoard->waitForSpiCompletion(SPI_COMPLETION_TIMEOUT_MS);
+
+    if (status != Rhd2000ONIBoard::WAIT_DONE)
     {
-        ;
+        LOGE("ADC calibration run did not complete (", status == Rhd2000ONIBoard::WAIT_TIMEOUT ? "timeout" : "register read error", ")");
+
+        const ScopedLock lock(oniLock);
+        evalBoard->stop();
+        return false;
     }
     
     SLOGD("DBG: E");
@@ -473,17 +827,22 @@ void DeviceThread::initializeBoard()
         ttlLineNames.add("TTL" + String(i + 1));
     }
 
+    return true;
 }
 
-void DeviceThread::scanPorts(bool initialScan)
+void DeviceThread::scanPorts(bool initialScan, bool fullScan)
 {
     if (!deviceFound) //Safety to avoid crashes if board not present
     {
         return;
     }
     if (!checkBoardMem()) return;
+
+    const ScopedLock scanLock(portScanLock);
+
     SLOGD("DBG: SA");
     impedanceThread->stopThreadSafely();
+    flushStaleFrames();
 
     //Clear previous known streams
     enabledStreams.clear();
@@ -522,6 +881,8 @@ void DeviceThread::scanPorts(bool initialScan)
     SLOGD("DBG: SB");
 
     setSampleRate(Rhd2000ONIBoard::SampleRate30000Hz, true, false); // set to 30 kHz temporarily
+
+    setPortScanProgress(0.05f);
     
     SLOGD("DBG: SC");
     // Enable all data streams, and set sources to cover one or two chips
@@ -565,40 +926,66 @@ void DeviceThread::scanPorts(bool initialScan)
     Array<int> indexSecondGoodDelay;
     indexSecondGoodDelay.insertMultiple(0, -1, 8);
 
+    // Try the delays found by the last scan of this board first.
+    Array<int> cachedDelays;
+    cachedDelays.insertMultiple(0, 0, 4);
+
+    bool delaysVerified = !fullScan && verifyCachedDelays(dataBlock, tmpChipId, cachedDelays);
+
+    if (delaysVerified)
+        LOGD("Cached cable delays verified, skipping delay sweep");
+
     // Run SPI command sequence at all 16 possible FPGA MISO delay settings
-    // to find optimum delay for each SPI interface cable.
+    // to find optimum delay for each SPI interface cable. The command sequence
+    // runs continuously; the delays are changed between bursts, and a port stops
+    // sweeping as soon as its optimum delay is known.
 
     LOGD( "Checking for connected amplifier chips..." );
 
-    for (delay = 0; delay < 16; delay++)
-    {
-        LOGD("Setting delay to: ", delay);
+    Array<bool> portDone;
+    portDone.insertMultiple(0, false, 4);
 
+    std::vector<int> commandList;
+    const int sequenceLength = chipRegisters.createCommandListRegisterConfig(commandList, true);
+    int64 sampleCount = 0;
 
-        evalBoard->setCableDelay(Rhd2000ONIBoard::PortA, delay);
-        evalBoard->setCableDelay(Rhd2000ONIBoard::PortB, delay);
-        evalBoard->setCableDelay(Rhd2000ONIBoard::PortC, delay);
-        evalBoard->setCableDelay(Rhd2000ONIBoard::PortD, delay);
+    if (!delaysVerified)
+    {
+        evalBoard->setContinuousRunMode(true);
 
         // Start SPI interface.
         evalBoard->run();
+    }
+
+    for (delay = 0; delay < 16 && !delaysVerified; delay++)
+    {
+        if (portScanCancelled)
+        {
+            LOGD("Port scan cancelled");
+            break;
+        }
 
-        // Wait for the 60-sample run to complete. //Not needed now.
-    /*    while (evalBoard->isRunning())
+        LOGD("Setting delay to: ", delay);
+
+        for (int port = 0; port < 4; port++)
         {
-            ;
-        }*/
-        // Read the resulting single data block from the USB interface.
-        evalBoard->readDataBlock(dataBlock, INIT_STEP);
+            if (!portDone[port])
+                evalBoard->setCableDelay(static_cast<Rhd2000ONIBoard::BoardPort>(port), delay);
+        }
+
+        // Read one complete command sequence sent with the new delays.
+        if (!readScanBurst(dataBlock, sequenceLength, sampleCount))
         {
-            const ScopedLock lock(oniLock);
-            evalBoard->stop();
+            LOGE("Error reading data while scanning ports");
+            break;
         }
 
         // Read the Intan chip ID number from each RHD2000 chip found.
         // Record delay settings that yield good communication with the chip.
         for (hs = 0; hs < headstages.size(); ++hs)
         {
+            if (portDone[hs / 2] || sumGoodDelays[hs] < 0)
+                continue;
 
             id = getDeviceId(dataBlock, hs, register59Value);
 
@@ -622,9 +1009,60 @@ void DeviceThread::scanPorts(bool initialScan)
                     tmpChipId.set(hs, id);
                 }
             }
+            else if (sumGoodDelays[hs] > 0 && sumGoodDelays[hs] <= 2)
+            {
+                // the window of good delays has closed; the first good delay is the optimum
+                sumGoodDelays.set(hs, -sumGoodDelays[hs]);
+            }
+        }
+
+        // A headstage is settled once a third good delay is found, or its window of good
+        // delays has closed. A port is done once one of its headstages is settled and the
+        // other one is settled too or has not answered at all.
+        bool allDone = true;
+
+        for (int port = 0; port < 4; port++)
+        {
+            bool anySettled = false;
+            bool allSettled = true;
+
+            for (int i = port * 2; i < port * 2 + 2; i++)
+            {
+                bool settled = sumGoodDelays[i] < 0 || sumGoodDelays[i] > 2;
+
+                anySettled = anySettled || settled;
+                allSettled = allSettled && (settled || sumGoodDelays[i] == 0);
+            }
+
+            if (!portDone[port] && anySettled && allSettled)
+            {
+                LOGD("Port ", String::charToString('A' + port), " delay found after ", delay + 1, " steps");
+                portDone.set(port, true);
+            }
+
+            allDone = allDone && portDone[port];
         }
+
+        setPortScanProgress(0.05f + 0.65f * float(delay + 1) / 16.0f);
+
+        if (allDone)
+            break;
     }
 
+    if (!delaysVerified)
+    {
+        {
+            const ScopedLock lock(oniLock);
+            evalBoard->stop();
+        }
+
+        evalBoard->setContinuousRunMode(false);
+    }
+
+    // Headstages whose window of good delays closed were marked with a negative count
+    for (hs = 0; hs < headstages.size(); ++hs)
+        sumGoodDelays.set(hs, std::abs(sumGoodDelays[hs]));
+
 #if DEBUG_EMULATE_HEADSTAGES > 0
     if (tmpChipId[0] > 0)
     {
@@ -649,80 +1087,343 @@ void DeviceThread::scanPorts(bool initialScan)
         }
     }
 
-#else
-    // Now, disable data streams where we did not find chips present.
-    int chipIdx = 0;
+#else
+    // Now, disable data streams where we did not find chips present.
+    numChannelsPerDataStream.clear();
+
+    for (int hs = 0; hs < headstages.size(); ++hs)
+        enableDetectedHeadstage(hs, tmpChipId[hs]);
+#endif
+    headstageChipIds = tmpChipId;
+
+    updateBoardStreams();
+
+    setPortScanProgress(0.75f);
+
+    LOGD( "Number of enabled data streams: ", evalBoard->getNumEnabledDataStreams() );
+
+    // Set cable delay settings that yield good communication with each
+    // RHD2000 chip.
+    Array<int> optimumDelay;
+
+    optimumDelay.insertMultiple(0, 0, headstages.size());
+
+    for (hs = 0; hs < headstages.size(); ++hs)
+    {
+        if (sumGoodDelays[hs] == 1 || sumGoodDelays[hs] == 2)
+        {
+            optimumDelay.set(hs,indexFirstGoodDelay[hs]);
+        }
+        else if (sumGoodDelays[hs] > 2)
+        {
+            optimumDelay.set(hs,indexSecondGoodDelay[hs]);
+        }
+    }
+
+    if (delaysVerified)
+    {
+        settings.optimumDelay.portA = cachedDelays[0];
+        settings.optimumDelay.portB = cachedDelays[1];
+        settings.optimumDelay.portC = cachedDelays[2];
+        settings.optimumDelay.portD = cachedDelays[3];
+    }
+    else
+    {
+        settings.optimumDelay.portA = std::max(optimumDelay[0], optimumDelay[1]);
+        settings.optimumDelay.portB = std::max(optimumDelay[2], optimumDelay[3]);
+        settings.optimumDelay.portC = std::max(optimumDelay[4], optimumDelay[5]);
+        settings.optimumDelay.portD = std::max(optimumDelay[6], optimumDelay[7]);
+
+        // an interrupted sweep is not worth remembering
+        if (!portScanCancelled)
+            storeCableDelays(tmpChipId);
+    }
+
+    updateSampleRateDelayKeys(tmpChipId);
+
+    // a known rig also skips the delay checks at the saved sample rate
+    if (delaysVerified)
+        loadSampleRateDelays();
+
+    evalBoard->setCableDelay(Rhd2000ONIBoard::PortA, settings.optimumDelay.portA);
+    evalBoard->setCableDelay(Rhd2000ONIBoard::PortB, settings.optimumDelay.portB);
+    evalBoard->setCableDelay(Rhd2000ONIBoard::PortC, settings.optimumDelay.portC);
+    evalBoard->setCableDelay(Rhd2000ONIBoard::PortD, settings.optimumDelay.portD);
+
+    LOGD("Set optimum delay for port A: ", settings.optimumDelay.portA);
+    LOGD("Set optimum delay for port B: ", settings.optimumDelay.portB);
+    LOGD("Set optimum delay for port C: ", settings.optimumDelay.portC);
+    LOGD("Set optimum delay for port D: ", settings.optimumDelay.portD);
+
+    setSampleRate(settings.savedSampleRateIndex, false, !initialScan); // restore saved sample rate and check delays
+
+    setPortScanProgress(0.95f);
+
+    applyImpedanceHistory();
+
+}
+
+void DeviceThread::enableDetectedHeadstage(int hs, int detectedChipId)
+{
+    if ((detectedChipId > 0) && (enabledStreams.size() < MAX_NUM_DATA_STREAMS))
+    {
+        const int streamIndex = enabledStreams.size();
+
+        chipId.set(streamIndex, detectedChipId);
+
+        LOGD("Enabling headstage ", hs);
+
+        if (detectedChipId == CHIP_ID_RHD2164) //RHD2164
+        {
+            if (enabledStreams.size() < MAX_NUM_DATA_STREAMS - 1)
+            {
+                enableHeadstage(hs, true, 2, 32);
+                chipId.set(streamIndex + 1, CHIP_ID_RHD2164_B);
+            }
+            else //just one stream left
+            {
+                enableHeadstage(hs, true, 1, 32);
+            }
+        }
+        else
+        {
+            enableHeadstage(hs, true, 1, detectedChipId == 1 ? 32:16);
+        }
+    }
+    else
+    {
+        enableHeadstage(hs, false);
+    }
+}
+
+void DeviceThread::rescanPort(Rhd2000ONIBoard::BoardPort port)
+{
+    if (!deviceFound || port > Rhd2000ONIBoard::PortD || headstageChipIds.size() < headstages.size())
+        return;
+
+    if (!checkBoardMem()) return;
+
+    const ScopedLock scanLock(portScanLock);
+
+    impedanceThread->stopThreadSafely();
+    flushStaleFrames();
+
+    const int firstHs = int(port) * 2;
+    const String portName = String::charToString('A' + int(port));
+
+    // Probe only the two data sources of this port
+    {
+        const ScopedLock lock(oniLock);
+
+        for (int i = 0; i < MAX_NUM_DATA_STREAMS; i++)
+            evalBoard->enableDataStream(i, i < 2);
+
+        evalBoard->setDataSource(0, headstages[firstHs]->getDataStream(0));
+        evalBoard->setDataSource(1, headstages[firstHs + 1]->getDataStream(0));
+        evalBoard->updateStreamBlockSize();
+    }
+
+    // calibrate the ADCs of a newly connected chip while probing
+    evalBoard->selectAuxCommandBank(port, Rhd2000ONIBoard::AuxCmd3, 0);
+
+    evalBoard->setMaxTimeStep(128 * INIT_STEP);
+
+    ScopedPointer<Rhd2000DataBlock> dataBlock = new Rhd2000DataBlock(2, evalBoard->isUSB3());
+
+    int sumGoodDelays[2] = { 0, 0 };
+    int indexFirstGoodDelay[2] = { -1, -1 };
+    int indexSecondGoodDelay[2] = { -1, -1 };
+    int detectedChipIds[2] = { -1, -1 };
+
+    std::vector<int> commandList;
+    const int sequenceLength = chipRegisters.createCommandListRegisterConfig(commandList, true);
+    int64 sampleCount = 0;
+
+    LOGD("Checking port ", portName, " for connected amplifier chips...");
+
+    evalBoard->setContinuousRunMode(true);
+    evalBoard->run();
+
+    for (int delay = 0; delay < 16; delay++)
+    {
+        evalBoard->setCableDelay(port, delay);
+
+        if (!readScanBurst(dataBlock, sequenceLength, sampleCount))
+        {
+            LOGE("Error reading data while scanning port ", portName);
+            break;
+        }
+
+        bool settled = true;
+
+        for (int i = 0; i < 2; i++)
+        {
+            if (sumGoodDelays[i] < 0 || sumGoodDelays[i] > 2)
+                continue;
+
+            int register59Value;
+            int id = getDeviceId(dataBlock, i, register59Value);
+
+            if (id == CHIP_ID_RHD2132 || id == CHIP_ID_RHD2216 ||
+                (id == CHIP_ID_RHD2164 && register59Value == REGISTER_59_MISO_A))
+            {
+                sumGoodDelays[i]++;
+                detectedChipIds[i] = id;
+
+                if (indexFirstGoodDelay[i] == -1)
+                    indexFirstGoodDelay[i] = delay;
+                else if (indexSecondGoodDelay[i] == -1)
+                    indexSecondGoodDelay[i] = delay;
+            }
+            else if (sumGoodDelays[i] > 0)
+            {
+                // the window of good delays has closed
+                sumGoodDelays[i] = -sumGoodDelays[i];
+            }
+
+            settled = settled && (sumGoodDelays[i] < 0 || sumGoodDelays[i] > 2);
+        }
+
+        // nothing more to learn once both sources are settled, or one is settled and the other silent
+        bool anySettled = false;
+
+        for (int i = 0; i < 2; i++)
+            anySettled = anySettled || sumGoodDelays[i] < 0 || sumGoodDelays[i] > 2;
+
+        if (anySettled && (settled || sumGoodDelays[0] == 0 || sumGoodDelays[1] == 0))
+            break;
+    }
+
+    {
+        const ScopedLock lock(oniLock);
+        evalBoard->stop();
+    }
+
+    evalBoard->setContinuousRunMode(false);
+    evalBoard->selectAuxCommandBank(port, Rhd2000ONIBoard::AuxCmd3, settings.fastSettleEnabled ? 2 : 1);
+
+    int optimumDelay = 0;
+
+    for (int i = 0; i < 2; i++)
+    {
+        int goodDelays = std::abs(sumGoodDelays[i]);
+
+        if (goodDelays == 1 || goodDelays == 2)
+            optimumDelay = std::max(optimumDelay, indexFirstGoodDelay[i]);
+        else if (goodDelays > 2)
+            optimumDelay = std::max(optimumDelay, indexSecondGoodDelay[i]);
+    }
+
+    // Rebuild the stream list in headstage order. Headstages on the other ports keep
+    // their chips, channel counts and names; only their stream indices can move.
+    Array<int> activeStreamChannels;
 
     for (int hs = 0; hs < headstages.size(); ++hs)
     {
-        if ((tmpChipId[hs] > 0) && (enabledStreams.size() < MAX_NUM_DATA_STREAMS))
-        {
-            chipId.set(chipIdx++,tmpChipId[hs]);
+        activeStreamChannels.add(headstages[hs]->isConnected() ?
+            numChannelsPerDataStream[headstages[hs]->getStreamIndex(0)] : 0);
+    }
+
+    headstageChipIds.set(firstHs, detectedChipIds[0]);
+    headstageChipIds.set(firstHs + 1, detectedChipIds[1]);
 
-            LOGD("Enabling headstage ", hs);
+    enabledStreams.clear();
+    numChannelsPerDataStream.clear();
+    chipId.clear();
 
-            if (tmpChipId[hs] == CHIP_ID_RHD2164) //RHD2164
+    for (int hs = 0; hs < headstages.size(); ++hs)
+    {
+        if (hs == firstHs || hs == firstHs + 1)
+        {
+            enableDetectedHeadstage(hs, headstageChipIds[hs]);
+        }
+        else if (headstages[hs]->isConnected())
+        {
+            if (enabledStreams.size() + headstages[hs]->getNumStreams() > MAX_NUM_DATA_STREAMS)
             {
-                if (enabledStreams.size() < MAX_NUM_DATA_STREAMS - 1)
-                {
-                    enableHeadstage(hs, true, 2, 32);
-                    chipId.set(chipIdx++, CHIP_ID_RHD2164_B);
-                }
-                else //just one stream left
-                {
-                    enableHeadstage(hs, true, 1, 32);
-                }
+                LOGE("No data streams left for headstage ", headstages[hs]->getStreamPrefix());
+                enableHeadstage(hs, false);
+                continue;
             }
-            else
+
+            headstages[hs]->setFirstStreamIndex(enabledStreams.size());
+
+            for (int i = 0; i < headstages[hs]->getNumStreams(); i++)
             {
-                enableHeadstage(hs, true, 1, tmpChipId[hs] == 1 ? 32:16);
+                chipId.set(enabledStreams.size(), i == 0 ? headstageChipIds[hs] : CHIP_ID_RHD2164_B);
+                enabledStreams.add(headstages[hs]->getDataStream(i));
+                numChannelsPerDataStream.add(activeStreamChannels[hs]);
             }
         }
-        else
+    }
+
+    int channelIndex = 0;
+
+    for (auto hs : headstages)
+    {
+        if (hs->isConnected())
         {
-            enableHeadstage(hs, false);
+            hs->setFirstChannel(channelIndex);
+
+            channelIndex += hs->getNumActiveChannels();
         }
     }
-#endif
-    updateBoardStreams();
 
-    LOGD( "Number of enabled data streams: ", evalBoard->getNumEnabledDataStreams() );
+    sourceBuffers[0]->resize(getNumChannels(), 10000);
 
-    // Set cable delay settings that yield good communication with each
-    // RHD2000 chip.
-    Array<int> optimumDelay;
+    updateBoardStreams();
 
-    optimumDelay.insertMultiple(0, 0, headstages.size());
+    LOGD("Number of enabled data streams: ", evalBoard->getNumEnabledDataStreams());
 
-    for (hs = 0; hs < headstages.size(); ++hs)
+    // The delay was found at the current sample rate. It is only the 30 kHz base delay
+    // (and worth caching) when that is the current rate; otherwise it stands in as the
+    // base until the next full scan.
+    switch (port)
     {
-        if (sumGoodDelays[hs] == 1 || sumGoodDelays[hs] == 2)
-        {
-            optimumDelay.set(hs,indexFirstGoodDelay[hs]);
-        }
-        else if (sumGoodDelays[hs] > 2)
-        {
-            optimumDelay.set(hs,indexSecondGoodDelay[hs]);
-        }
+        case Rhd2000ONIBoard::PortA: settings.optimumDelay.portA = optimumDelay; break;
+        case Rhd2000ONIBoard::PortB: settings.optimumDelay.portB = optimumDelay; break;
+        case Rhd2000ONIBoard::PortC: settings.optimumDelay.portC = optimumDelay; break;
+        default: settings.optimumDelay.portD = optimumDelay; break;
     }
 
-    settings.optimumDelay.portA = std::max(optimumDelay[0], optimumDelay[1]);
-    settings.optimumDelay.portB = std::max(optimumDelay[2], optimumDelay[3]);
-    settings.optimumDelay.portC = std::max(optimumDelay[4], optimumDelay[5]);
-    settings.optimumDelay.portD = std::max(optimumDelay[6], optimumDelay[7]);
+    updateSampleRateDelayKeys(headstageChipIds);
 
-    evalBoard->setCableDelay(Rhd2000ONIBoard::PortA, settings.optimumDelay.portA);
-    evalBoard->setCableDelay(Rhd2000ONIBoard::PortB, settings.optimumDelay.portB);
-    evalBoard->setCableDelay(Rhd2000ONIBoard::PortC, settings.optimumDelay.portC);
-    evalBoard->setCableDelay(Rhd2000ONIBoard::PortD, settings.optimumDelay.portD);
+    const int sampleRate = evalBoard->getSampleRateEnum();
 
-    LOGD("Set optimum delay for port A: ", settings.optimumDelay.portA);
-    LOGD("Set optimum delay for port B: ", settings.optimumDelay.portB);
-    LOGD("Set optimum delay for port C: ", settings.optimumDelay.portC);
-    LOGD("Set optimum delay for port D: ", settings.optimumDelay.portD);
+    if (detectedChipIds[0] > 0 || detectedChipIds[1] > 0)
+        sampleRateDelays[int(port)][sampleRate] = optimumDelay;
 
-    setSampleRate(settings.savedSampleRateIndex, false, !initialScan); // restore saved sample rate and check delays
+    if (sampleRate == Rhd2000ONIBoard::SampleRate30000Hz)
+        storeCableDelays(headstageChipIds);
+
+    evalBoard->setCableDelay(port, optimumDelay);
+
+    LOGD("Set optimum delay for port ", portName, ": ", optimumDelay);
+
+    applyImpedanceHistory();
+}
+
+void DeviceThread::scanPortsAsync(bool fullScan)
+{
+    if (!deviceFound)
+        return;
+
+    if (!portScanner->startScan(fullScan))
+        LOGD("Port scan already running");
+}
+
+void DeviceThread::cancelPortScan()
+{
+    if (isScanningPorts())
+        portScanner->cancel();
+}
+
+void DeviceThread::setPortScanProgress(float progress)
+{
+    portScanProgress = progress;
 
+    if (isScanningPorts())
+        sendChangeMessage();
 }
 
 int DeviceThread::getDeviceId(Rhd2000DataBlock* dataBlock, int stream, int& register59Value)
@@ -769,6 +1470,221 @@ int DeviceThread::getDeviceId(Rhd2000DataBlock* dataBlock, int stream, int& regi
     }
 }
 
+bool DeviceThread::readScanBurst(Rhd2000DataBlock* dataBlock, int sequenceLength, int64& sampleCount)
+{
+    // Discard the samples that may still have been acquired with the previous delays,
+    // up to the start of the next command sequence.
+    int64 firstSample = sampleCount + SCAN_SETTLE_SEQUENCES * sequenceLength;
+    firstSample += (sequenceLength - firstSample % sequenceLength) % sequenceLength;
+
+    while (sampleCount < firstSample)
+    {
+        oni_frame_t* frame;
+
+        if (evalBoard->readFrame(&frame) < ONI_ESUCCESS)
+            return false;
+
+        oni_destroy_frame(frame);
+        sampleCount++;
+    }
+
+    if (!evalBoard->readDataBlock(dataBlock, INIT_STEP))
+        return false;
+
+    sampleCount += INIT_STEP;
+
+    return true;
+}
+
+String DeviceThread::getBoardId() const
+{
+    oni_size_t address = 0;
+    int major = 0, minor = 0;
+
+    evalBoard->getHardwareAddress(&address);
+    evalBoard->getFirmwareVersion(&major, &minor);
+
+    return "oni-" + String(address) + "-v" + String(major) + "." + String(minor);
+}
+
+bool DeviceThread::verifyCachedDelays(Rhd2000DataBlock* dataBlock, Array<int>& detectedChipIds, Array<int>& portDelays)
+{
+    const String boardId = getBoardId();
+
+    Array<int> cachedChipIds;
+    Array<int> cachedDelays;
+    bool chipsExpected = false;
+
+    for (int port = 0; port < 4; port++)
+    {
+        int delay;
+        Array<int> chipIds;
+
+        if (!cableDelayCache->getPort(boardId, port, delay, chipIds) || chipIds.size() != 2)
+            return false;
+
+        for (int id : chipIds)
+            chipsExpected = chipsExpected || id > 0;
+
+        cachedDelays.add(delay);
+        cachedChipIds.addArray(chipIds);
+    }
+
+    // an empty board is always scanned in full, so newly connected headstages are found
+    if (!chipsExpected)
+        return false;
+
+    int cachedMemState;
+
+    if (!cableDelayCache->getMemoryState(boardId, cachedMemState) || cachedMemState != int(evalBoard->getBoardMemState()))
+    {
+        LOGD("Board memory state differs from the cached one");
+        return false;
+    }
+
+    evalBoard->setCableDelay(Rhd2000ONIBoard::PortA, cachedDelays[0]);
+    evalBoard->setCableDelay(Rhd2000ONIBoard::PortB, cachedDelays[1]);
+    evalBoard->setCableDelay(Rhd2000ONIBoard::PortC, cachedDelays[2]);
+    evalBoard->setCableDelay(Rhd2000ONIBoard::PortD, cachedDelays[3]);
+
+    evalBoard->run();
+    const bool blockRead = evalBoard->readDataBlock(dataBlock, INIT_STEP);
+    {
+        const ScopedLock lock(oniLock);
+        evalBoard->stop();
+    }
+
+    // the data block still holds the previous scan
+    if (!blockRead)
+    {
+        LOGD("Could not read a data block to verify the cached cable delays");
+        return false;
+    }
+
+    for (int hs = 0; hs < headstages.size(); ++hs)
+    {
+        int register59Value;
+        int id = getDeviceId(dataBlock, hs, register59Value);
+
+        if (!(id == CHIP_ID_RHD2132 || id == CHIP_ID_RHD2216 ||
+            (id == CHIP_ID_RHD2164 && register59Value == REGISTER_59_MISO_A)))
+        {
+            id = -1;
+        }
+
+        if (id != cachedChipIds[hs])
+        {
+            LOGD("Headstage ", hs, " does not match cached chip ID (", cachedChipIds[hs], ", found ", id, ")");
+            return false;
+        }
+    }
+
+    for (int hs = 0; hs < headstages.size(); ++hs)
+        detectedChipIds.set(hs, cachedChipIds[hs]);
+
+    portDelays = cachedDelays;
+
+    return true;
+}
+
+void DeviceThread::storeCableDelays(const Array<int>& detectedChipIds)
+{
+    const String boardId = getBoardId();
+
+    int delays[4] = { int(settings.optimumDelay.portA), int(settings.optimumDelay.portB),
+                      int(settings.optimumDelay.portC), int(settings.optimumDelay.portD) };
+
+    for (int port = 0; port < 4; port++)
+    {
+        Array<int> chipIds;
+        chipIds.add(detectedChipIds[port * 2]);
+        chipIds.add(detectedChipIds[port * 2 + 1]);
+
+        cableDelayCache->setPort(boardId, port, delays[port], chipIds);
+    }
+
+    cableDelayCache->setMemoryState(boardId, int(evalBoard->getBoardMemState()));
+    cableDelayCache->save();
+}
+
+void DeviceThread::loadSampleRateDelays()
+{
+    const String boardId = getBoardId();
+
+    for (int port = 0; port < 4; port++)
+    {
+        Array<int> delays;
+
+        if (!cableDelayCache->getSampleRateDelays(boardId, port, delays) || delays.size() != int(sampleRateDelays[port].size()))
+            continue;
+
+        for (int i = 0; i < delays.size(); i++)
+            sampleRateDelays[port][i] = delays[i];
+    }
+}
+
+void DeviceThread::storeSampleRateDelays()
+{
+    const String boardId = getBoardId();
+
+    for (int port = 0; port < 4; port++)
+    {
+        Array<int> delays;
+
+        for (int delay : sampleRateDelays[port])
+            delays.add(delay);
+
+        cableDelayCache->setSampleRateDelays(boardId, port, delays);
+    }
+
+    cableDelayCache->save();
+}
+
+void DeviceThread::updateSampleRateDelayKeys(const Array<int>& detectedChipIds)
+{
+    int delays[4] = { int(settings.optimumDelay.portA), int(settings.optimumDelay.portB),
+                      int(settings.optimumDelay.portC), int(settings.optimumDelay.portD) };
+
+    for (int port = 0; port < 4; port++)
+    {
+        Array<int> key;
+        key.add(delays[port]);
+        key.add(detectedChipIds[port * 2]);
+        key.add(detectedChipIds[port * 2 + 1]);
+
+        // a different chip or cable needs its delays checked again
+        if (key != sampleRateDelayKeys[port])
+        {
+            sampleRateDelayKeys[port] = key;
+            sampleRateDelays[port].fill(-1);
+        }
+    }
+}
+
+bool DeviceThread::applyKnownDelays(int sampleRate)
+{
+    for (int port = 0; port < 4; port++)
+    {
+        bool cableIsConnected = headstages[port * 2]->isConnected() || headstages[port * 2 + 1]->isConnected();
+
+        if (cableIsConnected && sampleRateDelays[port][sampleRate] < 0)
+            return false;
+    }
+
+    for (int port = 0; port < 4; port++)
+    {
+        if (headstages[port * 2]->isConnected() || headstages[port * 2 + 1]->isConnected())
+        {
+            evalBoard->setCableDelay(static_cast<Rhd2000ONIBoard::BoardPort>(port), sampleRateDelays[port][sampleRate]);
+
+            LOGD("Port ", String::charToString('A' + port), " cable delay at ", settings.boardSampleRate,
+                " samples/sec: ", sampleRateDelays[port][sampleRate], " (known)");
+        }
+    }
+
+    return true;
+}
+
 void DeviceThread::updateSettings(OwnedArray<ContinuousChannel>* continuousChannels,
     OwnedArray<EventChannel>* eventChannels,
     OwnedArray<SpikeChannel>* spikeChannels,
@@ -777,8 +1693,17 @@ void DeviceThread::updateSettings(OwnedArray<ContinuousChannel>* continuousChann
     OwnedArray<ConfigurationObject>* configurationObjects)
 {
 
-    if (!deviceFound)
+    if (!foundInputSource())
+        return;
+
+    // the streams are changing; the editor updates the signal chain again once the scan has finished
+    if (isScanningPorts())
+    {
+        LOGD("Port scan running, settings update deferred");
         return;
+    }
+
+    const ScopedLock scanLock(portScanLock);
 
     continuousChannels->clear();
     eventChannels->clear();
@@ -902,13 +1827,18 @@ void DeviceThread::updateSettings(OwnedArray<ContinuousChannel>* continuousChann
         }
     }
 
+    // the detectors only run if the event channel has their lines
+    adcEventLinesEnabled = adcDetector->isEnabled();
+
     EventChannel::Settings settings{
             EventChannel::Type::TTL,
             "Rhythm FPGA TTL Input",
             "Events on digital input lines of a Rhythm FPGA device",
             "rhythm-fpga-device.events",
             stream,
-            8
+            adcEventLinesEnabled ? ADC_EVENT_LINE + NUM_ADC_EVENT_LINES
+                : this->settings.logTtlOutputs ? TTL_OUTPUT_EVENT_LINE + NUM_TTL_OUTPUT_LINES
+                                               : NUM_TTL_INPUT_LINES + (impedanceMonitor->isEnabled() ? 1 : 0)
     };
 
     eventChannels->add(new EventChannel(settings));
@@ -922,16 +1852,86 @@ void DeviceThread::impedanceMeasurementFinished()
     {
         LOGD( "Updating headstage impedance values" );
 
+        int64 timestamp = Time::currentTimeMillis();
+
         for (auto hs : headstages)
         {
             if (hs->isConnected())
             {
                 hs->setImpedances(impedances);
+
+                for (int i = 0; i < impedances.streams.size(); i++)
+                {
+                    int ch = hs->getChannelIndex(impedances.streams[i], impedances.channels[i]);
+
+                    if (ch >= 0)
+                        storeImpedance(hs, ch, impedances.frequency, timestamp);
+                }
+            }
+        }
+
+        impedanceHistory->flush();
+    }
+}
+
+int DeviceThread::getHeadstageChipId(const Headstage* headstage) const
+{
+    int stream = headstage->getStreamIndex(0);
+
+    if (stream < 0 || stream >= chipId.size())
+        return -1;
+
+    return chipId[stream];
+}
+
+void DeviceThread::storeImpedance(const Headstage* headstage, int channel, float frequency, int64 timestamp)
+{
+    if (!headstage->hasImpedanceData())
+        return;
+
+    ImpedanceRecord record;
+    record.timestamp = timestamp;
+    record.port = int16(headstage->getDataStream(0));
+    record.chipId = int16(getHeadstageChipId(headstage));
+    record.channel = int16(channel);
+    record.reserved = 0;
+    record.frequency = frequency;
+    record.magnitude = headstage->getImpedanceMagnitude(channel);
+    record.phase = headstage->getImpedancePhase(channel);
+
+    impedanceHistory->add(record);
+}
+
+void DeviceThread::applyImpedanceHistory()
+{
+    ImpedanceRecord record;
+
+    for (auto hs : headstages)
+    {
+        if (!hs->isConnected())
+            continue;
+
+        int port = int(hs->getDataStream(0));
+        int hsChipId = getHeadstageChipId(hs);
+
+        for (int ch = 0; ch < hs->getNumActiveChannels(); ch++)
+        {
+            if (impedanceHistory->getLatest(port, hsChipId, ch, record))
+            {
+                hs->setImpedance(ch, record.magnitude, record.phase);
+                impedances.valid = true;
             }
         }
     }
 }
 
+Array<ImpedanceRecord> DeviceThread::getImpedanceHistory(const Headstage* headstage, int channel) const
+{
+    return impedanceHistory->getTrend(int(headstage->getDataStream(0)),
+        getHeadstageChipId(headstage),
+        channel);
+}
+
 void DeviceThread::saveImpedances(File& file)
 {
 
@@ -966,6 +1966,50 @@ void DeviceThread::saveImpedances(File& file)
 
 }
 
+void DeviceThread::exportImpedanceHistory(File& file)
+{
+    std::unique_ptr<XmlElement> xml = std::unique_ptr<XmlElement>(new XmlElement("IMPEDANCES"));
+
+    int globalChannelNumber = -1;
+
+    for (auto hs : headstages)
+    {
+        XmlElement* headstageXml = new XmlElement("HEADSTAGE");
+        headstageXml->setAttribute("name", hs->getStreamPrefix());
+
+        for (int ch = 0; ch < hs->getNumActiveChannels(); ch++)
+        {
+            globalChannelNumber++;
+
+            Array<ImpedanceRecord> trend = getImpedanceHistory(hs, ch);
+
+            if (trend.size() == 0)
+                continue;
+
+            XmlElement* channelXml = new XmlElement("CHANNEL");
+            channelXml->setAttribute("name", hs->getChannelName(ch));
+            channelXml->setAttribute("number", globalChannelNumber);
+            channelXml->setAttribute("magnitude", trend.getLast().magnitude);
+            channelXml->setAttribute("phase", trend.getLast().phase);
+
+            for (auto& record : trend)
+            {
+                XmlElement* measurementXml = channelXml->createNewChildElement("MEASUREMENT");
+                measurementXml->setAttribute("time", Time(record.timestamp).toISO8601(true));
+                measurementXml->setAttribute("frequency", record.frequency);
+                measurementXml->setAttribute("magnitude", record.magnitude);
+                measurementXml->setAttribute("phase", record.phase);
+            }
+
+            headstageXml->addChildElement(channelXml);
+        }
+
+        xml->addChildElement(headstageXml);
+    }
+
+    xml->writeTo(file);
+}
+
 String DeviceThread::getChannelName(int i) const
 {
     return channelNames[i];
@@ -994,6 +2038,13 @@ ChannelNamingScheme DeviceThread::getNamingScheme()
 
 void DeviceThread::setNumChannels(int hsNum, int numChannels)
 {
+    // the scan owns the headstages and streams until it has finished
+    if (isScanningPorts())
+    {
+        LOGE("Cannot change the number of channels while ports are being scanned");
+        return;
+    }
+
     if (headstages[hsNum]->getNumChannels() == 32)
     {
         if (numChannels < headstages[hsNum]->getNumChannels())
@@ -1015,6 +2066,8 @@ void DeviceThread::setNumChannels(int hsNum, int numChannels)
             channelIndex += hs->getNumActiveChannels();
         }
     }
+
+    publishAcquisitionConfig();
 }
 
 int DeviceThread::getHeadstageChannels (int hsNum) const
@@ -1187,7 +2240,7 @@ int DeviceThread::setNoiseSlicerLevel(int level)
 
 bool DeviceThread::foundInputSource()
 {
-    return deviceFound;
+    return deviceFound && initState == INIT_READY;
 }
 
 bool DeviceThread::enableHeadstage(int hsNum, bool enabled, int nStr, int strChans)
@@ -1300,12 +2353,14 @@ void DeviceThread::enableAuxs(bool t)
     settings.acquireAux = t;
     sourceBuffers[0]->resize(getNumChannels(), 10000);
     updateRegisters();
+    publishAcquisitionConfig();
 }
 
 void DeviceThread::enableAdcs(bool t)
 {
     settings.acquireAdc = t;
     sourceBuffers[0]->resize(getNumChannels(), 10000);
+    publishAcquisitionConfig();
 }
 
 bool DeviceThread::isAuxEnabled()
@@ -1315,6 +2370,9 @@ bool DeviceThread::isAuxEnabled()
 
 void DeviceThread::setSampleRate(int sampleRateIndex, bool isTemporary, bool checkDelays)
 {
+    // the board is reprogrammed and may be run to check delays; keep the hotplug probe off it
+    const ScopedLock scanLock(portScanLock);
+
     impedanceThread->stopThreadSafely();
     if (!isTemporary)
     {
@@ -1414,15 +2472,20 @@ void DeviceThread::setSampleRate(int sampleRateIndex, bool isTemporary, bool che
             settings.boardSampleRate = 30000.0f;
     }
 
+    // Select per-channel amplifier sampling rate. Reprogramming the clock
+    // is skipped if the board already runs at this rate.
+    if (evalBoard->getSampleRateEnum() != sampleRate)
     {
         const ScopedLock lock(oniLock);
-        // Select per-channel amplifier sampling rate.
-        evalBoard->setSampleRate(sampleRate);
+
+        if (!evalBoard->setSampleRate(sampleRate))
+            LOGE("Board clock did not switch to the new sample rate");
     }
     LOGD( "Sample rate set to ", evalBoard->getSampleRate() );
 
-    if (checkDelays)
+    if (checkDelays && !applyKnownDelays(sampleRate))
     {
+        flushStaleFrames();
 
         Array<bool> cableIsConnected;
 
@@ -1555,6 +2618,9 @@ void DeviceThread::setSampleRate(int sampleRateIndex, bool isTemporary, bool che
 
             evalBoard->setCableDelay(Rhd2000ONIBoard::PortA, settings.optimumDelay.portA + delayShift);
 
+            if (delayShift > -5)
+                sampleRateDelays[0][sampleRate] = settings.optimumDelay.portA + delayShift;
+
             LOGD("Port A cable delay at ", settings.boardSampleRate, " samples/sec: ",
                 settings.optimumDelay.portA + delayShift);
         }
@@ -1565,6 +2631,9 @@ void DeviceThread::setSampleRate(int sampleRateIndex, bool isTemporary, bool che
 
             evalBoard->setCableDelay(Rhd2000ONIBoard::PortB, settings.optimumDelay.portB + delayShift);
 
+            if (delayShift > -5)
+                sampleRateDelays[1][sampleRate] = settings.optimumDelay.portB + delayShift;
+
             LOGD("Port B cable delay at ", settings.boardSampleRate, " samples/sec: ",
                 settings.optimumDelay.portB + delayShift);
         }
@@ -1575,6 +2644,9 @@ void DeviceThread::setSampleRate(int sampleRateIndex, bool isTemporary, bool che
 
             evalBoard->setCableDelay(Rhd2000ONIBoard::PortC, settings.optimumDelay.portC + delayShift);
 
+            if (delayShift > -5)
+                sampleRateDelays[2][sampleRate] = settings.optimumDelay.portC + delayShift;
+
             LOGD("Port C cable delay at ", settings.boardSampleRate, " samples/sec: ",
                 settings.optimumDelay.portC + delayShift);
         }
@@ -1585,10 +2657,14 @@ void DeviceThread::setSampleRate(int sampleRateIndex, bool isTemporary, bool che
 
             evalBoard->setCableDelay(Rhd2000ONIBoard::PortD, settings.optimumDelay.portD + delayShift);
 
+            if (delayShift > -5)
+                sampleRateDelays[3][sampleRate] = settings.optimumDelay.portD + delayShift;
+
             LOGD("Port D cable delay at ", settings.boardSampleRate, " samples/sec: ",
                 settings.optimumDelay.portD + delayShift);
         }
-        
+
+        storeSampleRateDelays();
     }
 
     updateRegisters();
@@ -1602,6 +2678,9 @@ void DeviceThread::updateRegisters()
     {
         return;
     }
+
+    const ScopedLock scanLock(portScanLock);
+
     // Set up an RHD2000 register object using this sample rate to
     // optimize MUX-related register settings.
     chipRegisters.defineSampleRate(settings.boardSampleRate);
@@ -1618,14 +2697,19 @@ void DeviceThread::updateRegisters()
         // update Register 3, which controls the auxiliary digital output pin on each RHD2000 chip.
         // In concert with the v1.4 Rhythm FPGA code, this permits real-time control of the digital
         // output pin on chips on each SPI port.
+        // The same list with the output high is kept in another bank; every command writes
+        // Register 3, so switching banks changes the pin at the next sample.
+        chipRegisters.setDigOutHigh();
+        chipRegisters.createCommandListUpdateDigOut(commandList);
+        evalBoard->uploadCommandList(commandList, Rhd2000ONIBoard::AuxCmd1, AUXCMD1_DIGOUT_HIGH_BANK);
         chipRegisters.setDigOutLow();   // Take auxiliary output out of HiZ mode.
         commandSequenceLength = chipRegisters.createCommandListUpdateDigOut(commandList);
-        evalBoard->uploadCommandList(commandList, Rhd2000ONIBoard::AuxCmd1, 0);
+        evalBoard->uploadCommandList(commandList, Rhd2000ONIBoard::AuxCmd1, AUXCMD1_DIGOUT_LOW_BANK);
         evalBoard->selectAuxCommandLength(Rhd2000ONIBoard::AuxCmd1, 0, commandSequenceLength - 1);
-        evalBoard->selectAuxCommandBank(Rhd2000ONIBoard::PortA, Rhd2000ONIBoard::AuxCmd1, 0);
-        evalBoard->selectAuxCommandBank(Rhd2000ONIBoard::PortB, Rhd2000ONIBoard::AuxCmd1, 0);
-        evalBoard->selectAuxCommandBank(Rhd2000ONIBoard::PortC, Rhd2000ONIBoard::AuxCmd1, 0);
-        evalBoard->selectAuxCommandBank(Rhd2000ONIBoard::PortD, Rhd2000ONIBoard::AuxCmd1, 0);
+        evalBoard->selectAuxCommandBank(Rhd2000ONIBoard::PortA, Rhd2000ONIBoard::AuxCmd1, getDigOutBank(Rhd2000ONIBoard::PortA));
+        evalBoard->selectAuxCommandBank(Rhd2000ONIBoard::PortB, Rhd2000ONIBoard::AuxCmd1, getDigOutBank(Rhd2000ONIBoard::PortB));
+        evalBoard->selectAuxCommandBank(Rhd2000ONIBoard::PortC, Rhd2000ONIBoard::AuxCmd1, getDigOutBank(Rhd2000ONIBoard::PortC));
+        evalBoard->selectAuxCommandBank(Rhd2000ONIBoard::PortD, Rhd2000ONIBoard::AuxCmd1, getDigOutBank(Rhd2000ONIBoard::PortD));
 
 
         // Next, we'll create a command list for the AuxCmd2 slot.  This command sequence
@@ -1653,6 +2737,19 @@ void DeviceThread::updateRegisters()
     chipRegisters.enableAux2(settings.acquireAux);
     chipRegisters.enableAux3(settings.acquireAux);
 
+    // The register configurations only need uploading if a setting they depend on has changed
+    const String registerConfig = String(settings.boardSampleRate) + "/" + String(settings.dsp.cutoffFreq) + "/"
+        + String(settings.dsp.lowerBandwidth) + "/" + String(settings.dsp.upperBandwidth) + "/"
+        + String(int(settings.dsp.enabled)) + "/" + String(int(settings.acquireAux));
+
+    if (registerConfig == uploadedRegisterConfig)
+    {
+        selectRegularAuxCmd3Bank();
+        return;
+    }
+
+    uploadedRegisterConfig = registerConfig;
+
     commandSequenceLength = chipRegisters.createCommandListRegisterConfig(commandList, true);
     // Upload version with ADC calibration to AuxCmd3 RAM Bank 0.
     evalBoard->uploadCommandList(commandList, Rhd2000ONIBoard::AuxCmd3, 0);
@@ -1675,6 +2772,12 @@ void DeviceThread::updateRegisters()
                                       commandSequenceLength - 1);
 
     chipRegisters.setFastSettle(false);
+
+    selectRegularAuxCmd3Bank();
+}
+
+void DeviceThread::selectRegularAuxCmd3Bank()
+{
     evalBoard->selectAuxCommandBank(Rhd2000ONIBoard::PortA, Rhd2000ONIBoard::AuxCmd3,
                                     settings.fastSettleEnabled ? 2 : 1);
     evalBoard->selectAuxCommandBank(Rhd2000ONIBoard::PortB, Rhd2000ONIBoard::AuxCmd3,
@@ -1683,7 +2786,6 @@ void DeviceThread::updateRegisters()
                                     settings.fastSettleEnabled ? 2 : 1);
     evalBoard->selectAuxCommandBank(Rhd2000ONIBoard::PortD, Rhd2000ONIBoard::AuxCmd3,
                                     settings.fastSettleEnabled ? 2 : 1);
-
 }
 
 void DeviceThread::setCableLength(int hsNum, float length)
@@ -1712,27 +2814,44 @@ void DeviceThread::setCableLength(int hsNum, float length)
 
 bool DeviceThread::startAcquisition()
 {
-    if (!deviceFound || (getNumChannels() == 0))
+    if (!foundInputSource() || (getNumChannels() == 0))
         return false;
 
+    if (isScanningPorts())
+    {
+        LOGE("Cannot start acquisition while ports are being scanned");
+        return false;
+    }
+
     if (!checkBoardMem()) return false;
 
+    // the probe must not touch the board once acquisition has started
+    hotplugMonitor->pause();
+
     impedanceThread->waitSafely();
     dataBlock = new Rhd2000DataBlock(evalBoard->getNumEnabledDataStreams(), evalBoard->isUSB3());
 
     LOGD( "Expecting ", getNumChannels() ," channels." );
 
-    // reset TTL output state
-    for (int k = 0; k < 16; k++)
-    {
-        TTL_OUTPUT_STATE[k] = 0;
-    }
-
     //LOGD( "Number of 16-bit words in FIFO: ", evalBoard->numWordsInFifo());
     //LOGD("Is eval board running: ", evalBoard->isRunning());
 
     //LOGD("RHD2000 data thread starting acquisition.");
 
+    // the sample rate may have changed since the last reset (or a fast restart kept it);
+    // the monitors below size their settling delays from the block read
+    evalBoard->updateBlockReadSize();
+
+    // must be set up while the board is stopped
+    impedanceMonitorActive = impedanceMonitor->prepare();
+    artifactSettleActive = artifactSettle->prepare();
+    stimulusBlankerActive = stimulusBlanker->prepare();
+    adcDetectorActive = adcEventLinesEnabled;
+    adcDetector->reset();
+
+    // the streams only change while acquisition is stopped
+    publishAcquisitionConfig();
+
     if (1)
     {
         LOGD("Setting continuous mode");
@@ -1741,6 +2860,15 @@ bool DeviceThread::startAcquisition()
         evalBoard->run();
     }
 
+    // also clears the TTL outputs
+    ttlWriter->start();
+    pulseScheduler->reset();
+    ttlOutputState = 0;
+
+    sampleClockVersion++;
+    sampleClockSample = -1;
+    sampleClockVersion++;
+
     blockSize = dataBlock->calculateDataBlockSizeInWords(evalBoard->getNumEnabledDataStreams(), evalBoard->isUSB3());
     //LOGD("Expecting blocksize of ", blockSize, " for ", evalBoard->getNumEnabledDataStreams(), " streams");
 
@@ -1756,41 +2884,83 @@ bool DeviceThread::stopAcquisition()
 
     //LOGD("RHD2000 data thread stopping acquisition.");
 
+    const int64 stopTicks = Time::getHighResolutionTicks();
+
     if (isThreadRunning())
     {
         signalThreadShouldExit();
 
+        // the board keeps running until the thread has left, so the read in progress
+        // completes within one block and no further read is started
+        evalBoard->cancelReads(true);
     }
 
-    if (waitForThreadToExit(500))
+    const bool exited = waitForThreadToExit(500);
+
+    lastThreadExitLatencyMs = Time::highResolutionTicksToSeconds(Time::getHighResolutionTicks() - stopTicks) * 1000.0;
+    maxThreadExitLatencyMs = jmax(maxThreadExitLatencyMs, lastThreadExitLatencyMs);
+
+    if (exited)
     {
-        //LOGD("RHD2000 data thread exited.");
+        LOGD("Data thread exited in ", lastThreadExitLatencyMs, " ms (block read size ", (int) evalBoard->getBlockReadSize(), " bytes)");
     }
     else
     {
-        //LOGD("RHD2000 data thread failed to exit, continuing anyway...");
+        LOGE("Data thread did not exit within ", lastThreadExitLatencyMs, " ms");
     }
 
+    ttlWriter->stop();
+    dacPlayer->stop();
+
+    if (ttlWriter->getNumCommandsWritten() > 0)
+        LOGD("TTL output latency: mean ", ttlWriter->getMeanLatencyUs(), " us, max ", ttlWriter->getMaxLatencyUs(),
+             " us over ", ttlWriter->getNumCommandsWritten(), " commands");
+
+    if (ttlWriter->getNumCommandsFailed() > 0)
+        LOGE(ttlWriter->getNumCommandsFailed(), " TTL output commands were lost to failed writes");
+
     if (deviceFound)
     {
         const ScopedLock lock(oniLock);
+        // don't leave a pulse that was cut short high
+        evalBoard->clearTtlOut();
         evalBoard->setContinuousRunMode(false);
         evalBoard->setMaxTimeStep(0);
         evalBoard->stop();
-        evalBoard->resetBoard();
+        impedanceMonitor->finish();
+        artifactSettle->finish();
+
+        // A fast restart keeps the board configuration; frames still queued
+        // are discarded by the next run, or flushed before the board is used otherwise.
+        if (settings.fastRestart)
+        {
+            staleFramesQueued = true;
+        }
+        else
+        {
+            evalBoard->resetBoard();
+            staleFramesQueued = false;
+        }
     }
 
+    evalBoard->cancelReads(false);
+
+    patternSequencer->acquisitionStopped();
+
+    impedanceMonitorActive = false;
+    artifactSettleActive = false;
+    stimulusBlanker->finish();
+    stimulusBlankerActive = false;
+    adcDetectorActive = false;
+    configInUse = nullptr;
+
+    hotplugMonitor->resume();
+
     sourceBuffers[0]->clear();
 
     isTransmitting = false;
     updateSettingsDuringAcquisition = false;
 
-    // remove timers
-    digitalOutputTimers.clear();
-
-    // remove commands
-    while (!digitalOutputCommands.empty())
-        digitalOutputCommands.pop();
 
     return true;
 }
@@ -1800,23 +2970,47 @@ bool DeviceThread::updateBuffer()
     const int nSamps = 128; //This is relatively arbitrary. Latency could be improved by adjusting both this and the usb block size depending on channel count
     oni_frame_t* frame;
     unsigned char* bufferPtr;
-    int numStreams = enabledStreams.size();
     double ts;
 
+    // settings changed from now on apply to the next batch
+    const AcquisitionConfig& config = *acquireAcquisitionConfig();
+    const int numStreams = config.numStreams;
+
     //evalBoard->printFIFOmetrics();
     for (int samp = 0; samp < nSamps; samp++)
     {
+        // leave quickly when acquisition stops
+        if ((samp & 15) == 0 && threadShouldExit())
+            break;
 
         int index = 0;
         int auxIndex, chanIndex;
         int res = evalBoard->readFrame(&frame);
 
+        if (res == Rhd2000ONIBoard::READ_CANCELLED)
+            break;
+
         if (res < ONI_ESUCCESS)
         {
             LOGE("Error reading ONI frame: ", oni_error_str(res), " code ", res);
             return false;
         }
 
+        if (staleFramesQueued)
+        {
+            // the acquisition clock restarts with every run, so frames of the previous run are newer
+            if (frame->time > lastFrameTime)
+            {
+                oni_destroy_frame(frame);
+                samp--;
+                continue;
+            }
+
+            staleFramesQueued = false;
+        }
+
+        lastFrameTime = frame->time;
+
         int channel = -1; 
 
         bufferPtr = (unsigned char*)frame->data + 8; //skip ONI timestamps
@@ -1837,11 +3031,11 @@ bool DeviceThread::updateBuffer()
         for (int dataStream = 0; dataStream < numStreams; dataStream++)
         {
 
-            int nChans = numChannelsPerDataStream[dataStream];
+            int nChans = config.numChannels[dataStream];
 
             chanIndex = index + 2 * dataStream;
 
-            if ((chipId[dataStream] == CHIP_ID_RHD2132) && (nChans == 16)) //RHD2132 16ch. headstage
+            if ((config.chipId[dataStream] == CHIP_ID_RHD2132) && (nChans == 16)) //RHD2132 16ch. headstage
             {
                 chanIndex += 2 * RHD2132_16CH_OFFSET * numStreams;
             }
@@ -1857,11 +3051,11 @@ bool DeviceThread::updateBuffer()
         index += 64 * numStreams; // neural data width
         auxIndex += 2 * numStreams; // skip AuxCmd1 slots (see updateRegisters())
         // copy the 3 aux channels
-        if (settings.acquireAux)
+        if (config.acquireAux)
         {
             for (int dataStream = 0; dataStream < numStreams; dataStream++)
             {
-                if (chipId[dataStream] != CHIP_ID_RHD2164_B)
+                if (config.chipId[dataStream] != CHIP_ID_RHD2164_B)
                 {
                     int auxNum = (samp + 3) % 4;
                     if (auxNum < 3)
@@ -1883,17 +3077,18 @@ bool DeviceThread::updateBuffer()
         }
         index += 2 * numStreams; // skip over filler word at the end of each data stream
         // copy the 8 ADC channels
-        if (settings.acquireAdc)
+        if (config.acquireAdc || adcDetectorActive)
         {
             for (int adcChan = 0; adcChan < 8; ++adcChan)
             {
-
-                channel++;
                 // ADC waveform units = volts
+                adcSample[adcChan] = config.adcScale[adcChan] * float(*(uint16*)(bufferPtr + index)) + config.adcOffset[adcChan];
 
-                thisSample[channel] = adcRangeSettings[adcChan] == 0 ?
-                    0.00015258789 * float(*(uint16*)(bufferPtr + index)) - 5 - 0.4096 : // account for +/-5V input range and DC offset
-                    0.00030517578 * float(*(uint16*)(bufferPtr + index)); // shouldn't this be half the value, not 2x?
+                if (config.acquireAdc)
+                {
+                    channel++;
+                    thisSample[channel] = adcSample[adcChan];
+                }
                 
                 index += 2; // single chan width (2 bytes)
             }
@@ -1905,17 +3100,70 @@ bool DeviceThread::updateBuffer()
 
         uint64 ttlEventWord = *(uint64*)(bufferPtr + index) & 65535;
 
+        // the lines above the TTL inputs carry the Zcheck marker, the TTL outputs and the ADC events
+        if (impedanceMonitorActive || config.logTtlOutputs || adcDetectorActive)
+            ttlEventWord &= (1ULL << NUM_TTL_INPUT_LINES) - 1;
+
+        if (impedanceMonitorActive)
+        {
+            // marks samples affected by a Zcheck measurement
+            if (impedanceMonitor->processSample(thisSample, timestamp))
+                ttlEventWord |= 1ULL << ZCHECK_EVENT_LINE;
+        }
+
+        if (artifactSettleActive)
+            artifactSettle->processSample(thisSample, timestamp);
+
+        uint32 outputState = pulseScheduler->process(timestamp) | patternSequencer->process(timestamp);
+
+        if (adcDetectorActive)
+        {
+            ttlEventWord |= uint64(adcDetector->process(adcSample)) << ADC_EVENT_LINE;
+            outputState |= adcDetector->getOutputState();
+        }
+        uint32 changedOutputs = outputState ^ ttlOutputState;
+
+        ttlOutputState = outputState;
+
+        if (changedOutputs != 0 && !ttlWriter->push(changedOutputs, outputState))
+            LOGE("TTL output queue is full, pulse edge at sample ", timestamp, " dropped");
+
+        // outputs computed now reach the pins about one block read later; log the state the board applied
+        const uint32 appliedOutputs = *(uint16*)(bufferPtr + index + 2) & ((1u << NUM_TTL_OUTPUT_LINES) - 1);
+
+        if (config.logTtlOutputs)
+            ttlEventWord |= uint64(appliedOutputs) << TTL_OUTPUT_EVENT_LINE;
+
         index += 4;
 
-        sourceBuffers[0]->addToBuffer(thisSample,
-            &timestamp,
-            &ts,
-            &ttlEventWord,
-            1);
+        if (stimulusBlankerActive)
+        {
+            stimulusBlanker->process(sourceBuffers[0], thisSample, timestamp, &ts,
+                ttlEventWord, uint32(ttlEventWord), appliedOutputs);
+        }
+        else
+        {
+            sourceBuffers[0]->addToBuffer(thisSample,
+                &timestamp,
+                &ts,
+                &ttlEventWord,
+                1);
+        }
 
         oni_destroy_frame(frame);
     }
 
+    // frames are read as soon as a block arrives, so the last one approximates the board's clock
+    const int64 lastSample = pulseScheduler->getLastSampleNumber();
+
+    if (lastSample >= 0)
+    {
+        sampleClockVersion++;
+        sampleClockSample = lastSample;
+        sampleClockTicks = Time::getHighResolutionTicks();
+        sampleClockVersion++;
+    }
+
 
     if (updateSettingsDuringAcquisition)
     {
@@ -1925,7 +3173,12 @@ bool DeviceThread::updateBuffer()
             if (dacChannelsToUpdate[k])
             {
                 dacChannelsToUpdate[k] = false;
-                if (dacChannels[k] >= 0)
+                if (dacPlaybackChannels & (1 << k))
+                {
+                    evalBoard->enableDac(k, true);
+                    evalBoard->selectDacDataStream(k, Rhd2000ONIBoard::DAC_MANUAL_STREAM);
+                }
+                else if (dacChannels[k] >= 0)
                 {
                     evalBoard->enableDac(k, true);
                     evalBoard->selectDacDataStream(k, dacStream[k]);
@@ -1951,33 +3204,23 @@ bool DeviceThread::updateBuffer()
         updateSettingsDuringAcquisition = false;
     }
 
-    if (!digitalOutputCommands.empty())
-    {
-
-        while (!digitalOutputCommands.empty())
-        {
-            DigitalOutputCommand command = digitalOutputCommands.front();
-            TTL_OUTPUT_STATE[command.ttlLine] = command.state;
-            digitalOutputCommands.pop();
-
-        }
-
-        evalBoard->setTtlOut(TTL_OUTPUT_STATE);
+    return true;
 
-        LOGB("TTL OUTPUT STATE: ",
-            TTL_OUTPUT_STATE[0],
-            TTL_OUTPUT_STATE[1],
-            TTL_OUTPUT_STATE[2],
-            TTL_OUTPUT_STATE[3],
-            TTL_OUTPUT_STATE[4],
-            TTL_OUTPUT_STATE[5],
-            TTL_OUTPUT_STATE[6],
-            TTL_OUTPUT_STATE[7]);
+}
 
-    }
+double DeviceThread::getLastTtlLatencyUs() const
+{
+    return ttlWriter->getLastLatencyUs();
+}
 
-    return true;
+double DeviceThread::getMeanTtlLatencyUs() const
+{
+    return ttlWriter->getMeanLatencyUs();
+}
 
+double DeviceThread::getMaxTtlLatencyUs() const
+{
+    return ttlWriter->getMaxLatencyUs();
 }
 
 int DeviceThread::getChannelFromHeadstage (int hs, int ch)
@@ -2091,6 +3334,21 @@ int DeviceThread::getHeadstageChannel (int& hs, int ch) const
     return -1;
 }
 
+void DeviceThread::setFastRestart(bool enabled)
+{
+    settings.fastRestart = enabled;
+}
+
+void DeviceThread::flushStaleFrames()
+{
+    if (!staleFramesQueued)
+        return;
+
+    const ScopedLock lock(oniLock);
+    evalBoard->resetBoard();
+    staleFramesQueued = false;
+}
+
 void DeviceThread::enableBoardLeds(bool enable)
 {
 
@@ -2135,6 +3393,69 @@ int DeviceThread::setClockDivider(int divide_ratio)
 void DeviceThread::setAdcRange(int channel, short range)
 {
     adcRangeSettings[channel] = range;
+    publishAcquisitionConfig();
+}
+
+void DeviceThread::publishAcquisitionConfig()
+{
+    const ScopedLock lock(acquisitionConfigLock);
+
+    AcquisitionConfig* config = new AcquisitionConfig();
+
+    config->acquireAux = settings.acquireAux;
+    config->acquireAdc = settings.acquireAdc;
+    config->logTtlOutputs = settings.logTtlOutputs;
+    config->numStreams = jmin(enabledStreams.size(), MAX_NUM_DATA_STREAMS_USB3);
+
+    for (int stream = 0; stream < config->numStreams; stream++)
+    {
+        config->chipId[stream] = chipId[stream];
+        config->numChannels[stream] = numChannelsPerDataStream[stream];
+    }
+
+    for (int adc = 0; adc < 8; adc++)
+    {
+        if (adcRangeSettings[adc] == 0)
+        {
+            config->adcScale[adc] = 0.00015258789;
+            config->adcOffset[adc] = -5 - 0.4096; // account for +/-5V input range and DC offset
+        }
+        else
+        {
+            config->adcScale[adc] = 0.00030517578; // shouldn't this be half the value, not 2x?
+            config->adcOffset[adc] = 0.0;
+        }
+    }
+
+    acquisitionConfigs.add(config);
+    publishedConfig = config;
+
+    // The acquisition thread marks a configuration in use before checking it is still the
+    // published one, so any other configuration can no longer be picked up.
+    const AcquisitionConfig* inUse = configInUse;
+
+    for (int i = acquisitionConfigs.size() - 1; i >= 0; i--)
+    {
+        if (acquisitionConfigs[i] != config && acquisitionConfigs[i] != inUse)
+            acquisitionConfigs.remove(i);
+    }
+}
+
+const AcquisitionConfig* DeviceThread::acquireAcquisitionConfig()
+{
+    const AcquisitionConfig* config = publishedConfig;
+
+    for (;;)
+    {
+        configInUse = config;
+
+        const AcquisitionConfig* latest = publishedConfig;
+
+        if (latest == config)
+            return config;
+
+        config = latest;
+    }
 }
 
 short DeviceThread::getAdcRange(int channel) const
@@ -2142,17 +3463,207 @@ short DeviceThread::getAdcRange(int channel) const
     return adcRangeSettings[channel];
 }
 
-void DeviceThread::runImpedanceTest()
+void DeviceThread::runImpedanceTest(const Array<int>& channels)
 {
     if (!checkBoardMem()) return;
 
+    // keeps the hotplug probe off the board until the measurement has finished
+    const ScopedLock scanLock(portScanLock);
+
+    flushStaleFrames();
+
     setSampleRate(Rhd2000ONIBoard::SampleRate30000Hz, true, false); // set to 30 kHz temporarily
 
+    impedanceThread->setSelectedChannels(channels);
     impedanceThread->runThread();
 
     setSampleRate(settings.savedSampleRateIndex, false, true); // set to 30 kHz temporarily
 
 }
 
+void DeviceThread::setImpedanceMonitorEnabled(bool enabled)
+{
+    impedanceMonitor->setEnabled(enabled);
+}
+
+bool DeviceThread::isImpedanceMonitorEnabled() const
+{
+    return impedanceMonitor->isEnabled();
+}
+
+void DeviceThread::setImpedanceMonitorInterval(int intervalMs)
+{
+    impedanceMonitor->setInterval(intervalMs);
+}
+
+void DeviceThread::setArtifactSettleEnabled(bool enabled)
+{
+    artifactSettle->setEnabled(enabled);
+}
+
+bool DeviceThread::isArtifactSettleEnabled() const
+{
+    return artifactSettle->isEnabled();
+}
+
+void DeviceThread::setArtifactSettleChannels(const Array<int>& channels)
+{
+    artifactSettle->setChannels(channels);
+}
+
+Array<int> DeviceThread::getArtifactSettleChannels() const
+{
+    return artifactSettle->getChannels();
+}
+
+void DeviceThread::setArtifactSettleThresholds(float saturation, float step)
+{
+    artifactSettle->setSaturationThreshold(saturation);
+    artifactSettle->setTransientThreshold(step);
+}
+
+float DeviceThread::getArtifactSettleSaturation() const
+{
+    return artifactSettle->getSaturationThreshold();
+}
+
+float DeviceThread::getArtifactSettleStep() const
+{
+    return artifactSettle->getTransientThreshold();
+}
+
+void DeviceThread::setArtifactSettleSamples(int samples)
+{
+    artifactSettle->setSettleSamples(samples);
+}
+
+int DeviceThread::getArtifactSettleSamples() const
+{
+    return artifactSettle->getSettleSamples();
+}
+
+int64 DeviceThread::getNumArtifactSettleTriggers() const
+{
+    return artifactSettle->getNumTriggers();
+}
+
+void DeviceThread::setStimulusBlankingEnabled(bool enabled)
+{
+    stimulusBlanker->setEnabled(enabled);
+}
+
+bool DeviceThread::isStimulusBlankingEnabled() const
+{
+    return stimulusBlanker->isEnabled();
+}
+
+void DeviceThread::setStimulusBlankingTriggers(uint32 outputLines, uint32 inputLines)
+{
+    stimulusBlanker->setTriggerLines(outputLines, inputLines);
+}
+
+uint32 DeviceThread::getStimulusBlankingOutputTriggers() const
+{
+    return stimulusBlanker->getOutputTriggerLines();
+}
+
+uint32 DeviceThread::getStimulusBlankingInputTriggers() const
+{
+    return stimulusBlanker->getInputTriggerLines();
+}
+
+void DeviceThread::setStimulusBlankingWindow(int samples)
+{
+    stimulusBlanker->setWindow(samples);
+}
+
+int DeviceThread::getStimulusBlankingWindow() const
+{
+    return stimulusBlanker->getWindow();
+}
+
+void DeviceThread::setStimulusBlankingInterpolation(bool interpolate)
+{
+    stimulusBlanker->setMode(interpolate ? StimulusBlanker::INTERPOLATE : StimulusBlanker::HOLD);
+}
+
+bool DeviceThread::isStimulusBlankingInterpolated() const
+{
+    return stimulusBlanker->getMode() == StimulusBlanker::INTERPOLATE;
+}
+
+void DeviceThread::setStimulusBlankingChannels(const Array<int>& channels)
+{
+    stimulusBlanker->setChannels(channels);
+}
+
+Array<int> DeviceThread::getStimulusBlankingChannels() const
+{
+    return stimulusBlanker->getChannels();
+}
+
+void DeviceThread::setAdcThreshold(int adcChannel, bool enabled, float threshold, float hysteresis,
+                                   bool falling, int ttlLine)
+{
+    adcDetector->setThreshold(adcChannel, threshold, hysteresis, falling);
+    adcDetector->setOutputLine(adcChannel, ttlLine);
+    adcDetector->setEnabled(adcChannel, enabled);
+}
+
+bool DeviceThread::isAdcThresholdEnabled(int adcChannel) const
+{
+    return adcDetector->isEnabled(adcChannel);
+}
+
+float DeviceThread::getAdcThreshold(int adcChannel) const
+{
+    return adcDetector->getThreshold(adcChannel);
+}
+
+float DeviceThread::getAdcThresholdHysteresis(int adcChannel) const
+{
+    return adcDetector->getHysteresis(adcChannel);
+}
+
+bool DeviceThread::isAdcThresholdFalling(int adcChannel) const
+{
+    return adcDetector->isFalling(adcChannel);
+}
+
+int DeviceThread::getAdcThresholdOutput(int adcChannel) const
+{
+    return adcDetector->getOutputLine(adcChannel);
+}
+
+void DeviceThread::setHotplugProbeEnabled(bool enabled)
+{
+    hotplugMonitor->setEnabled(enabled);
+}
+
+bool DeviceThread::isHotplugProbeEnabled() const
+{
+    return hotplugMonitor->isEnabled();
+}
+
+void DeviceThread::setHotplugProbeInterval(int intervalMs)
+{
+    hotplugMonitor->setInterval(intervalMs);
+}
+
+int DeviceThread::getHotplugProbeInterval() const
+{
+    return hotplugMonitor->getInterval();
+}
+
+void DeviceThread::setHotplugAutoRescan(bool autoRescan)
+{
+    hotplugMonitor->setAutoRescan(autoRescan);
+}
+
+bool DeviceThread::isHotplugAutoRescanEnabled() const
+{
+    return hotplugMonitor->isAutoRescanEnabled();
+}
+
 
 
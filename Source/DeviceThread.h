@@ -35,6 +35,10 @@
 #include "rhythm-api/rhd2000registers.h"
 #include "rhythm-api/rhd2000datablock.h"
 
+#include "ImpedanceHistory.h"
+#include "CableDelayCache.h"
+#include "TtlCommand.h"
+
 #define CHIP_ID_RHD2132  1
 #define CHIP_ID_RHD2216  2
 #define CHIP_ID_RHD2164  4
@@ -43,6 +47,18 @@
 #define REGISTER_59_MISO_B  58
 #define RHD2132_16CH_OFFSET 8
 
+#define INIT_STEP 64
+
+#define AUXCMD1_DIGOUT_LOW_BANK 0
+#define AUXCMD1_DIGOUT_HIGH_BANK 2
+
+#define NUM_TTL_INPUT_LINES 8
+#define ZCHECK_EVENT_LINE 8
+#define NUM_TTL_OUTPUT_LINES 8
+#define TTL_OUTPUT_EVENT_LINE 9
+#define NUM_ADC_EVENT_LINES 8
+#define ADC_EVENT_LINE 17
+
 #define MAX_NUM_CHANNELS MAX_NUM_DATA_STREAMS_USB3 * 35 + 16
 
 namespace ONIRhythmNode
@@ -50,6 +66,19 @@ namespace ONIRhythmNode
 
 	class Headstage;
 	class ImpedanceMeter;
+	class ImpedanceMonitor;
+	class PortScanner;
+	class HotplugMonitor;
+	class DeviceInitializer;
+	class TtlOutputWriter;
+	class PulseScheduler;
+	class TtlCommandServer;
+	class PatternSequencer;
+	class DacPlayer;
+	class ArtifactSettle;
+	class StimulusBlanker;
+	class AdcThresholdDetector;
+	struct AcquisitionConfig;
 
 
 	enum ChannelNamingScheme
@@ -60,10 +89,12 @@ namespace ONIRhythmNode
 
 	struct Impedances
 	{
-		Array<int> streams;
-		Array<int> channels;
+		Array<int> streams;      // position in the enabled streams
+		Array<int> channels;     // acquired channel on that stream
 		Array<float> magnitudes;
 		Array<float> phases;
+		float frequency = 0.0f;
+		bool partial = false;    // only a selection of channels was measured
 		bool valid = false;
 	};
 
@@ -72,11 +103,30 @@ namespace ONIRhythmNode
 
 		@see DataThread, SourceNode
 	*/
-	class DeviceThread : public DataThread
+	class DeviceThread : public DataThread,
+						 public ChangeBroadcaster
 	{
 		friend class ImpedanceMeter;
+		friend class ImpedanceMonitor;
+		friend class PortScanner;
+		friend class HotplugMonitor;
+		friend class DeviceInitializer;
+		friend class TtlOutputWriter;
+		friend class DacPlayer;
+		friend class ArtifactSettle;
 
 	public:
+
+		/** Stages of the background initialization started by the constructor*/
+		enum InitState
+		{
+			INIT_OPENING = 0,
+			INIT_CALIBRATING,
+			INIT_SCANNING,
+			INIT_READY,
+			INIT_FAILED
+		};
+
 		/** Constructor; must specify the type of board used */
 		DeviceThread(SourceNode* sn);
 
@@ -95,7 +145,8 @@ namespace ONIRhythmNode
 		/** Stops data transfer */
 		bool stopAcquisition() override;
 
-		/* Passes the processor's info objects to DataThread, to allow them to be configured */
+		/* Passes the processor's info objects to DataThread, to allow them to be configured.
+		   Returns without changes while a background port scan runs; the editor updates the signal chain once it has finished. */
 		void updateSettings(OwnedArray<ContinuousChannel>* continuousChannels,
 			OwnedArray<EventChannel>* eventChannels,
 			OwnedArray<SpikeChannel>* spikeChannels,
@@ -121,6 +172,7 @@ namespace ONIRhythmNode
 		/** Informs the DataThread about whether to expect saved settings to be loaded*/
 		void initialize(bool signalChainIsLoading) override;
 
+		/** Sets the number of active channels of a 32-channel headstage (ignored while ports are scanned)*/
 		void setNumChannels(int hsNum, int nChannels);
 
 		int getNumChannels();
@@ -140,10 +192,44 @@ namespace ONIRhythmNode
 		// for communication with SourceNode processors:
 		bool foundInputSource() override;
 
-		void scanPorts(bool initialScan = false);
+		/** Detects connected headstages. Cable delays found by a previous scan are verified
+		    with a single read first; the full delay sweep only runs if that fails or fullScan is set.*/
+		void scanPorts(bool initialScan = false, bool fullScan = false);
+
+		/** Detects the headstages on a single SPI port at the current sample rate. Headstages,
+		    cable delays and channel names on the other ports are kept.*/
+		void rescanPort(Rhd2000ONIBoard::BoardPort port);
+
+		/** Returns the current stage of the board initialization*/
+		InitState getInitState() const { return initState; }
+
+		/** Starts the initialization again after it has failed*/
+		void retryInitialization();
+
+		/** Runs scanPorts() on a background thread. A change message is sent as the scan
+		    progresses and once it has finished.*/
+		void scanPortsAsync(bool fullScan = false);
+
+		/** Stops a background port scan at the next delay step*/
+		void cancelPortScan();
+
+		/** Returns true while a background port scan is running*/
+		bool isScanningPorts() const { return portScanRunning; }
+
+		/** Returns the progress of the current port scan (0-1)*/
+		float getPortScanProgress() const { return portScanProgress; }
 
 		void saveImpedances(File& file);
 
+		/** Returns true if impedance values are available (measured or loaded from the history)*/
+		bool hasImpedanceData() const { return impedances.valid; }
+
+		/** Writes the latest stored impedances, with all previous measurements, to a file (XML format)*/
+		void exportImpedanceHistory(File& file);
+
+		/** Returns all stored impedance measurements for a headstage channel, oldest first*/
+		Array<ImpedanceRecord> getImpedanceHistory(const Headstage* headstage, int channel) const;
+
 		// DEPRECATED:
 		//int getNumDataOutputs(DataChannel::DataChannelTypes type, int subProcessor) const override;
 		//unsigned int getNumSubProcessors() const override;
@@ -181,8 +267,6 @@ namespace ONIRhythmNode
 		void enableAuxs(bool);
 		void enableAdcs(bool);
 
-		int TTL_OUTPUT_STATE[16];
-
 		bool isAuxEnabled();
 		bool isAcquisitionActive() const;
 
@@ -194,10 +278,142 @@ namespace ONIRhythmNode
 		int getHeadstageChannels(int hsNum) const;
 		int getActiveChannelsInHeadstage(int hsNum) const;
 
-		void runImpedanceTest();
+		/** Measures electrode impedances. If channels (indexed across all connected headstages)
+		    are given, only those are measured and the other values are kept.*/
+		void runImpedanceTest(const Array<int>& channels = Array<int>());
+
+		/** Enables impedance measurements in the background during acquisition*/
+		void setImpedanceMonitorEnabled(bool enabled);
+
+		/** Returns true if background impedance measurements are enabled*/
+		bool isImpedanceMonitorEnabled() const;
+
+		/** Sets the idle time between two background measurements*/
+		void setImpedanceMonitorInterval(int intervalMs);
+
+		/** Enables fast settle when an artifact is detected on the selected channels (takes effect at the next start)*/
+		void setArtifactSettleEnabled(bool enabled);
+
+		/** Returns true if artifact-triggered fast settle is enabled*/
+		bool isArtifactSettleEnabled() const;
+
+		/** Sets the amplifier channels checked for artifacts (indexed across all connected headstages)*/
+		void setArtifactSettleChannels(const Array<int>& channels);
+
+		/** Returns the amplifier channels checked for artifacts*/
+		Array<int> getArtifactSettleChannels() const;
+
+		/** Sets the saturation and sample-to-sample step thresholds, in uV (a step of 0 disables step detection)*/
+		void setArtifactSettleThresholds(float saturation, float step);
+
+		/** Returns the saturation threshold, in uV*/
+		float getArtifactSettleSaturation() const;
+
+		/** Returns the sample-to-sample step threshold, in uV*/
+		float getArtifactSettleStep() const;
+
+		/** Sets the number of samples fast settle is held after an artifact*/
+		void setArtifactSettleSamples(int samples);
+
+		/** Returns the number of samples fast settle is held after an artifact*/
+		int getArtifactSettleSamples() const;
+
+		/** Returns the number of artifacts that triggered fast settle since acquisition started*/
+		int64 getNumArtifactSettleTriggers() const;
+
+		/** Enables blanking of the amplifier channels after stimulus edges (takes effect at the next start)*/
+		void setStimulusBlankingEnabled(bool enabled);
+
+		/** Returns true if stimulus blanking is enabled*/
+		bool isStimulusBlankingEnabled() const;
+
+		/** Selects the TTL output and input lines whose rising edges start a blanking window (bit n = line n)*/
+		void setStimulusBlankingTriggers(uint32 outputLines, uint32 inputLines);
+
+		/** Returns the TTL output lines that start a blanking window*/
+		uint32 getStimulusBlankingOutputTriggers() const;
+
+		/** Returns the TTL input lines that start a blanking window*/
+		uint32 getStimulusBlankingInputTriggers() const;
+
+		/** Sets the number of samples blanked after each edge*/
+		void setStimulusBlankingWindow(int samples);
+
+		/** Returns the number of samples blanked after each edge*/
+		int getStimulusBlankingWindow() const;
+
+		/** Replaces blanked samples by linear interpolation if true, by the value at the edge otherwise*/
+		void setStimulusBlankingInterpolation(bool interpolate);
+
+		/** Returns true if blanked samples are interpolated*/
+		bool isStimulusBlankingInterpolated() const;
+
+		/** Sets the blanked amplifier channels; all amplifier channels if empty*/
+		void setStimulusBlankingChannels(const Array<int>& channels);
+
+		/** Returns the blanked amplifier channels*/
+		Array<int> getStimulusBlankingChannels() const;
+
+		/** Configures the threshold detector of an ADC (0-7): thresholds in volts, ttlLine is the
+		    TTL output (0-7) following the detector or -1. Enabling the first detector takes effect
+		    after the next signal chain update, which adds the ADC event lines.*/
+		void setAdcThreshold(int adcChannel, bool enabled, float threshold, float hysteresis,
+							 bool falling = false, int ttlLine = -1);
+
+		/** Returns true if the threshold detector of an ADC is enabled*/
+		bool isAdcThresholdEnabled(int adcChannel) const;
+
+		/** Returns the threshold of an ADC, in volts*/
+		float getAdcThreshold(int adcChannel) const;
+
+		/** Returns the hysteresis of an ADC threshold, in volts*/
+		float getAdcThresholdHysteresis(int adcChannel) const;
+
+		/** Returns true if the ADC detector goes high below its threshold*/
+		bool isAdcThresholdFalling(int adcChannel) const;
+
+		/** Returns the TTL output line following an ADC detector, or -1*/
+		int getAdcThresholdOutput(int adcChannel) const;
+
+		/** Enables checking for connected or removed headstages while acquisition is stopped*/
+		void setHotplugProbeEnabled(bool enabled);
+
+		/** Returns true if headstages are checked for while acquisition is stopped*/
+		bool isHotplugProbeEnabled() const;
+
+		/** Sets the idle time between two headstage checks*/
+		void setHotplugProbeInterval(int intervalMs);
+
+		/** Returns the idle time between two headstage checks*/
+		int getHotplugProbeInterval() const;
+
+		/** Sets whether a port is rescanned as soon as its headstages have changed*/
+		void setHotplugAutoRescan(bool autoRescan);
+
+		/** Returns true if changed ports are rescanned automatically*/
+		bool isHotplugAutoRescanEnabled() const;
 
 		void enableBoardLeds(bool enable);
 
+		/** Keeps the board configuration when acquisition stops, so it restarts quickly (off by default).
+		    Frames left over from the previous run are discarded on restart; hotplug detection
+		    stays paused until then.*/
+		void setFastRestart(bool enabled);
+
+		/** Returns true if acquisition stops without resetting the board*/
+		bool isFastRestartEnabled() const { return settings.fastRestart; }
+
+		/** Time the data thread took to exit at the last acquisition stop, in ms*/
+		double getLastThreadExitLatencyMs() const { return lastThreadExitLatencyMs; }
+
+		/** Longest data thread exit time since the plugin was created, in ms*/
+		double getMaxThreadExitLatencyMs() const { return maxThreadExitLatencyMs; }
+
+		/** Latency between a TTL output request and its write to the board, in us*/
+		double getLastTtlLatencyUs() const;
+		double getMeanTtlLatencyUs() const;
+		double getMaxTtlLatencyUs() const;
+
 		int setClockDivider(int divide_ratio);
 
 		void setAdcRange(int adcChannel, short rangeType);
@@ -206,33 +422,81 @@ namespace ONIRhythmNode
 
 		static DataThread* createDataThread(SourceNode* sn);
 
-		class DigitalOutputTimer : public Timer
-		{
-		public:
+		/** Queues a TTL output command without parsing or allocating; safe from any thread.
+		    Commands are only accepted during acquisition. Returns false if the command was rejected.*/
+		bool executeTtlCommand(const TtlCommand& command);
 
-			/** Constructor */
-			DigitalOutputTimer(DeviceThread*, int tllLine, int eventDurationMs);
+		/** Loads a TTL pattern: a train of pulses (in samples from the start of the train), repeated
+		    with an interval between trains. Cannot be changed while the pattern is playing.*/
+		bool loadTtlPattern(const Array<TtlPatternPulse>& pulses, int repetitions, int64 interval, int64 trainLength = 0);
 
-			/** Destructor*/
-			~DigitalOutputTimer() { }
+		/** Plays the loaded TTL pattern from a sample number (-1 for the next sample), during acquisition only*/
+		bool startTtlPattern(int64 startSample = -1);
 
-			/** Sends signal to turn off event channel*/
-			void timerCallback();
+		/** Stops the TTL pattern at the end of the current train*/
+		void stopTtlPattern();
 
-		private:
-			DeviceThread* board;
+		/** Stops the TTL pattern immediately*/
+		void abortTtlPattern();
 
-			int tllOutputLine;
-		};
+		bool isTtlPatternPlaying() const;
 
-		struct DigitalOutputCommand {
-			int ttlLine;
-			bool state;
-		};
+		void addTtlPatternListener(TtlPatternListener* listener);
+		void removeTtlPatternListener(TtlPatternListener* listener);
+
+		/** Queues an analog waveform for the DAC outputs: numFrames x 8 codes (one per DAC
+		    channel, 32768 = 0 V) played at sampleRate, loops times (0 = until replaced).
+		    Returns false if two waveforms are already queued or playing, or if sampleRate is
+		    above DacPlayer::MAX_SAMPLE_RATE.*/
+		bool queueDacWaveform(const uint16* frames, int numFrames, double sampleRate, int loops = 1);
+
+		/** Plays the queued waveforms from a sample number (-1 for now), during acquisition only*/
+		bool startDacPlayback(int64 startSample = -1);
+
+		/** Stops the waveforms and sets the DAC outputs to 0 V*/
+		void stopDacPlayback();
+
+		bool isDacPlaying() const;
+
+		/** Routes a DAC output to the played waveforms instead of an amplifier channel*/
+		void setDacPlaybackChannel(int dacOutput, bool enabled);
+
+		/** Sets the auxiliary digital output pin of the headstages on a port, by switching the
+		    port to the AuxCmd1 list that writes it high or low. Takes effect at the next sample.*/
+		bool setHeadstageDigOut(Rhd2000ONIBoard::BoardPort port, bool high);
+
+		/** Returns the state of the headstage digital output on a port*/
+		bool getHeadstageDigOut(Rhd2000ONIBoard::BoardPort port) const;
+
+		/** Time from the last setHeadstageDigOut() call until the pin changed, in us (host
+		    register write plus the worst case wait for the next SPI command)*/
+		double getLastHeadstageDigOutLatencyUs() const { return lastDigOutLatencyUs; }
+
+		/** Returns the AuxCmd1 bank holding the digital output state of a port*/
+		int getDigOutBank(Rhd2000ONIBoard::BoardPort port) const;
+
+		/** Guards the AuxCmd1 bank selection, shared by the digital outputs and Zcheck*/
+		CriticalSection digOutLock;
+
+		/** Returns the last acquired sample number and the high resolution ticks at which
+		    it was read. Returns false if no samples have been acquired.*/
+		bool getSampleClock(int64& sampleNumber, int64& ticks) const;
+
+		/** Accepts binary TTL commands on a local TCP port (0 to disable)*/
+		void setTtlCommandPort(int port);
 
-		void addDigitalOutputCommand(DigitalOutputTimer* timerToDelete,
-			int ttlLine,
-			bool state);
+		/** Returns the TTL command port (0 if disabled)*/
+		int getTtlCommandPort() const;
+
+		/** Returns the Rhythm sample number of the last acquired frame (-1 if none)*/
+		int64 getCurrentSampleNumber() const;
+
+		/** Adds the state of the TTL outputs, as applied by the board, to the event channel
+		    (lines 10-17, off by default), so that every output edge is recorded at the sample it reached the pins*/
+		void setTtlOutputLogging(bool enabled);
+
+		/** Returns true if the TTL outputs are recorded in the event channel*/
+		bool isTtlOutputLoggingEnabled() const { return settings.logTtlOutputs; }
 
 		int MAX_NUM_HEADSTAGES;
 		int MAX_NUM_DATA_STREAMS;
@@ -241,9 +505,9 @@ namespace ONIRhythmNode
 		bool varSampleRateCapable = false;
 
 		bool commonCommandsSet = false;
-		std::queue<DigitalOutputCommand> digitalOutputCommands;
 
-		OwnedArray<DigitalOutputTimer> digitalOutputTimers;
+		/** Settings the AuxCmd3 register configurations were last uploaded with (empty if none)*/
+		String uploadedRegisterConfig;
 
 		bool enableHeadstage(int hsNum, bool enabled, int nStr = 1, int strChans = 32);
 		void updateBoardStreams();
@@ -258,12 +522,73 @@ namespace ONIRhythmNode
 		/** Custom classes*/
 		OwnedArray<Headstage> headstages;
 		ScopedPointer<ImpedanceMeter> impedanceThread;
+		ScopedPointer<ImpedanceMonitor> impedanceMonitor;
+		ScopedPointer<ImpedanceHistory> impedanceHistory;
+		ScopedPointer<CableDelayCache> cableDelayCache;
+		ScopedPointer<PortScanner> portScanner;
+		ScopedPointer<HotplugMonitor> hotplugMonitor;
+		ScopedPointer<DeviceInitializer> deviceInitializer;
+		ScopedPointer<TtlOutputWriter> ttlWriter;
+		ScopedPointer<PulseScheduler> pulseScheduler;
+		ScopedPointer<TtlCommandServer> ttlCommandServer;
+		ScopedPointer<PatternSequencer> patternSequencer;
+		ScopedPointer<DacPlayer> dacPlayer;
+		ScopedPointer<ArtifactSettle> artifactSettle;
+		ScopedPointer<StimulusBlanker> stimulusBlanker;
+		ScopedPointer<AdcThresholdDetector> adcDetector;
+
+		/** Stage of the background initialization*/
+		std::atomic<InitState> initState;
+
+		/** Updates the initialization stage and notifies listeners*/
+		void setInitState(InitState state);
+
+		/** Reads the gateware version and brings the board to its default settings. Returns false if the board does not respond.*/
+		bool prepareBoard();
+
+		/** Applies the default DAC and DSP settings once the ports have been scanned*/
+		void finishInitialization();
+
+		/** Port scan state, shared with the PortScanner thread*/
+		std::atomic<bool> portScanRunning;
+		std::atomic<bool> portScanCancelled;
+		std::atomic<float> portScanProgress;
+
+		/** Held while headstages are being detected, impedances measured or the board reprogrammed*/
+		CriticalSection portScanLock;
+
+		/** Updates the port scan progress and notifies listeners*/
+		void setPortScanProgress(float progress);
+
+		/** Cable delay of each port at each amplifier sample rate (-1 if not checked yet)*/
+		std::array<std::array<int, Rhd2000ONIBoard::SampleRate30000Hz + 1>, 4> sampleRateDelays;
+
+		/** Optimum delay and chip IDs each port's sample rate delays were found with*/
+		std::array<Array<int>, 4> sampleRateDelayKeys;
+
+		/** True if background impedance measurements run during this acquisition*/
+		bool impedanceMonitorActive = false;
+
+		/** True if artifact-triggered fast settle runs during this acquisition*/
+		bool artifactSettleActive = false;
+
+		/** True if stimulus artifacts are blanked during this acquisition*/
+		bool stimulusBlankerActive = false;
+
+		/** True if ADC threshold events are generated during this acquisition*/
+		bool adcDetectorActive = false;
+
+		/** True if the event channel was created with the ADC event lines (see updateSettings())*/
+		bool adcEventLinesEnabled = false;
+
+		/** Last sample of the 8 ADCs, in volts*/
+		float adcSample[8];
 
 		/** True if device is available*/
 		bool deviceFound;
 
-		/** True if data is streaming*/
-		bool isTransmitting;
+		/** True if data is streaming (read by the TTL command server thread)*/
+		std::atomic<bool> isTransmitting;
 
 		/** True if change in settings is needed during acquisition*/
 		bool updateSettingsDuringAcquisition;
@@ -342,6 +667,8 @@ namespace ONIRhythmNode
 			bool newScan = true;
 			int numberingScheme = 1;
 			uint16 clockDivideFactor = 0;
+			bool fastRestart = false;
+			bool logTtlOutputs = false;
 
 		} settings;
 
@@ -349,7 +676,7 @@ namespace ONIRhythmNode
 		bool openBoard(bool displayInfo = false);
 
 		/** Initialize the board*/
-		void initializeBoard();
+		bool initializeBoard();
 
 		/**Check board memory status */
 		bool checkBoardMem() const;
@@ -357,14 +684,106 @@ namespace ONIRhythmNode
 		/** Update register settings*/
 		void updateRegisters();
 
+		/** Selects the regular (or fast settle) AuxCmd3 bank on all ports*/
+		void selectRegularAuxCmd3Bank();
+
+		/** Resets the board if frames of a fast-stopped run are still queued.
+		    Must be called before the board is run outside of acquisition.*/
+		void flushStaleFrames();
+
+		/** True while frames of the last run may still be queued (fast restart)*/
+		std::atomic<bool> staleFramesQueued { false };
+
+		/** Acquisition clock of the last frame read; queued frames after a fast stop are newer*/
+		oni_fifo_time_t lastFrameTime = 0;
+
+		/** Headstage digital outputs set high (bit per port)*/
+		std::atomic<int> headstageDigOut;
+		std::atomic<double> lastDigOutLatencyUs;
+
+		/** DAC outputs playing waveforms instead of amplifier channels (bit per output)*/
+		std::atomic<int> dacPlaybackChannels;
+
+		/** Sample clock published by the acquisition thread; odd version while it is updated*/
+		std::atomic<uint32> sampleClockVersion;
+		std::atomic<int64> sampleClockSample;
+		std::atomic<int64> sampleClockTicks;
+
+		/** Builds a configuration from the current settings and makes it the one the acquisition
+		    thread uses from its next batch of frames. Configurations no longer in use are freed.*/
+		void publishAcquisitionConfig();
+
+		/** Returns the latest configuration and marks it as in use (acquisition thread)*/
+		const AcquisitionConfig* acquireAcquisitionConfig();
+
+		/** Configurations that may still be read, owned by the message thread*/
+		OwnedArray<AcquisitionConfig> acquisitionConfigs;
+		CriticalSection acquisitionConfigLock;
+
+		/** Latest configuration, and the one the acquisition thread is reading*/
+		std::atomic<const AcquisitionConfig*> publishedConfig;
+		std::atomic<const AcquisitionConfig*> configInUse;
+
+		/** TTL output state written by the acquisition thread*/
+		uint32 ttlOutputState = 0;
+
+		/** Handles the ACQBOARD PATTERN broadcast messages*/
+		void handlePatternMessage(const StringArray& parts);
+
+		double lastThreadExitLatencyMs = 0.0;
+		double maxThreadExitLatencyMs = 0.0;
+
 		/** Returns the device ID for an Intan chip*/
 		int getDeviceId(Rhd2000DataBlock* dataBlock, int stream, int& register59Value);
 
+		/** Reads one block of a continuously running port scan, starting at the beginning of a
+		    command sequence that was entirely sent after the last cable delay change*/
+		bool readScanBurst(Rhd2000DataBlock* dataBlock, int sequenceLength, int64& sampleCount);
+
+		/** Returns an identifier for the connected board, used to key cached settings. ONI does not
+		    expose a board serial number, so it is based on the hardware address: a board moved to
+		    another slot is scanned in full once.*/
+		String getBoardId() const;
+
+		/** Sets the cached cable delays and checks that the same chips answer on every port.
+		    On success, fills the chip ID of each data source and the delay of each port.*/
+		bool verifyCachedDelays(Rhd2000DataBlock* dataBlock, Array<int>& detectedChipIds, Array<int>& portDelays);
+
+		/** Stores the current optimum delays and the chip IDs found on each port*/
+		void storeCableDelays(const Array<int>& detectedChipIds);
+
+		/** Forgets the per-sample-rate delays of every port whose chips or optimum delay have changed*/
+		void updateSampleRateDelayKeys(const Array<int>& detectedChipIds);
+
+		/** Restores the per-sample-rate delays stored with the cached cable delays*/
+		void loadSampleRateDelays();
+
+		/** Stores the per-sample-rate delays with the cached cable delays*/
+		void storeSampleRateDelays();
+
+		/** Enables a headstage with the streams its chip ID needs, or disables it if no chip was found*/
+		void enableDetectedHeadstage(int hsNum, int detectedChipId);
+
+		/** Sets the delays already found for a sample rate. Returns false if a connected port has not been checked at that rate.*/
+		bool applyKnownDelays(int sampleRate);
+
+		/** Returns the chip ID of a connected headstage (-1 if unknown)*/
+		int getHeadstageChipId(const Headstage* headstage) const;
+
+		/** Queues a measured impedance value for the history file*/
+		void storeImpedance(const Headstage* headstage, int channel, float frequency, int64 timestamp);
+
+		/** Sets headstage impedances from the latest stored measurements*/
+		void applyImpedanceHistory();
+
 		int* dacChannels, *dacStream;
 		float* dacThresholds;
 		bool* dacChannelsToUpdate;
 		Array<int> chipId;
 
+		/** Chip ID found on each data source (one per headstage) by the last scan*/
+		Array<int> headstageChipIds;
+
 		Array<int> numChannelsPerDataStream;
 
 		ChannelNamingScheme channelNamingScheme;
@@ -207,6 +207,19 @@ void Headstage::generateChannelNames()
 void Headstage::setImpedances(Impedances& impedances)
 {
 
+    if (impedances.partial)
+    {
+        for (int i = 0; i < impedances.streams.size(); i++)
+        {
+            int ch = getChannelIndex(impedances.streams[i], impedances.channels[i]);
+
+            if (ch >= 0)
+                setImpedance(ch, impedances.magnitudes[i], impedances.phases[i]);
+        }
+
+        return;
+    }
+
     impedanceMagnitudes.clear();
     impedancePhases.clear();
 
@@ -226,6 +239,34 @@ void Headstage::setImpedances(Impedances& impedances)
     }
 }
 
+int Headstage::getChannelIndex(int stream, int streamChannel) const
+{
+    if (!isConnected() || stream < streamIndex || stream >= streamIndex + numStreams)
+        return -1;
+
+    int activeChannelsPerStream = getNumActiveChannels() / numStreams;
+
+    if (streamChannel < 0 || streamChannel >= activeChannelsPerStream)
+        return -1;
+
+    return (stream - streamIndex) * activeChannelsPerStream + streamChannel;
+}
+
+void Headstage::setImpedance(int channel, float magnitude, float phase)
+{
+    if (channel < 0 || channel >= getNumActiveChannels())
+        return;
+
+    while (impedanceMagnitudes.size() < getNumActiveChannels())
+    {
+        impedanceMagnitudes.add(0.0f);
+        impedancePhases.add(0.0f);
+    }
+
+    impedanceMagnitudes.set(channel, magnitude);
+    impedancePhases.set(channel, phase);
+}
+
 float Headstage::getImpedanceMagnitude(int channel) const
 {
     if (channel < impedanceMagnitudes.size())
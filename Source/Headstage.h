@@ -119,6 +119,12 @@ namespace ONIRhythmNode
 		/** Sets impedance values after measurement*/
 		void setImpedances(Impedances& impedances);
 
+		/** Returns the channel index for a channel on one of this headstage's streams, or -1*/
+		int getChannelIndex(int stream, int streamChannel) const;
+
+		/** Updates the impedance value of a single channel*/
+		void setImpedance(int channel, float magnitude, float phase);
+
 		/** Returns the impedance magnitude for a channel (if it exists)*/
 		float getImpedanceMagnitude(int channel) const;
 
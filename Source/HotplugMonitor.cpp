@@ -0,0 +1,281 @@
+/*
+    ------------------------------------------------------------------
+
+    This file is part of the Open Ephys GUI
+    Copyright (C) 2021 Open Ephys
+
+    ------------------------------------------------------------------
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "HotplugMonitor.h"
+#include "ImpedanceMeter.h"
+#include "Headstage.h"
+
+using namespace ONIRhythmNode;
+
+/** Number of consecutive probes that must see a change before it is reported*/
+#define HOTPLUG_CONFIRM_PROBES 2
+
+HotplugMonitor::HotplugMonitor(DeviceThread* board_) :
+    Thread("Hotplug Monitor"),
+    board(board_),
+    enabled(true),
+    autoRescan(false),
+    intervalMs(2000),
+    changedPorts(0),
+    portsRescanned(false)
+{
+    probeDelay.fill(0);
+    changeCount.fill(0);
+}
+
+HotplugMonitor::~HotplugMonitor()
+{
+    pause();
+    cancelPendingUpdate();
+}
+
+void HotplugMonitor::setEnabled(bool enabled_)
+{
+    enabled = enabled_;
+
+    if (enabled)
+    {
+        if (!CoreServices::getAcquisitionStatus())
+            resume();
+    }
+    else
+    {
+        pause();
+    }
+}
+
+void HotplugMonitor::setInterval(int intervalMs_)
+{
+    intervalMs = jmax(100, intervalMs_);
+}
+
+void HotplugMonitor::setAutoRescan(bool autoRescan_)
+{
+    autoRescan = autoRescan_;
+}
+
+void HotplugMonitor::resume()
+{
+    if (!enabled || !board->foundInputSource() || isThreadRunning())
+        return;
+
+    changeCount.fill(0);
+
+    startThread();
+}
+
+void HotplugMonitor::pause()
+{
+    signalThreadShouldExit();
+    notify();
+
+    // a probe only takes a few ms, but an automatic rescan has to finish
+    if (!stopThread(5000))
+        LOGE("Hotplug monitor did not exit.");
+}
+
+void HotplugMonitor::run()
+{
+    while (!threadShouldExit())
+    {
+        wait(intervalMs);
+
+        if (threadShouldExit())
+            break;
+
+        int changed = probe();
+
+        if (changed == 0)
+            continue;
+
+        bool rescanned = false;
+
+        if (autoRescan)
+        {
+            for (int port = 0; port < 4 && !threadShouldExit(); port++)
+            {
+                if (changed & (1 << port))
+                {
+                    board->rescanPort(static_cast<Rhd2000ONIBoard::BoardPort>(port));
+                    rescanned = true;
+                }
+            }
+        }
+
+        changedPorts |= changed;
+        portsRescanned = portsRescanned || rescanned;
+
+        triggerAsyncUpdate();
+    }
+}
+
+int HotplugMonitor::probe()
+{
+    // skip this probe if the ports are being scanned
+    const ScopedTryLock scanLock(board->portScanLock);
+
+    if (!scanLock.isLocked())
+        return 0;
+
+    if (board->isThreadRunning() || board->impedanceThread->isThreadRunning()
+        || board->headstageChipIds.size() < board->headstages.size())
+        return 0;
+
+    // Frames of a fast-stopped run can only be flushed by resetting the board, which
+    // would defeat the fast restart; probing resumes once the board has been reset.
+    if (board->staleFramesQueued)
+        return 0;
+
+    Rhd2000ONIBoard* evalBoard = board->evalBoard;
+
+    if (dataBlock == nullptr)
+        dataBlock = new Rhd2000DataBlock(board->MAX_NUM_DATA_STREAMS, evalBoard->isUSB3());
+
+    Array<bool> portIsEmpty;
+
+    for (int port = 0; port < 4; port++)
+        portIsEmpty.add(board->headstageChipIds[port * 2] <= 0 && board->headstageChipIds[port * 2 + 1] <= 0);
+
+    Array<int> ids;
+
+    {
+        const ScopedLock lock(board->oniLock);
+
+        if (threadShouldExit())
+            return 0;
+
+        for (int i = 0; i < board->MAX_NUM_DATA_STREAMS; i++)
+        {
+            evalBoard->enableDataStream(i, i < board->headstages.size());
+
+            if (i < board->headstages.size())
+                evalBoard->setDataSource(i, board->headstages[i]->getDataStream(0));
+        }
+
+        evalBoard->updateStreamBlockSize();
+
+        // connected ports keep their delays; empty ports are the only ones not in use
+        for (int port = 0; port < 4; port++)
+        {
+            if (portIsEmpty[port])
+                evalBoard->setCableDelay(static_cast<Rhd2000ONIBoard::BoardPort>(port), probeDelay[port]);
+        }
+
+        evalBoard->setMaxTimeStep(INIT_STEP);
+        evalBoard->setContinuousRunMode(false);
+        evalBoard->run();
+
+        bool ok = evalBoard->readDataBlock(dataBlock, INIT_STEP);
+
+        evalBoard->stop();
+
+        if (ok)
+        {
+            for (int hs = 0; hs < board->headstages.size(); hs++)
+                ids.add(readChipId(hs));
+        }
+    }
+
+    board->updateBoardStreams();
+
+    if (ids.size() < board->headstages.size())
+    {
+        LOGD("Hotplug probe could not read data");
+        return 0;
+    }
+
+    int changed = 0;
+
+    for (int port = 0; port < 4; port++)
+    {
+        bool portChanged = false;
+
+        for (int hs = port * 2; hs < port * 2 + 2; hs++)
+        {
+            int known = board->headstageChipIds[hs] > 0 ? board->headstageChipIds[hs] : -1;
+            portChanged = portChanged || ids[hs] != known;
+        }
+
+        if (!portChanged)
+        {
+            changeCount[port] = 0;
+
+            // nothing answered at this delay, try the next one
+            if (portIsEmpty[port])
+                probeDelay[port] = (probeDelay[port] + 1) % 16;
+
+            continue;
+        }
+
+        if (++changeCount[port] >= HOTPLUG_CONFIRM_PROBES)
+        {
+            LOGC("Headstage change detected on port ", String::charToString('A' + port));
+
+            changeCount[port] = 0;
+            changed |= 1 << port;
+        }
+    }
+
+    return changed;
+}
+
+int HotplugMonitor::readChipId(int stream)
+{
+    int register59Value;
+    int id = board->getDeviceId(dataBlock, stream, register59Value);
+
+    if (id == CHIP_ID_RHD2132 || id == CHIP_ID_RHD2216 ||
+        (id == CHIP_ID_RHD2164 && register59Value == REGISTER_59_MISO_A))
+        return id;
+
+    return -1;
+}
+
+void HotplugMonitor::handleAsyncUpdate()
+{
+    int ports = changedPorts.exchange(0);
+    bool rescanned = portsRescanned.exchange(false);
+
+    if (ports == 0)
+        return;
+
+    StringArray names;
+
+    for (int port = 0; port < 4; port++)
+    {
+        if (ports & (1 << port))
+            names.add(String::charToString('A' + port));
+    }
+
+    if (rescanned)
+    {
+        CoreServices::sendStatusMessage("Headstages changed on port " + names.joinIntoString(", ") + ".");
+
+        // the editor updates the signal chain
+        board->sendChangeMessage();
+    }
+    else
+    {
+        CoreServices::sendStatusMessage("Headstages changed on port " + names.joinIntoString(", ") + ". Press RESCAN to update.");
+    }
+}
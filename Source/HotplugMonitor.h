@@ -0,0 +1,127 @@
+/*
+    ------------------------------------------------------------------
+
+    This file is part of the Open Ephys GUI
+    Copyright (C) 2020 Open Ephys
+
+    ------------------------------------------------------------------
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef __HOTPLUGMONITOR_H_2C4CBD67__
+#define __HOTPLUGMONITOR_H_2C4CBD67__
+
+#include <DataThreadHeaders.h>
+
+#include <array>
+#include <atomic>
+
+#include "rhythm-api/rhd2000ONIboard.h"
+#include "rhythm-api/rhd2000datablock.h"
+
+#include "DeviceThread.h"
+
+namespace ONIRhythmNode
+{
+
+	/**
+		Detects headstages being connected or removed while acquisition is stopped.
+
+		Every interval, all eight data sources are read once (INIT_STEP samples)
+		with the current cable delays, and the chip IDs found are compared with
+		the ones found by the last port scan. Ports without a known chip are
+		probed at a different delay each time, so a new headstage is found within
+		16 probes. A change must be seen by two consecutive probes before it is
+		reported; the affected port can then be rescanned automatically.
+
+		The probe never runs during acquisition, impedance measurements, port scans or
+		while the board is reprogrammed; all of these hold DeviceThread::portScanLock.
+		It is also skipped while frames of a fast-stopped run are queued.
+
+		@see DeviceThread::rescanPort
+	*/
+	class HotplugMonitor : public Thread,
+						   public AsyncUpdater
+	{
+	public:
+
+		/** Constructor*/
+		HotplugMonitor(DeviceThread* b);
+
+		/** Destructor*/
+		~HotplugMonitor();
+
+		/** Enables or disables the probe*/
+		void setEnabled(bool enabled);
+
+		/** Returns true if the probe is enabled*/
+		bool isEnabled() const { return enabled; }
+
+		/** Sets the idle time between two probes*/
+		void setInterval(int intervalMs);
+
+		/** Returns the idle time between two probes*/
+		int getInterval() const { return intervalMs; }
+
+		/** Sets whether a port is rescanned as soon as a change is detected on it*/
+		void setAutoRescan(bool autoRescan);
+
+		/** Returns true if changed ports are rescanned automatically*/
+		bool isAutoRescanEnabled() const { return autoRescan; }
+
+		/** Starts probing, if enabled*/
+		void resume();
+
+		/** Stops probing. Returns once the current probe has finished.*/
+		void pause();
+
+		/** Probes the ports periodically*/
+		void run() override;
+
+		/** Reports detected changes (message thread)*/
+		void handleAsyncUpdate() override;
+
+	private:
+
+		/** Reads all data sources once. Returns a bit mask of the ports whose chips have changed.*/
+		int probe();
+
+		/** Returns the chip ID read from a data source, or -1 if no valid chip answered*/
+		int readChipId(int stream);
+
+		DeviceThread* board;
+
+		ScopedPointer<Rhd2000DataBlock> dataBlock;
+
+		std::atomic<bool> enabled;
+		std::atomic<bool> autoRescan;
+		std::atomic<int> intervalMs;
+
+		/** Delay each port without a known chip is probed at*/
+		std::array<int, 4> probeDelay;
+
+		/** Number of consecutive probes that saw a change on each port*/
+		std::array<int, 4> changeCount;
+
+		/** Ports changed since the last update, and whether they have been rescanned*/
+		std::atomic<int> changedPorts;
+		std::atomic<bool> portsRescanned;
+
+		JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(HotplugMonitor);
+	};
+
+}
+#endif  // __HOTPLUGMONITOR_H_2C4CBD67__
@@ -0,0 +1,350 @@
+/*
+    ------------------------------------------------------------------
+
+    This file is part of the Open Ephys GUI
+    Copyright (C) 2021 Open Ephys
+
+    ------------------------------------------------------------------
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "ImpedanceHistory.h"
+
+#include <vector>
+
+using namespace ONIRhythmNode;
+
+static_assert(sizeof(ImpedanceRecord) == 32, "ImpedanceRecord must keep its on-disk layout");
+
+namespace
+{
+    struct HistoryHeader
+    {
+        char magic[8];
+        uint32 version;
+        uint32 recordSize;
+    };
+
+    const char historyMagic[8] = { 'O', 'E', 'Z', 'H', 'I', 'S', 'T', '\0' };
+    const uint32 historyVersion = 1;
+
+    // fcntl-based InterProcessLocks are held per process, so instances in this process also share this one
+    CriticalSection& getProcessFileLock()
+    {
+        static CriticalSection processFileLock;
+        return processFileLock;
+    }
+}
+
+ImpedanceHistory::ImpedanceHistory(const File& file_) :
+    file(file_),
+    records(nullptr),
+    numRecords(0),
+    lastRecord(),
+    fileLock("rhythm-oni-" + file_.getFileName())
+{
+}
+
+ImpedanceHistory::~ImpedanceHistory()
+{
+    flush();
+}
+
+int64 ImpedanceHistory::makeKey(int port, int chipId, int channel)
+{
+    return (int64(port & 0xFFFF) << 32) | (int64(chipId & 0xFFFF) << 16) | int64(channel & 0xFFFF);
+}
+
+void ImpedanceHistory::unmap()
+{
+    mappedFile.reset();
+    records = nullptr;
+}
+
+bool ImpedanceHistory::hasValidHeader() const
+{
+    FileInputStream stream(file);
+    HistoryHeader header;
+
+    return stream.openedOk()
+        && stream.read(&header, sizeof(header)) == sizeof(header)
+        && memcmp(header.magic, historyMagic, sizeof(historyMagic)) == 0
+        && header.version == historyVersion
+        && header.recordSize == sizeof(ImpedanceRecord);
+}
+
+void ImpedanceHistory::indexRecords(int firstRecord)
+{
+    for (int i = firstRecord; i < numRecords; i++)
+    {
+        recordIndex[makeKey(records[i].port, records[i].chipId, records[i].channel)].add(i);
+    }
+
+    if (numRecords > 0)
+        lastRecord = records[numRecords - 1];
+}
+
+bool ImpedanceHistory::compact()
+{
+    MemoryBlock data;
+
+    if (!file.loadFileAsData(data) || data.getSize() < sizeof(HistoryHeader))
+        return false;
+
+    const ImpedanceRecord* fileRecords = reinterpret_cast<const ImpedanceRecord*>(
+        static_cast<const char*>(data.getData()) + sizeof(HistoryHeader));
+    const int numFileRecords = int((data.getSize() - sizeof(HistoryHeader)) / sizeof(ImpedanceRecord));
+
+    // keep the latest records of every channel, up to half the cap so compaction stays rare
+    std::map<int64, int> channelCounts;
+    std::vector<bool> keep(numFileRecords, false);
+    int numKept = 0;
+
+    for (int i = numFileRecords - 1; i >= 0 && numKept < MAX_RECORDS / 2; i--)
+    {
+        int& count = channelCounts[makeKey(fileRecords[i].port, fileRecords[i].chipId, fileRecords[i].channel)];
+
+        if (count < MAX_TREND_RECORDS)
+        {
+            count++;
+            keep[i] = true;
+            numKept++;
+        }
+    }
+
+    // other instances keep mapping the replaced file until their next flush
+    TemporaryFile tempFile(file);
+
+    {
+        FileOutputStream stream(tempFile.getFile());
+
+        if (stream.failedToOpen())
+            return false;
+
+        stream.write(data.getData(), sizeof(HistoryHeader));
+
+        for (int i = 0; i < numFileRecords; i++)
+        {
+            if (keep[i])
+                stream.write(&fileRecords[i], sizeof(ImpedanceRecord));
+        }
+
+        stream.flush();
+
+        if (stream.getStatus().failed())
+            return false;
+    }
+
+    if (!tempFile.overwriteTargetFileWithTemporary())
+        return false;
+
+    LOGD("Compacted impedance history from ", numFileRecords, " to ", numKept, " records.");
+
+    return true;
+}
+
+bool ImpedanceHistory::load()
+{
+    const ScopedLock sl(lock);
+
+    unmap();
+    recordIndex.clear();
+    numRecords = 0;
+
+    if (!file.existsAsFile())
+        return false;
+
+    mappedFile = std::make_unique<MemoryMappedFile>(file, MemoryMappedFile::readOnly);
+
+    if (mappedFile->getData() == nullptr || mappedFile->getSize() < sizeof(HistoryHeader))
+    {
+        unmap();
+        return false;
+    }
+
+    const HistoryHeader* header = static_cast<const HistoryHeader*>(mappedFile->getData());
+
+    if (memcmp(header->magic, historyMagic, sizeof(historyMagic)) != 0
+        || header->version != historyVersion
+        || header->recordSize != sizeof(ImpedanceRecord))
+    {
+        LOGE("Impedance history file ", file.getFullPathName(), " has an unknown format.");
+        unmap();
+        return false;
+    }
+
+    records = reinterpret_cast<const ImpedanceRecord*>(header + 1);
+
+    // a record that was only partially written is ignored
+    numRecords = int((mappedFile->getSize() - sizeof(HistoryHeader)) / sizeof(ImpedanceRecord));
+
+    indexRecords(0);
+
+    LOGD("Loaded ", numRecords, " impedance history records.");
+
+    return true;
+}
+
+void ImpedanceHistory::add(const ImpedanceRecord& record)
+{
+    const ScopedLock sl(lock);
+
+    pendingRecords.add(record);
+}
+
+bool ImpedanceHistory::flush()
+{
+    const ScopedLock sl(lock);
+
+    if (pendingRecords.size() == 0)
+        return true;
+
+    // other plugin instances append to the same file
+    const ScopedLock instanceLock(getProcessFileLock());
+    const InterProcessLock::ScopedLockType processLock(fileLock);
+
+    if (!processLock.isLocked())
+    {
+        LOGE("Could not lock impedance history file ", file.getFullPathName());
+        return false;
+    }
+
+    if (file.existsAsFile() && file.getSize() > 0 && !hasValidHeader())
+    {
+        // keep an unreadable file for inspection instead of appending to it
+        file.moveFileTo(file.withFileExtension("bak"));
+    }
+
+    if (file.getSize() > int64(sizeof(HistoryHeader)) + int64(MAX_RECORDS) * int64(sizeof(ImpedanceRecord)))
+    {
+        // the file is replaced, so the records are indexed again once it is re-mapped
+        unmap();
+        numRecords = 0;
+        recordIndex.clear();
+
+        if (!compact())
+            LOGE("Could not compact impedance history file ", file.getFullPathName());
+    }
+
+    int firstNewRecord = numRecords;
+
+    {
+        // the current mapping stays valid if the file cannot be opened
+        FileOutputStream stream(file);
+
+        if (stream.failedToOpen())
+        {
+            LOGE("Could not open impedance history file ", file.getFullPathName());
+            return false;
+        }
+
+        // the mapping must not be held while the file changes size
+        unmap();
+
+        if (stream.getPosition() == 0)
+        {
+            HistoryHeader header;
+            memcpy(header.magic, historyMagic, sizeof(historyMagic));
+            header.version = historyVersion;
+            header.recordSize = sizeof(ImpedanceRecord);
+
+            stream.write(&header, sizeof(header));
+            firstNewRecord = 0;
+        }
+        else
+        {
+            // Drop a partially written record left by an interrupted append. Complete records
+            // are kept, including those other instances appended since the last flush.
+            const int64 fileRecords = (stream.getPosition() - int64(sizeof(HistoryHeader))) / int64(sizeof(ImpedanceRecord));
+            const int64 validSize = sizeof(HistoryHeader) + fileRecords * sizeof(ImpedanceRecord);
+
+            if (stream.getPosition() != validSize)
+            {
+                stream.setPosition(validSize);
+                stream.truncate();
+            }
+        }
+
+        stream.write(pendingRecords.getRawDataPointer(), pendingRecords.size() * sizeof(ImpedanceRecord));
+        stream.flush();
+    }
+
+    pendingRecords.clear();
+
+    // re-map and index the records that are new to this instance
+    mappedFile = std::make_unique<MemoryMappedFile>(file, MemoryMappedFile::readOnly);
+
+    if (mappedFile->getData() == nullptr)
+    {
+        unmap();
+        numRecords = 0;
+        recordIndex.clear();
+        return false;
+    }
+
+    records = reinterpret_cast<const ImpedanceRecord*>(static_cast<const char*>(mappedFile->getData()) + sizeof(HistoryHeader));
+    numRecords = int((mappedFile->getSize() - sizeof(HistoryHeader)) / sizeof(ImpedanceRecord));
+
+    // the file was compacted or replaced by another instance since the last flush
+    if (firstNewRecord > numRecords
+        || (firstNewRecord > 0 && memcmp(&records[firstNewRecord - 1], &lastRecord, sizeof(ImpedanceRecord)) != 0))
+        firstNewRecord = 0;
+
+    if (firstNewRecord == 0)
+        recordIndex.clear();
+
+    indexRecords(firstNewRecord);
+
+    return true;
+}
+
+bool ImpedanceHistory::getLatest(int port, int chipId, int channel, ImpedanceRecord& record) const
+{
+    const ScopedLock sl(lock);
+
+    auto it = recordIndex.find(makeKey(port, chipId, channel));
+
+    if (it == recordIndex.end() || it->second.size() == 0)
+        return false;
+
+    record = records[it->second.getLast()];
+
+    return true;
+}
+
+Array<ImpedanceRecord> ImpedanceHistory::getTrend(int port, int chipId, int channel) const
+{
+    const ScopedLock sl(lock);
+
+    Array<ImpedanceRecord> trend;
+
+    auto it = recordIndex.find(makeKey(port, chipId, channel));
+
+    if (it != recordIndex.end())
+    {
+        for (int i : it->second)
+            trend.add(records[i]);
+    }
+
+    return trend;
+}
+
+int ImpedanceHistory::getNumRecords() const
+{
+    const ScopedLock sl(lock);
+
+    return numRecords;
+}
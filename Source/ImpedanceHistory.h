@@ -0,0 +1,133 @@
+/*
+    ------------------------------------------------------------------
+
+    This file is part of the Open Ephys GUI
+    Copyright (C) 2020 Open Ephys
+
+    ------------------------------------------------------------------
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef __IMPEDANCEHISTORY_H_2C4CBD67__
+#define __IMPEDANCEHISTORY_H_2C4CBD67__
+
+#include <DataThreadHeaders.h>
+
+#include <map>
+#include <memory>
+
+namespace ONIRhythmNode
+{
+
+	/** A single impedance measurement, as stored on disk (32 bytes)*/
+	struct ImpedanceRecord
+	{
+		int64 timestamp;   // milliseconds since 1970
+		int16 port;        // headstage data source (A1 = 0 ... D2 = 7)
+		int16 chipId;
+		int16 channel;     // headstage channel index
+		int16 reserved;
+		float frequency;   // Hz
+		float magnitude;   // Ohm
+		float phase;       // degrees
+	};
+
+	/**
+		Append-only binary store of impedance measurements, keyed by
+		headstage port, chip ID and channel.
+
+		The file is a 16-byte header followed by fixed-size ImpedanceRecords.
+		It is memory-mapped on load, so the latest value and the trend of
+		any channel are available without parsing or re-measuring. Several
+		plugin instances may share the file; appends are serialized by an
+		inter-process lock, and records appended by other instances are
+		indexed on the next flush().
+
+		The file is capped: once it holds more than MAX_RECORDS records, flush()
+		compacts it to the latest MAX_TREND_RECORDS of each channel (at most
+		half the cap) before appending.
+	*/
+	class ImpedanceHistory
+	{
+	public:
+
+		/** Constructor*/
+		ImpedanceHistory(const File& file);
+
+		/** Destructor*/
+		~ImpedanceHistory();
+
+		/** Maps the history file and indexes its records. Returns false if the file is missing or invalid.*/
+		bool load();
+
+		/** Queues a measurement; it is written to disk on the next call to flush()*/
+		void add(const ImpedanceRecord& record);
+
+		/** Appends queued measurements to the history file*/
+		bool flush();
+
+		/** Gets the most recent measurement for a channel. Returns false if there is none.*/
+		bool getLatest(int port, int chipId, int channel, ImpedanceRecord& record) const;
+
+		/** Returns all measurements for a channel, oldest first*/
+		Array<ImpedanceRecord> getTrend(int port, int chipId, int channel) const;
+
+		/** Returns the total number of stored measurements*/
+		int getNumRecords() const;
+
+		static const int MAX_RECORDS = 1 << 18;
+		static const int MAX_TREND_RECORDS = 256;
+
+	private:
+
+		/** Returns the index key for a channel*/
+		static int64 makeKey(int port, int chipId, int channel);
+
+		/** Releases the memory-mapped file*/
+		void unmap();
+
+		/** Returns true if the file starts with a valid history header*/
+		bool hasValidHeader() const;
+
+		/** Rewrites the file with the latest records of each channel. Must be called with
+		    the file locked and unmapped.*/
+		bool compact();
+
+		/** Indexes the mapped records from a position on*/
+		void indexRecords(int firstRecord);
+
+		File file;
+
+		std::unique_ptr<MemoryMappedFile> mappedFile;
+		const ImpedanceRecord* records;
+		int numRecords;
+
+		std::map<int64, Array<int>> recordIndex;
+
+		/** Copy of the last indexed record, to detect a file rewritten by another instance*/
+		ImpedanceRecord lastRecord;
+
+		Array<ImpedanceRecord> pendingRecords;
+
+		CriticalSection lock;
+
+		InterProcessLock fileLock;
+
+		JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(ImpedanceHistory);
+	};
+
+}
+#endif  // __IMPEDANCEHISTORY_H_2C4CBD67__
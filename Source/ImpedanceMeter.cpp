@@ -22,6 +22,7 @@
 */
 
 #include "ImpedanceMeter.h"
+#include "Headstage.h"
 
 using namespace ONIRhythmNode;
 
@@ -53,7 +54,11 @@ ImpedanceMeter::ImpedanceMeter(DeviceThread* board_) :
         "RHD2000 Impedance Measurement",
         true,
         true),
-    board(board_)
+    numTuples(0),
+    windowLength(0),
+    processingPool(SystemStats::getNumCpus()),
+    board(board_),
+    zcheckBankSelected(false)
 {
     // to perform electrode impedance measurements at very low frequencies.
     const int maxNumBlocks = 120;
@@ -177,38 +182,182 @@ int ImpedanceMeter::loadAmplifierData(std::queue<Rhd2000DataBlock>& dataQueue,
 }
 
 
-void ImpedanceMeter::measureComplexAmplitude(
-    std::vector<std::vector<std::vector<double>>>& measuredMagnitude,
-    std::vector<std::vector<std::vector<double>>>& measuredPhase,
-    int capIndex, 
-    int stream, 
-    int chipChannel, 
-    int numBlocks,
-    double sampleRate, 
-    double frequency, 
-    int numPeriods)
+void ImpedanceMeter::setSelectedChannels(const Array<int>& channels)
 {
-    int period = (sampleRate / frequency);
-    int startIndex = 0;
-    int endIndex = startIndex + numPeriods * period - 1;
+    selectedChannels = channels;
+}
 
-    // Move the measurement window to the end of the waveform to ignore start-up transient.
-    while (endIndex < SAMPLES_PER_DATA_BLOCK(board->evalBoard->isUSB3()) * numBlocks - period)
+int ImpedanceMeter::planSweep()
+{
+    targets.clear();
+    sweepPlan.clear();
+    sweepPlan.resize(64);
+
+    int globalChannel = 0;
+
+    for (auto hs : board->headstages)
+    {
+        if (!hs->isConnected())
+            continue;
+
+        const int firstStream = hs->getStreamIndex(0);
+        const int channelsPerStream = hs->getNumActiveChannels() / hs->getNumStreams();
+
+        for (int ch = 0; ch < hs->getNumActiveChannels(); ++ch, ++globalChannel)
+        {
+            if (selectedChannels.size() > 0 && !selectedChannels.contains(globalChannel))
+                continue;
+
+            const int stream = firstStream + ch / channelsPerStream;
+            const int streamChannel = ch % channelsPerStream;
+            int chipChannel = streamChannel;
+
+            if ((board->chipId[stream] == CHIP_ID_RHD2132) && (board->numChannelsPerDataStream[stream] == 16))
+                chipChannel += RHD2132_16CH_OFFSET;
+
+            // the second MISO line of an RHD2164 carries chip channels 32-63
+            const int zcheckChannel = chipChannel + (board->chipId[stream] == CHIP_ID_RHD2164_B ? 32 : 0);
+
+            sweepPlan[zcheckChannel].push_back(int(targets.size()));
+            targets.push_back({ stream, streamChannel, chipChannel });
+        }
+    }
+
+    return int(targets.size());
+}
+
+int ImpedanceMeter::getTupleIndex(int capIndex, int target) const
+{
+    return capIndex * int(targets.size()) + target;
+}
+
+void ImpedanceMeter::storeMeasurementWindow(
+    int capIndex,
+    int target,
+    int startIndex)
+{
+    const int tuple = getTupleIndex(capIndex, target);
+    const std::vector<double>& data = amplifierPreFilter[targets[target].stream][targets[target].chipChannel];
+
+    for (int n = 0; n < windowLength; ++n)
+    {
+        windowSamples[n * numTuples + tuple] = data[startIndex + n];
+    }
+}
+
+void ImpedanceMeter::measureComplexAmplitudes(
+    int startIndex,
+    double sampleRate,
+    double frequency)
+{
+    const double k = TWO_PI * frequency / sampleRate;  // precalculate for speed
+
+    // The reference waveforms are the same for every tuple
+    std::vector<double> cosTable(windowLength);
+    std::vector<double> sinTable(windowLength);
+
+    for (int n = 0; n < windowLength; ++n)
+    {
+        const int t = startIndex + n;
+        cosTable[n] = cos(k * t);
+        sinTable[n] = -1.0 * sin(k * t);
+    }
+
+    parallelFor(numTuples, [&](int begin, int end)
+    {
+        const int count = end - begin;
+
+        std::vector<double> meanI(count, 0.0);
+        std::vector<double> meanQ(count, 0.0);
+
+        // Perform correlation with sine and cosine waveforms. The inner loop runs over
+        // independent tuples, so it vectorizes while keeping the summation order of each tuple.
+        for (int n = 0; n < windowLength; ++n)
+        {
+            const double* x = &windowSamples[n * numTuples + begin];
+            const double c = cosTable[n];
+            const double s = sinTable[n];
+
+            for (int j = 0; j < count; ++j)
+            {
+                meanI[j] += x[j] * c;
+                meanQ[j] += x[j] * s;
+            }
+        }
+
+        for (int j = 0; j < count; ++j)
+        {
+            const double iComponent = 2.0 * (meanI[j] / (double)windowLength);
+            const double qComponent = 2.0 * (meanQ[j] / (double)windowLength);
+
+            // Calculate magnitude and phase from real (I) and imaginary (Q) components.
+            measuredMagnitudes[begin + j] = sqrt(iComponent * iComponent + qComponent * qComponent);
+            measuredPhases[begin + j] = RADIANS_TO_DEGREES * atan2(qComponent, iComponent);
+        }
+    });
+}
+
+bool ImpedanceMeter::matchesPerChannelAmplitudes(
+    int startIndex,
+    double sampleRate,
+    double frequency) const
+{
+    std::vector<double> data(startIndex + windowLength, 0.0);
+
+    for (int tuple = 0; tuple < numTuples; ++tuple)
     {
-        startIndex += period;
-        endIndex += period;
+        for (int n = 0; n < windowLength; ++n)
+            data[startIndex + n] = windowSamples[n * numTuples + tuple];
+
+        double iComponent, qComponent;
+        amplitudeOfFreqComponent(iComponent, qComponent, data, startIndex,
+            startIndex + windowLength - 1, sampleRate, frequency);
+
+        const double phase = DEGREES_TO_RADIANS * measuredPhases[tuple];
+        const double errorI = measuredMagnitudes[tuple] * cos(phase) - iComponent;
+        const double errorQ = measuredMagnitudes[tuple] * sin(phase) - qComponent;
+        const double magnitude = sqrt(iComponent * iComponent + qComponent * qComponent);
+
+        if (sqrt(errorI * errorI + errorQ * errorQ) > 1.0e-9 * jmax(1.0, magnitude))
+        {
+            LOGE("Impedance meter: batched amplitude of tuple ", tuple, " differs from the per-channel result");
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void ImpedanceMeter::parallelFor(int numItems, std::function<void(int begin, int end)> function)
+{
+    const int minItemsPerJob = 64;
+
+    int numJobs = jmin(processingPool.getNumThreads(), (numItems + minItemsPerJob - 1) / minItemsPerJob);
+
+    if (numJobs <= 1)
+    {
+        function(0, numItems);
+        return;
     }
 
-    double iComponent, qComponent;
+    std::atomic<int> remainingJobs(numJobs);
+    WaitableEvent jobsFinished;
 
-    // Measure real (iComponent) and imaginary (qComponent) amplitude of frequency component.
-    amplitudeOfFreqComponent(iComponent, qComponent, amplifierPreFilter[stream][chipChannel],
-        startIndex, endIndex, sampleRate, frequency);
-    // Calculate magnitude and phase from real (I) and imaginary (Q) components.
-    measuredMagnitude[stream][chipChannel][capIndex] =
-        sqrt(iComponent * iComponent + qComponent * qComponent);
-    measuredPhase[stream][chipChannel][capIndex] =
-        RADIANS_TO_DEGREES *atan2(qComponent, iComponent);
+    for (int job = 0; job < numJobs; ++job)
+    {
+        const int begin = int((int64)numItems * job / numJobs);
+        const int end = int((int64)numItems * (job + 1) / numJobs);
+
+        processingPool.addJob([&, begin, end]
+        {
+            function(begin, end);
+
+            if (--remainingJobs == 0)
+                jobsFinished.signal();
+        });
+    }
+
+    jobsFinished.wait();
 }
 
 
@@ -243,34 +392,55 @@ void ImpedanceMeter::amplitudeOfFreqComponent(
 void ImpedanceMeter::factorOutParallelCapacitance(double& impedanceMagnitude, double& impedancePhase,
     double frequency, double parasiticCapacitance)
 {
-    // First, convert from polar coordinates to rectangular coordinates.
-    double measuredR = impedanceMagnitude * cos(DEGREES_TO_RADIANS * impedancePhase);
-    double measuredX = impedanceMagnitude * sin(DEGREES_TO_RADIANS * impedancePhase);
-
-    double capTerm = TWO_PI * frequency * parasiticCapacitance;
-    double xTerm = capTerm * (measuredR * measuredR + measuredX * measuredX);
-    double denominator = capTerm * xTerm + 2 * capTerm * measuredX + 1;
-    double trueR = measuredR / denominator;
-    double trueX = (measuredX + xTerm) / denominator;
-
-    // Now, convert from rectangular coordinates back to polar coordinates.
-    impedanceMagnitude = sqrt(trueR * trueR + trueX * trueX);
-    impedancePhase = RADIANS_TO_DEGREES * atan2(trueX, trueR);
+    factorOutParallelCapacitance(&impedanceMagnitude, &impedancePhase, 1, frequency, parasiticCapacitance);
+}
+
+void ImpedanceMeter::factorOutParallelCapacitance(double* impedanceMagnitudes, double* impedancePhases,
+    int count, double frequency, double parasiticCapacitance)
+{
+    const double capTerm = TWO_PI * frequency * parasiticCapacitance;
+
+    for (int i = 0; i < count; ++i)
+    {
+        // First, convert from polar coordinates to rectangular coordinates.
+        double measuredR = impedanceMagnitudes[i] * cos(DEGREES_TO_RADIANS * impedancePhases[i]);
+        double measuredX = impedanceMagnitudes[i] * sin(DEGREES_TO_RADIANS * impedancePhases[i]);
+
+        double xTerm = capTerm * (measuredR * measuredR + measuredX * measuredX);
+        double denominator = capTerm * xTerm + 2 * capTerm * measuredX + 1;
+        double trueR = measuredR / denominator;
+        double trueX = (measuredX + xTerm) / denominator;
+
+        // Now, convert from rectangular coordinates back to polar coordinates.
+        impedanceMagnitudes[i] = sqrt(trueR * trueR + trueX * trueX);
+        impedancePhases[i] = RADIANS_TO_DEGREES * atan2(trueX, trueR);
+    }
 }
 
 void ImpedanceMeter::empiricalResistanceCorrection(double& impedanceMagnitude, double& impedancePhase,
     double boardSampleRate)
 {
-    // First, convert from polar coordinates to rectangular coordinates.
-    double impedanceR = impedanceMagnitude * cos(DEGREES_TO_RADIANS * impedancePhase);
-    double impedanceX = impedanceMagnitude * sin(DEGREES_TO_RADIANS * impedancePhase);
+    empiricalResistanceCorrection(&impedanceMagnitude, &impedancePhase, 1, boardSampleRate);
+}
 
+void ImpedanceMeter::empiricalResistanceCorrection(double* impedanceMagnitudes, double* impedancePhases,
+    int count, double boardSampleRate)
+{
     // Emprically derived correction factor (i.e., no physical basis for this equation).
-    impedanceR /= 10.0 * exp(-boardSampleRate / 2500.0) * cos(TWO_PI * boardSampleRate / 15000.0) + 1.0;
+    const double correction = 10.0 * exp(-boardSampleRate / 2500.0) * cos(TWO_PI * boardSampleRate / 15000.0) + 1.0;
 
-    // Now, convert from rectangular coordinates back to polar coordinates.
-    impedanceMagnitude = sqrt(impedanceR * impedanceR + impedanceX * impedanceX);
-    impedancePhase = RADIANS_TO_DEGREES * atan2(impedanceX, impedanceR);
+    for (int i = 0; i < count; ++i)
+    {
+        // First, convert from polar coordinates to rectangular coordinates.
+        double impedanceR = impedanceMagnitudes[i] * cos(DEGREES_TO_RADIANS * impedancePhases[i]);
+        double impedanceX = impedanceMagnitudes[i] * sin(DEGREES_TO_RADIANS * impedancePhases[i]);
+
+        impedanceR /= correction;
+
+        // Now, convert from rectangular coordinates back to polar coordinates.
+        impedanceMagnitudes[i] = sqrt(impedanceR * impedanceR + impedanceX * impedanceX);
+        impedancePhases[i] = RADIANS_TO_DEGREES * atan2(impedanceX, impedanceR);
+    }
 }
 
 
@@ -293,7 +463,7 @@ void ImpedanceMeter::run()
 
 void ImpedanceMeter::runImpedanceMeasurement(Impedances& impedances)
 {
-    int commandSequenceLength, stream, channel, capRange;
+    int commandSequenceLength, capRange;
     double cSeries;
     std::vector<int> commandList;
 
@@ -302,25 +472,21 @@ void ImpedanceMeter::runImpedanceMeasurement(Impedances& impedances)
     int numdataStreams = board->evalBoard->getNumEnabledDataStreams();
 	LOGD("ImpedanceMeter: Num enabled streams = ", numdataStreams);
 
-    bool rhd2164ChipPresent = false;
-    int chOffset;
+    // Only visit the Zcheck channels that carry a connected, selected channel
+    const int numTargets = planSweep();
 
-    Array<int> enabledStreams;
+    Array<int> zcheckChannels;
 
-    for (stream = 0; stream < board->MAX_NUM_DATA_STREAMS; ++stream)
+    for (int zcheckChannel = 0; zcheckChannel < sweepPlan.size(); ++zcheckChannel)
     {
-        CHECK_EXIT;
+        if (sweepPlan[zcheckChannel].size() > 0)
+            zcheckChannels.add(zcheckChannel);
+    }
 
-        if (board->evalBoard->isStreamEnabled(stream))
-        {
-            enabledStreams.add(stream);
-        }
+    LOGD("ImpedanceMeter: Measuring ", numTargets, " channels over ", zcheckChannels.size(), " Zcheck channels");
 
-        if (board->chipId[stream] == CHIP_ID_RHD2164_B)
-        {
-            rhd2164ChipPresent = true;
-        }
-    }
+    if (numTargets == 0)
+        return;
 
     bool validImpedanceFreq;
     LOGD("ImpedanceMeter: Updating impedance frequency to 1000");
@@ -346,14 +512,21 @@ void ImpedanceMeter::runImpedanceMeasurement(Impedances& impedances)
     }
 
     CHECK_EXIT;
-    board->evalBoard->selectAuxCommandBank(Rhd2000ONIBoard::PortA,
-        Rhd2000ONIBoard::AuxCmd1, 1);
-    board->evalBoard->selectAuxCommandBank(Rhd2000ONIBoard::PortB,
-        Rhd2000ONIBoard::AuxCmd1, 1);
-    board->evalBoard->selectAuxCommandBank(Rhd2000ONIBoard::PortC,
-        Rhd2000ONIBoard::AuxCmd1, 1);
-    board->evalBoard->selectAuxCommandBank(Rhd2000ONIBoard::PortD,
-        Rhd2000ONIBoard::AuxCmd1, 1);
+    {
+        // digital output changes are recorded, and applied by restoreBoardSettings()
+        const ScopedLock lock(board->digOutLock);
+
+        board->evalBoard->selectAuxCommandBank(Rhd2000ONIBoard::PortA,
+            Rhd2000ONIBoard::AuxCmd1, 1);
+        board->evalBoard->selectAuxCommandBank(Rhd2000ONIBoard::PortB,
+            Rhd2000ONIBoard::AuxCmd1, 1);
+        board->evalBoard->selectAuxCommandBank(Rhd2000ONIBoard::PortC,
+            Rhd2000ONIBoard::AuxCmd1, 1);
+        board->evalBoard->selectAuxCommandBank(Rhd2000ONIBoard::PortD,
+            Rhd2000ONIBoard::AuxCmd1, 1);
+
+        zcheckBankSelected = true;
+    }
 
     // Select number of periods to measure impedance over
     int numPeriods = (0.020 * actualImpedanceFreq); // Test each channel for at least 20 msec...
@@ -387,37 +560,25 @@ void ImpedanceMeter::runImpedanceMeasurement(Impedances& impedances)
 
     board->evalBoard->setMaxTimeStep(128*SAMPLES_PER_DATA_BLOCK(board->evalBoard->isUSB3()) * numBlocks);
 
-    // Create matrices of doubles of size (numStreams x 32 x 3) to store complex amplitudes
-    // of all amplifier channels (32 on each data stream) at three different Cseries values.
-    std::vector<std::vector<std::vector<double>>>  measuredMagnitude;
-    std::vector<std::vector<std::vector<double>>>  measuredPhase;
-
-    measuredMagnitude.resize(board->evalBoard->getNumEnabledDataStreams());
-    measuredPhase.resize(board->evalBoard->getNumEnabledDataStreams());
+    // Allocate batched buffers for the complex amplitudes of all measured channels
+    // at three different Cseries values.
+    int samplePeriod = (board->settings.boardSampleRate / actualImpedanceFreq);
+    int startIndex = 0;
+    int endIndex = startIndex + numPeriods * samplePeriod - 1;
 
-    for (int i = 0; i < board->evalBoard->getNumEnabledDataStreams(); ++i)
+    // Move the measurement window to the end of the waveform to ignore start-up transient.
+    while (endIndex < SAMPLES_PER_DATA_BLOCK(board->evalBoard->isUSB3()) * numBlocks - samplePeriod)
     {
-        measuredMagnitude[i].resize(32);
-        measuredPhase[i].resize(32);
-
-        for (int j = 0; j < 32; ++j)
-        {
-            measuredMagnitude[i][j].resize(3);
-            measuredPhase[i][j].resize(3);
-        }
+        startIndex += samplePeriod;
+        endIndex += samplePeriod;
     }
 
-    double distance, minDistance, current, Cseries;
-    double impedanceMagnitude, impedancePhase;
-
-    const double bestAmplitude = 250.0;  // we favor voltage readings that are closest to 250 uV: not too large,
-    // and not too small.
-    const double dacVoltageAmplitude = 128 * (1.225 / 256);  // this assumes the DAC amplitude was set to 128
-    const double parasiticCapacitance = 14.0e-12;  // 14 pF: an estimate of on-chip parasitic capacitance,
-    // including 10 pF of amplifier input capacitance.
-    double relativeFreq = actualImpedanceFreq / board->settings.boardSampleRate;
+    numTuples = 3 * numTargets;
+    windowLength = endIndex - startIndex + 1;
 
-    int bestAmplitudeIndex;
+    windowSamples.assign((size_t)windowLength * numTuples, 0.0);
+    measuredMagnitudes.assign(numTuples, 0.0);
+    measuredPhases.assign(numTuples, 0.0);
 
     // We execute three complete electrode impedance measurements: one each with
     // Cseries set to 0.1 pF, 1 pF, and 10 pF.  Then we select the best measurement
@@ -442,15 +603,20 @@ void ImpedanceMeter::runImpedanceMeasurement(Impedances& impedances)
             break;
         }
 
-        // Check all 32 channels across all active data streams.
-        for (channel = 0; channel < 32; ++channel)
+        // Channels 32-63 only exist on RHD2164 chips, and are read on their second (B) stream
+        for (int i = 0; i < zcheckChannels.size(); ++i)
         {
 
             CHECK_EXIT;
 
-            //LOGD("ImpedanceMeter: channel = ", channel);
+            const int zcheckChannel = zcheckChannels[i];
+
+            //LOGD("ImpedanceMeter: Zcheck channel = ", zcheckChannel);
+
+            setProgress(float(capRange) / 3.0f 
+                        + (float(i) / float(zcheckChannels.size()) / 3.0f));
    
-            board->chipRegisters.setZcheckChannel(channel);
+            board->chipRegisters.setZcheckChannel(zcheckChannel);
             commandSequenceLength =
                 board->chipRegisters.createCommandListRegisterConfig(commandList, false);
             // Upload version with no ADC calibration to AuxCmd3 RAM Bank 1.
@@ -470,130 +636,91 @@ void ImpedanceMeter::runImpedanceMeasurement(Impedances& impedances)
             loadAmplifierData(dataQueue, numBlocks, numdataStreams);
             //LOGD("ImpedanceMeter: loaded amplifier data");
             
-            for (stream = 0; stream < numdataStreams; ++stream)
+            for (int target : sweepPlan[zcheckChannel])
             {
-                //LOGD("ImpedanceMeter: stream = ", stream);
-                setProgress(float(capRange) / 3.0f 
-                            + (float(channel) / 32.0f / 3.0f) 
-                            + (float(stream) / float(numdataStreams) / 32.0f / 3.0f));
-
-                if (board->chipId[stream] != CHIP_ID_RHD2164_B)
-                {
-                    measureComplexAmplitude(measuredMagnitude, measuredPhase,
-                        capRange, stream, channel, numBlocks, board->settings.boardSampleRate,
-                        actualImpedanceFreq, numPeriods);
-                }
+                storeMeasurementWindow(capRange, target, startIndex);
             }
+        }
+    }
 
-            // If an RHD2164 chip is plugged in, we have to set the Zcheck select register to channels 32-63
-            // and repeat the previous steps.
-            if (rhd2164ChipPresent)
-            {
-                CHECK_EXIT;
-                board->chipRegisters.setZcheckChannel(channel + 32); // address channels 32-63
-                commandSequenceLength =
-                    board->chipRegisters.createCommandListRegisterConfig(commandList, false);
-                // Upload version with no ADC calibration to AuxCmd3 RAM Bank 1.
-                board->evalBoard->uploadCommandList(commandList, Rhd2000ONIBoard::AuxCmd3, 3);
-
-                board->evalBoard->run();
-              /*  while (board->evalBoard->isRunning())
-                {
+    CHECK_EXIT;
 
-                }*/
-                board->evalBoard->readDataBlocks(numBlocks, dataQueue);
-                {
-                    const ScopedLock lock(board->oniLock);
-                    board->evalBoard->stop();
-                }
-                loadAmplifierData(dataQueue, numBlocks, numdataStreams);
+    // Measure real (iComponent) and imaginary (qComponent) amplitudes of all windows at once
+    measureComplexAmplitudes(startIndex, board->settings.boardSampleRate, actualImpedanceFreq);
 
-                for (stream = 0; stream < board->evalBoard->getNumEnabledDataStreams(); ++stream)
-                {
-                    if (board->chipId[stream] == CHIP_ID_RHD2164_B)
-                    {
-                        measureComplexAmplitude(measuredMagnitude, measuredPhase,
-                            capRange, stream, channel, numBlocks, board->settings.boardSampleRate,
-                            actualImpedanceFreq, numPeriods);
-                    }
-                }
-            }
-        }
-    }
+#if JUCE_DEBUG
+    jassert(matchesPerChannelAmplitudes(startIndex, board->settings.boardSampleRate, actualImpedanceFreq));
+#endif
 
-    impedances.streams.clear();
-    impedances.channels.clear();
-    impedances.magnitudes.clear();
-    impedances.phases.clear();
+    const double bestAmplitude = 250.0;  // we favor voltage readings that are closest to 250 uV: not too large,
+    // and not too small.
+    const double dacVoltageAmplitude = 128 * (1.225 / 256);  // this assumes the DAC amplitude was set to 128
+    const double parasiticCapacitance = 14.0e-12;  // 14 pF: an estimate of on-chip parasitic capacitance,
+    // including 10 pF of amplifier input capacitance.
+    const double relativeFreq = actualImpedanceFreq / board->settings.boardSampleRate;
+    const double cSeriesValues[3] = { 0.1e-12, 1.0e-12, 10.0e-12 };
 
-    for (stream = 0; stream < board->evalBoard->getNumEnabledDataStreams(); ++stream)
-    {
-        if ((board->chipId[stream] == CHIP_ID_RHD2132) && (board->numChannelsPerDataStream[stream] == 16))
-            chOffset = RHD2132_16CH_OFFSET;
-        else
-            chOffset = 0;
+    const int numResults = numTargets;
 
-        for (channel = 0; channel < board->numChannelsPerDataStream[stream]; ++channel)
+    std::vector<double> impedanceMagnitudes(numResults);
+    std::vector<double> impedancePhases(numResults);
+
+    parallelFor(numResults, [&](int begin, int end)
+    {
+        for (int i = begin; i < end; ++i)
         {
-            if (1)
+            int bestAmplitudeIndex = 0;
+            double minDistance = 9.9e99;  // ridiculously large number
+
+            for (int c = 0; c < 3; ++c)
             {
-                minDistance = 9.9e99;  // ridiculously large number
-                for (capRange = 0; capRange < 3; ++capRange)
-                {
-                    // Find the measured amplitude that is closest to bestAmplitude on a logarithmic scale
-                    distance = abs(log(measuredMagnitude[stream][channel+chOffset][capRange] / bestAmplitude));
-                    if (distance < minDistance)
-                    {
-                        bestAmplitudeIndex = capRange;
-                        minDistance = distance;
-                    }
-                }
-                switch (bestAmplitudeIndex)
+                // Find the measured amplitude that is closest to bestAmplitude on a logarithmic scale
+                double distance = abs(log(measuredMagnitudes[getTupleIndex(c, i)] / bestAmplitude));
+                if (distance < minDistance)
                 {
-                case 0:
-                    Cseries = 0.1e-12;
-                    break;
-                case 1:
-                    Cseries = 1.0e-12;
-                    break;
-                case 2:
-                    Cseries = 10.0e-12;
-                    break;
+                    bestAmplitudeIndex = c;
+                    minDistance = distance;
                 }
+            }
 
-                // Calculate current amplitude produced by on-chip voltage DAC
-                current = TWO_PI * actualImpedanceFreq * dacVoltageAmplitude * Cseries;
+            const int tuple = getTupleIndex(bestAmplitudeIndex, i);
 
-                // Calculate impedance magnitude from calculated current and measured voltage.
-                impedanceMagnitude = 1.0e-6 * (measuredMagnitude[stream][channel + chOffset][bestAmplitudeIndex] / current) *
-                    (18.0 * relativeFreq * relativeFreq + 1.0);
+            // Calculate current amplitude produced by on-chip voltage DAC
+            double current = TWO_PI * actualImpedanceFreq * dacVoltageAmplitude * cSeriesValues[bestAmplitudeIndex];
 
-                // Calculate impedance phase, with small correction factor accounting for the
-                // 3-command SPI pipeline delay.
-                impedancePhase = measuredPhase[stream][channel + chOffset][bestAmplitudeIndex] + (360.0 * (3.0 / period));
+            // Calculate impedance magnitude from calculated current and measured voltage.
+            impedanceMagnitudes[i] = 1.0e-6 * (measuredMagnitudes[tuple] / current) *
+                (18.0 * relativeFreq * relativeFreq + 1.0);
 
-                // Factor out on-chip parasitic capacitance from impedance measurement.
-                factorOutParallelCapacitance(impedanceMagnitude, impedancePhase, actualImpedanceFreq,
-                    parasiticCapacitance);
+            // Calculate impedance phase, with small correction factor accounting for the
+            // 3-command SPI pipeline delay.
+            impedancePhases[i] = measuredPhases[tuple] + (360.0 * (3.0 / period));
+        }
 
-                // Perform empirical resistance correction to improve accuarcy at sample rates below 15 kS/s.
-                empiricalResistanceCorrection(impedanceMagnitude, impedancePhase,
-                    board->settings.boardSampleRate);
+        // Factor out on-chip parasitic capacitance from impedance measurement.
+        factorOutParallelCapacitance(&impedanceMagnitudes[begin], &impedancePhases[begin], end - begin,
+            actualImpedanceFreq, parasiticCapacitance);
 
-                impedances.streams.add(enabledStreams[stream]);
-                impedances.channels.add(channel + chOffset);
-                impedances.magnitudes.add(impedanceMagnitude);
-                impedances.phases.add(impedancePhase);
+        // Perform empirical resistance correction to improve accuarcy at sample rates below 15 kS/s.
+        empiricalResistanceCorrection(&impedanceMagnitudes[begin], &impedancePhases[begin], end - begin,
+            board->settings.boardSampleRate);
+    });
 
-                //if (impedanceMagnitude > 1000000)
-                //    cout << "stream " << stream << " channel " << 1 + channel << " magnitude: " << String(impedanceMagnitude / 1e6, 2) << " MOhm , phase : " << impedancePhase << endl;
-                //else
-                //    cout << "stream " << stream << " channel " << 1 + channel << " magnitude: " << String(impedanceMagnitude / 1e3, 2) << " kOhm , phase : " << impedancePhase << endl;
+    impedances.streams.clear();
+    impedances.channels.clear();
+    impedances.magnitudes.clear();
+    impedances.phases.clear();
 
-            }
-        }
+    for (int i = 0; i < numResults; ++i)
+    {
+        impedances.streams.add(targets[i].stream);
+        impedances.channels.add(targets[i].streamChannel);
+        impedances.magnitudes.add(impedanceMagnitudes[i]);
+        impedances.phases.add(impedancePhases[i]);
     }
     
+    impedances.frequency = actualImpedanceFreq;
+    impedances.partial = selectedChannels.size() > 0;
     impedances.valid = true;
 
 }
@@ -603,15 +730,24 @@ void ImpedanceMeter::restoreBoardSettings()
     board->evalBoard->setContinuousRunMode(false);
     board->evalBoard->setMaxTimeStep(0);
 
-    // Switch back to flatline
-    board->evalBoard->selectAuxCommandBank(Rhd2000ONIBoard::PortA, Rhd2000ONIBoard::AuxCmd1, 0);
-    board->evalBoard->selectAuxCommandBank(Rhd2000ONIBoard::PortB, Rhd2000ONIBoard::AuxCmd1, 0);
-    board->evalBoard->selectAuxCommandBank(Rhd2000ONIBoard::PortC, Rhd2000ONIBoard::AuxCmd1, 0);
-    board->evalBoard->selectAuxCommandBank(Rhd2000ONIBoard::PortD, Rhd2000ONIBoard::AuxCmd1, 0);
+    {
+        // Switch back to the digital output lists, including changes made during the measurement
+        const ScopedLock lock(board->digOutLock);
+
+        board->evalBoard->selectAuxCommandBank(Rhd2000ONIBoard::PortA, Rhd2000ONIBoard::AuxCmd1, board->getDigOutBank(Rhd2000ONIBoard::PortA));
+        board->evalBoard->selectAuxCommandBank(Rhd2000ONIBoard::PortB, Rhd2000ONIBoard::AuxCmd1, board->getDigOutBank(Rhd2000ONIBoard::PortB));
+        board->evalBoard->selectAuxCommandBank(Rhd2000ONIBoard::PortC, Rhd2000ONIBoard::AuxCmd1, board->getDigOutBank(Rhd2000ONIBoard::PortC));
+        board->evalBoard->selectAuxCommandBank(Rhd2000ONIBoard::PortD, Rhd2000ONIBoard::AuxCmd1, board->getDigOutBank(Rhd2000ONIBoard::PortD));
+
+        zcheckBankSelected = false;
+    }
 
     
     board->evalBoard->selectAuxCommandLength(Rhd2000ONIBoard::AuxCmd1, 0, 1);
 
+    // the Zcheck sweep has changed the register settings and AuxCmd3 length
+    board->uploadedRegisterConfig = String();
+
     board->evalBoard->selectAuxCommandBank(Rhd2000ONIBoard::PortA, Rhd2000ONIBoard::AuxCmd3,
         board->settings.fastSettleEnabled ? 2 : 1);
     board->evalBoard->selectAuxCommandBank(Rhd2000ONIBoard::PortB, Rhd2000ONIBoard::AuxCmd3,
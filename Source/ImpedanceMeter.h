@@ -30,6 +30,7 @@
 #include <string.h>
 #include <array>
 #include <atomic>
+#include <functional>
 
 #include "rhythm-api/rhd2000ONIboard.h"
 #include "rhythm-api/rhd2000registers.h"
@@ -59,33 +60,20 @@ namespace ONIRhythmNode
 		/** Wait for thread to finish*/
 		void waitSafely();
 
+		/** Returns true while AuxCmd1 plays the Zcheck waveform instead of the digital
+		    output lists. Must be called with DeviceThread::digOutLock held.*/
+		bool isZcheckBankSelected() const { return zcheckBankSelected; }
+
 		/** Save values to a file (XML format)*/
 		void saveValues(File& file);
 
-	private:
-
-		/** Calculates impedance values for all channels*/
-		void runImpedanceMeasurement(Impedances& impedances);
-		
-		/** Restores settings of device*/
-		void restoreBoardSettings();
-
-		/** Returns the magnitude and phase (in degrees) of a selected frequency component (in Hz)
-	        for a selected amplifier channel on the selected USB data stream.*/
-		void measureComplexAmplitude(
-			std::vector<std::vector<std::vector<double>>>& measuredMagnitude,
-			std::vector<std::vector<std::vector<double>>>& measuredPhase,
-			int capIndex, 
-			int stream, 
-			int chipChannel, 
-			int numBlocks,
-			double sampleRate, 
-			double frequency, 
-			int numPeriods);
+		/** Restricts the next measurement to a set of channels, indexed across all connected
+		    headstages. An empty selection measures every connected channel.*/
+		void setSelectedChannels(const Array<int>& channels);
 
 		/** Returns the real and imaginary amplitudes of a selected frequency component in the vector
 		    data, between a start index and end index. */
-		void amplitudeOfFreqComponent(
+		static void amplitudeOfFreqComponent(
 			double& realComponent,					  
 			double& imagComponent,					  
 			const std::vector<double>& data, 				 
@@ -98,23 +86,77 @@ namespace ONIRhythmNode
 		    with a parasitic capacitance (i.e., due to the amplifier input capacitance and other
 		    capacitances associated with the chip bondpads), this function factors out the effect of the
 		    parasitic capacitance to return the acutal electrode impedance. */
-		void factorOutParallelCapacitance(
+		static void factorOutParallelCapacitance(
 			double& impedanceMagnitude,				  
 			double& impedancePhase,					  
 			double frequency, 					 
 			double parasiticCapacitance);
 
+		/** Batched version of factorOutParallelCapacitance(), applied in place to count values.*/
+		static void factorOutParallelCapacitance(
+			double* impedanceMagnitudes,
+			double* impedancePhases,
+			int count,
+			double frequency,
+			double parasiticCapacitance);
+
 		/** This is a purely empirical function to correct observed errors in the real component
 		    of measured electrode impedances at sampling rates below 15 kS/s.  At low sampling rates,
 		    it is difficult to approximate a smooth sine wave with the on-chip voltage DAC and 10 kHz
 		    2-pole lowpass filter.  This function attempts to somewhat correct for this, but a better
 		    solution is to always run impedance measurements at 20 kS/s, where they seem to be most
 		    accurate. */
-		void empiricalResistanceCorrection(
+		static void empiricalResistanceCorrection(
 			double& impedanceMagnitude, 					   
 			double& impedancePhase,
 			double boardSampleRate);
 
+		/** Batched version of empiricalResistanceCorrection(), applied in place to count values.*/
+		static void empiricalResistanceCorrection(
+			double* impedanceMagnitudes,
+			double* impedancePhases,
+			int count,
+			double boardSampleRate);
+
+	private:
+
+		/** Calculates impedance values for all channels*/
+		void runImpedanceMeasurement(Impedances& impedances);
+		
+		/** Restores settings of device*/
+		void restoreBoardSettings();
+
+		/** Builds the list of channels to measure from the connected headstages and the
+		    channel selection, grouped by the Zcheck channel that reaches them. Returns the number of channels.*/
+		int planSweep();
+
+		/** Returns the index of a (capacitor range, target) tuple in the batched arrays*/
+		int getTupleIndex(int capIndex, int target) const;
+
+		/** Copies the measurement window of a target channel into the batched sample buffer.*/
+		void storeMeasurementWindow(
+			int capIndex,
+			int target,
+			int startIndex);
+
+		/** Computes the magnitude and phase (in degrees) of a selected frequency component (in Hz)
+		    for every stored measurement window, spread over the thread pool.*/
+		void measureComplexAmplitudes(
+			int startIndex,
+			double sampleRate,
+			double frequency);
+
+		/** Checks the batched amplitudes against amplitudeOfFreqComponent() run on each window,
+		    to within 1e-9 (relative). Used in debug builds.*/
+		bool matchesPerChannelAmplitudes(
+			int startIndex,
+			double sampleRate,
+			double frequency) const;
+
+		/** Splits [0, numItems) into contiguous ranges, runs them on the thread pool and
+		    waits until all of them have finished.*/
+		void parallelFor(int numItems, std::function<void(int begin, int end)> function);
+
 		/** Updates electrode impedance measurement frequency, after checking that
 		    requested test frequency lies within acceptable ranges based on the
 		    amplifier bandwidth and the sampling rate.  See impedancefreqdialog.cpp
@@ -133,8 +175,33 @@ namespace ONIRhythmNode
 
 		std::vector<std::vector<std::vector<double>>> amplifierPreFilter;
 
+		/** An amplifier channel measured by the sweep*/
+		struct Target
+		{
+			int stream;         // position in the enabled streams
+			int streamChannel;  // acquired channel on that stream
+			int chipChannel;    // amplifier channel on that stream
+		};
+
+		Array<int> selectedChannels;
+		std::vector<Target> targets;
+		std::vector<std::vector<int>> sweepPlan;  // Zcheck channel -> targets
+
+		/** Batched (structure-of-arrays) measurement data. Samples are stored sample-major,
+		    so the correlation loop runs over contiguous tuples for every sample.*/
+		int numTuples;
+		int windowLength;
+		std::vector<double> windowSamples;
+		std::vector<double> measuredMagnitudes;
+		std::vector<double> measuredPhases;
+
+		ThreadPool processingPool;
+
 		DeviceThread* board;
 
+		/** Guarded by DeviceThread::digOutLock*/
+		bool zcheckBankSelected;
+
 		JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(ImpedanceMeter);
 	};
 
@@ -0,0 +1,500 @@
+/*
+    ------------------------------------------------------------------
+
+    This file is part of the Open Ephys GUI
+    Copyright (C) 2021 Open Ephys
+
+    ------------------------------------------------------------------
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "ImpedanceMonitor.h"
+#include "ImpedanceMeter.h"
+#include "Headstage.h"
+
+using namespace ONIRhythmNode;
+
+#define TWO_PI  6.28318530718
+#define RADIANS_TO_DEGREES  57.2957795132
+
+#define MAX_ZCHECK_CHANNELS 64
+
+ImpedanceMonitor::ImpedanceMonitor(DeviceThread* board_) :
+    Thread("Impedance Monitor Upload"),
+    board(board_),
+    zcheckRegisters(30000.0f),
+    enabled(false),
+    intervalMs(1000),
+    active(false),
+    zcheckBankSelected(false),
+    state(IDLE),
+    countdown(0),
+    sampleRate(30000.0),
+    frequency(1000.0),
+    period(30),
+    numPeriods(20),
+    commandListLength(0),
+    intervalSamples(0),
+    regularAuxCmd3Bank(1),
+    blockReadFrames(1),
+    switchTimestamp(0),
+    step(-1),
+    bankSet(0),
+    capRange(0),
+    sampleCount(0),
+    uploadRequest(-1)
+{
+    uploadedStep[0] = -1;
+    uploadedStep[1] = -1;
+}
+
+ImpedanceMonitor::~ImpedanceMonitor()
+{
+    signalThreadShouldExit();
+    notify();
+    stopThread(2000);
+
+    cancelPendingUpdate();
+}
+
+void ImpedanceMonitor::setEnabled(bool enabled_)
+{
+    enabled = enabled_;
+}
+
+void ImpedanceMonitor::setInterval(int intervalMs_)
+{
+    intervalMs = jmax(10, intervalMs_);
+}
+
+bool ImpedanceMonitor::prepare()
+{
+    active = false;
+    state = IDLE;
+
+    if (!enabled)
+        return false;
+
+    // a bank set may still be written after the previous acquisition
+    const ScopedLock lock(uploadLock);
+
+    uploadRequest = -1;
+
+    sampleRate = board->settings.boardSampleRate;
+
+    // Work on a copy, so the register state used by updateRegisters() is never touched
+    zcheckRegisters = board->chipRegisters;
+    zcheckRegisters.defineSampleRate(sampleRate);
+    zcheckRegisters.enableZcheck(true);
+
+    commandListLength = zcheckRegisters.createCommandListUpdateDigOut(commandList);
+
+    // The Zcheck waveform temporarily replaces the digital output list in AuxCmd1, and both
+    // banks share the same length register. The waveform is therefore tiled to the length of
+    // the digital output list, which requires its period to divide that length.
+    double upperBandwidthLimit = board->settings.dsp.upperBandwidth / 1.5;
+    double lowerBandwidthLimit = board->settings.dsp.lowerBandwidth * 1.5;
+
+    if (board->settings.dsp.enabled)
+    {
+        if (board->settings.dsp.cutoffFreq > board->settings.dsp.lowerBandwidth)
+        {
+            lowerBandwidthLimit = board->settings.dsp.cutoffFreq * 1.5;
+        }
+    }
+
+    period = 0;
+
+    for (int p = 4; p <= commandListLength; ++p)
+    {
+        if (commandListLength % p != 0)
+            continue;
+
+        double f = sampleRate / p;
+
+        if (f < lowerBandwidthLimit || f > upperBandwidthLimit)
+            continue;
+
+        if (period == 0 || std::abs(f - 1000.0) < std::abs(sampleRate / period - 1000.0))
+            period = p;
+    }
+
+    if (period == 0)
+    {
+        LOGC("Impedance monitor: no valid test frequency at ", sampleRate, " Hz. Background measurements disabled.");
+        return false;
+    }
+
+    frequency = sampleRate / period;
+
+    numPeriods = (0.020 * frequency); // Test each channel for at least 20 msec...
+    if (numPeriods < 5) numPeriods = 5; // ...but always measure across no fewer than 5 complete periods
+
+    // Map every chip channel to the enabled streams and decoded sample indices it appears on
+    const int numStreams = board->enabledStreams.size();
+
+    targets.clear();
+    targets.resize(MAX_ZCHECK_CHANNELS);
+
+    int firstChannel = 0;
+
+    for (int stream = 0; stream < numStreams; ++stream)
+    {
+        int nChans = board->numChannelsPerDataStream[stream];
+        int chOffset = 0;
+
+        if ((board->chipId[stream] == CHIP_ID_RHD2132) && (nChans == 16))
+            chOffset = RHD2132_16CH_OFFSET;
+
+        // the second MISO line of an RHD2164 carries chip channels 32-63
+        if (board->chipId[stream] == CHIP_ID_RHD2164_B)
+            chOffset = 32;
+
+        for (int ch = 0; ch < nChans; ++ch)
+        {
+            if (ch + chOffset < MAX_ZCHECK_CHANNELS)
+                targets[ch + chOffset].push_back({ stream, ch, firstChannel + ch });
+        }
+
+        firstChannel += nChans;
+    }
+
+    windowData.resize(numStreams);
+    for (auto& data : windowData)
+        data.assign(numPeriods * period, 0.0);
+
+    measuredMagnitude.assign(numStreams, { 0.0, 0.0, 0.0 });
+    measuredPhase.assign(numStreams, { 0.0, 0.0, 0.0 });
+
+    step = getNextStep(-1);
+
+    if (step < 0)
+        return false;
+
+    std::vector<int> waveform;
+    zcheckRegisters.createCommandListZcheckDac(waveform, frequency, 128.0);
+
+    commandList.clear();
+    while (commandList.size() < commandListLength)
+        commandList.insert(commandList.end(), waveform.begin(), waveform.end());
+
+    board->evalBoard->uploadCommandList(commandList, Rhd2000ONIBoard::AuxCmd1, 1);
+    board->evalBoard->selectAuxCommandLength(Rhd2000ONIBoard::AuxCmd1, 0, commandListLength - 1);
+
+    // the first two steps are uploaded while the board is stopped, the others by run()
+    bankSet = 0;
+    uploadZcheckConfig(0, step);
+    uploadZcheckConfig(1, getNextStep(step));
+
+    if (!isThreadRunning())
+        startThread();
+
+    regularAuxCmd3Bank = board->settings.fastSettleEnabled ? 2 : 1;
+    blockReadFrames = int(board->evalBoard->getBlockReadFrames());
+    intervalSamples = jmax(1, int(sampleRate * intervalMs / 1000));
+
+    capRange = 0;
+    countdown = intervalSamples;
+    active = true;
+
+    LOGD("Impedance monitor: measuring at ", frequency, " Hz every ", intervalMs, " ms");
+
+    return true;
+}
+
+bool ImpedanceMonitor::processSample(const float* sample, int64 timestamp)
+{
+    if (!active)
+        return false;
+
+    switch (state)
+    {
+    case IDLE:
+        if (--countdown > 0)
+            return false;
+
+        // the bank set of this step is still being written
+        if (uploadedStep[bankSet] != step)
+        {
+            countdown = 1;
+            return false;
+        }
+
+        capRange = 0;
+        selectBanks(true, getZcheckBank(bankSet, 0), timestamp);
+
+        state = SETTLING;
+        countdown = commandListLength + 2 * period; // one pass of the register list, plus 2 periods to settle
+        return true;
+
+    case SETTLING:
+        // the board was up to one block read ahead when the banks switched
+        if (timestamp > switchTimestamp && --countdown <= 0)
+            state = ALIGNING;
+        return true;
+
+    case ALIGNING:
+        // AuxCmd1 starts its list together with the timestamp counter, so the phase of the
+        // Zcheck waveform is timestamp % period. Start the window at phase 0, as ImpedanceMeter does.
+        if (timestamp % period != 0)
+            return true;
+
+        state = MEASURING;
+        sampleCount = 0;
+        // fall through
+
+    case MEASURING:
+    {
+        const std::vector<Target>& stepTargets = targets[step];
+
+        for (int i = 0; i < stepTargets.size(); ++i)
+            windowData[i][sampleCount] = sample[stepTargets[i].sampleIndex];
+
+        if (++sampleCount < numPeriods * period)
+            return true;
+
+        measureWindow();
+
+        if (++capRange < 3)
+        {
+            selectBanks(true, getZcheckBank(bankSet, capRange), timestamp);
+            state = SETTLING;
+            countdown = commandListLength + 2 * period;
+        }
+        else
+        {
+            selectBanks(false, regularAuxCmd3Bank, timestamp);
+            state = RECOVERING;
+            countdown = commandListLength; // wait for the regular register list to disable Zcheck
+        }
+        return true;
+    }
+
+    case RECOVERING:
+        if (timestamp <= switchTimestamp || --countdown > 0)
+            return true;
+
+        computeImpedances();
+
+        // the other set holds the next step; this one now receives the step after it
+        step = getNextStep(step);
+        uploadedStep[bankSet] = -1;
+        uploadRequest = bankSet * MAX_ZCHECK_CHANNELS + getNextStep(step);
+        notify();
+        bankSet = 1 - bankSet;
+
+        state = IDLE;
+        countdown = intervalSamples;
+        return true;
+    }
+
+    return false;
+}
+
+void ImpedanceMonitor::finish()
+{
+    if (active && state != IDLE)
+        selectBanks(false, regularAuxCmd3Bank, switchTimestamp);
+
+    active = false;
+    state = IDLE;
+}
+
+void ImpedanceMonitor::uploadZcheckConfig(int set, int zcheckStep)
+{
+    zcheckRegisters.setZcheckChannel(zcheckStep);
+
+    for (int range = 0; range < 3; range++)
+    {
+        switch (range)
+        {
+        case 0:
+            zcheckRegisters.setZcheckScale(Rhd2000Registers::ZcheckCs100fF);
+            break;
+        case 1:
+            zcheckRegisters.setZcheckScale(Rhd2000Registers::ZcheckCs1pF);
+            break;
+        case 2:
+            zcheckRegisters.setZcheckScale(Rhd2000Registers::ZcheckCs10pF);
+            break;
+        }
+
+        zcheckRegisters.createCommandListRegisterConfig(uploadCommandList, false);
+        board->evalBoard->uploadCommandList(uploadCommandList, Rhd2000ONIBoard::AuxCmd3, getZcheckBank(set, range));
+    }
+
+    uploadedStep[set] = zcheckStep;
+}
+
+void ImpedanceMonitor::run()
+{
+    while (!threadShouldExit())
+    {
+        wait(-1);
+
+        const int request = uploadRequest.exchange(-1);
+
+        if (request < 0)
+            continue;
+
+        const ScopedLock lock(uploadLock);
+        const ScopedLock boardLock(board->oniLock);
+
+        uploadZcheckConfig(request / MAX_ZCHECK_CHANNELS, request % MAX_ZCHECK_CHANNELS);
+    }
+}
+
+void ImpedanceMonitor::selectBanks(bool zcheck, int auxCmd3Bank, int64 timestamp)
+{
+    {
+        // the digital outputs may change while Zcheck runs; restore their current state
+        const ScopedLock lock(board->digOutLock);
+
+        for (int port = 0; port < 4; port++)
+        {
+            const Rhd2000ONIBoard::BoardPort boardPort = static_cast<Rhd2000ONIBoard::BoardPort>(port);
+            board->evalBoard->selectAuxCommandBank(boardPort, Rhd2000ONIBoard::AuxCmd1,
+                zcheck ? 1 : board->getDigOutBank(boardPort));
+        }
+
+        zcheckBankSelected = zcheck;
+    }
+
+    board->evalBoard->selectAuxCommandBank(Rhd2000ONIBoard::PortA, Rhd2000ONIBoard::AuxCmd3, auxCmd3Bank);
+    board->evalBoard->selectAuxCommandBank(Rhd2000ONIBoard::PortB, Rhd2000ONIBoard::AuxCmd3, auxCmd3Bank);
+    board->evalBoard->selectAuxCommandBank(Rhd2000ONIBoard::PortC, Rhd2000ONIBoard::AuxCmd3, auxCmd3Bank);
+    board->evalBoard->selectAuxCommandBank(Rhd2000ONIBoard::PortD, Rhd2000ONIBoard::AuxCmd3, auxCmd3Bank);
+
+    // frames still buffered from the current block read were recorded with the previous banks
+    switchTimestamp = timestamp + blockReadFrames;
+}
+
+void ImpedanceMonitor::measureWindow()
+{
+    double iComponent, qComponent;
+
+    for (int i = 0; i < targets[step].size(); ++i)
+    {
+        ImpedanceMeter::amplitudeOfFreqComponent(iComponent, qComponent, windowData[i],
+            0, numPeriods * period - 1, sampleRate, frequency);
+
+        measuredMagnitude[i][capRange] = sqrt(iComponent * iComponent + qComponent * qComponent);
+        measuredPhase[i][capRange] = RADIANS_TO_DEGREES * atan2(qComponent, iComponent);
+    }
+}
+
+void ImpedanceMonitor::computeImpedances()
+{
+    const double bestAmplitude = 250.0;  // favor voltage readings closest to 250 uV
+    const double dacVoltageAmplitude = 128 * (1.225 / 256);  // DAC amplitude set to 128
+    const double parasiticCapacitance = 14.0e-12;  // on-chip parasitic capacitance, see ImpedanceMeter
+    const double relativeFreq = frequency / sampleRate;
+    const double cSeries[3] = { 0.1e-12, 1.0e-12, 10.0e-12 };
+
+    Array<Result> results;
+
+    for (int i = 0; i < targets[step].size(); ++i)
+    {
+        int bestAmplitudeIndex = 0;
+        double minDistance = 9.9e99;
+
+        for (int c = 0; c < 3; ++c)
+        {
+            double distance = abs(log(measuredMagnitude[i][c] / bestAmplitude));
+            if (distance < minDistance)
+            {
+                bestAmplitudeIndex = c;
+                minDistance = distance;
+            }
+        }
+
+        double current = TWO_PI * frequency * dacVoltageAmplitude * cSeries[bestAmplitudeIndex];
+
+        double impedanceMagnitude = 1.0e-6 * (measuredMagnitude[i][bestAmplitudeIndex] / current) *
+            (18.0 * relativeFreq * relativeFreq + 1.0);
+
+        double impedancePhase = measuredPhase[i][bestAmplitudeIndex] + (360.0 * (3.0 / period));
+
+        ImpedanceMeter::factorOutParallelCapacitance(impedanceMagnitude, impedancePhase, frequency,
+            parasiticCapacitance);
+
+        ImpedanceMeter::empiricalResistanceCorrection(impedanceMagnitude, impedancePhase, sampleRate);
+
+        results.add({ targets[step][i].stream,
+                      targets[step][i].streamChannel,
+                      float(impedanceMagnitude),
+                      float(impedancePhase) });
+    }
+
+    {
+        const ScopedLock lock(resultLock);
+        pendingResults.addArray(results);
+    }
+
+    triggerAsyncUpdate();
+}
+
+int ImpedanceMonitor::getNextStep(int fromStep) const
+{
+    for (int i = 1; i <= MAX_ZCHECK_CHANNELS; ++i)
+    {
+        int next = (fromStep + i + MAX_ZCHECK_CHANNELS) % MAX_ZCHECK_CHANNELS;
+
+        if (targets[next].size() > 0)
+            return next;
+    }
+
+    return -1;
+}
+
+void ImpedanceMonitor::handleAsyncUpdate()
+{
+    Array<Result> results;
+
+    {
+        const ScopedLock lock(resultLock);
+        results.swapWith(pendingResults);
+    }
+
+    int64 timestamp = Time::currentTimeMillis();
+
+    for (auto& result : results)
+    {
+        for (auto hs : board->headstages)
+        {
+            if (!hs->isConnected())
+                continue;
+
+            int firstStream = hs->getStreamIndex(0);
+
+            if (result.stream < firstStream || result.stream >= firstStream + hs->getNumStreams())
+                continue;
+
+            int channelsPerStream = hs->getNumActiveChannels() / hs->getNumStreams();
+
+            int channel = (result.stream - firstStream) * channelsPerStream + result.streamChannel;
+
+            hs->setImpedance(channel, result.magnitude, result.phase);
+            board->storeImpedance(hs, channel, frequency, timestamp);
+        }
+    }
+
+    if (results.size() > 0)
+    {
+        board->impedances.valid = true;
+        board->impedanceHistory->flush();
+    }
+}
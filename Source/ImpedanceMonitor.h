@@ -0,0 +1,210 @@
+/*
+    ------------------------------------------------------------------
+
+    This file is part of the Open Ephys GUI
+    Copyright (C) 2020 Open Ephys
+
+    ------------------------------------------------------------------
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef __IMPEDANCEMONITOR_H_2C4CBD67__
+#define __IMPEDANCEMONITOR_H_2C4CBD67__
+
+#include <DataThreadHeaders.h>
+
+#include <stdio.h>
+#include <string.h>
+#include <array>
+#include <atomic>
+#include <vector>
+
+#include "rhythm-api/rhd2000ONIboard.h"
+#include "rhythm-api/rhd2000registers.h"
+#include "rhythm-api/rhd2000datablock.h"
+
+#include "DeviceThread.h"
+
+namespace ONIRhythmNode
+{
+
+	/**
+		Measures electrode impedances in the background while data
+		acquisition is running.
+
+		One chip channel at a time is switched to the Zcheck DAC (AuxCmd1 bank 1)
+		and Zcheck register configuration, measured at the three series capacitor
+		values and switched back. The configurations of the current channel and the
+		next one are kept in two sets of three AuxCmd3 banks (3-5 and 6-8), so the
+		acquisition thread only switches banks. A set is rewritten by a background
+		thread once it is no longer selected. Measurements are spaced by a
+		configurable interval, so only a small fraction of samples is affected.
+		Affected samples are flagged by processSample(), so they can be marked
+		on an event line.
+
+		@see ImpedanceMeter
+	*/
+	class ImpedanceMonitor : public AsyncUpdater,
+							 private Thread
+	{
+	public:
+
+		/** Constructor*/
+		ImpedanceMonitor(DeviceThread* b);
+
+		/** Destructor*/
+		~ImpedanceMonitor();
+
+		/** Enables or disables background measurements (takes effect at the next acquisition start)*/
+		void setEnabled(bool enabled);
+
+		/** Returns true if background measurements are enabled*/
+		bool isEnabled() const { return enabled; }
+
+		/** Sets the idle time between two consecutive channel measurements*/
+		void setInterval(int intervalMs);
+
+		/** Returns the idle time between two consecutive channel measurements*/
+		int getInterval() const { return intervalMs; }
+
+		/** Builds the channel map and uploads the Zcheck DAC waveform.
+		    Must be called before the board starts running; returns true if the monitor is active.*/
+		bool prepare();
+
+		/** Advances the measurement by one sample. Called by the acquisition thread once the
+		    amplifier data of a frame has been decoded. Returns true if the sample is affected by Zcheck.*/
+		bool processSample(const float* sample, int64 timestamp);
+
+		/** Returns the board to its regular command banks. Must be called once the acquisition thread has exited.*/
+		void finish();
+
+		/** Returns true while AuxCmd1 plays the Zcheck waveform instead of the digital
+		    output lists. Must be called with DeviceThread::digOutLock held.*/
+		bool isZcheckBankSelected() const { return zcheckBankSelected; }
+
+		/** Applies new results to the headstages (message thread)*/
+		void handleAsyncUpdate() override;
+
+	private:
+
+		enum State
+		{
+			IDLE = 0,
+			SETTLING,
+			ALIGNING,
+			MEASURING,
+			RECOVERING
+		};
+
+		/** A channel measured during a single Zcheck step*/
+		struct Target
+		{
+			int stream;
+			int streamChannel;
+			int sampleIndex;
+		};
+
+		/** A finished measurement*/
+		struct Result
+		{
+			int stream;
+			int streamChannel;
+			float magnitude;
+			float phase;
+		};
+
+		/** Uploads the Zcheck configurations of a step for the three capacitor ranges to a bank set*/
+		void uploadZcheckConfig(int bankSet, int zcheckStep);
+
+		/** Uploads the bank set requested by the acquisition thread*/
+		void run() override;
+
+		/** Returns the AuxCmd3 bank holding a capacitor range of a bank set*/
+		static int getZcheckBank(int bankSet, int range) { return 3 + 3 * bankSet + range; }
+
+		/** Selects the Zcheck (or each port's digital output) AuxCmd1 bank, and an AuxCmd3 bank, on all ports.
+		    timestamp is the sample being decoded; the settling delays start after the frames already buffered.*/
+		void selectBanks(bool zcheck, int auxCmd3Bank, int64 timestamp);
+
+		/** Computes the complex amplitude of the current window for every target*/
+		void measureWindow();
+
+		/** Converts the three complex amplitudes of every target into an impedance*/
+		void computeImpedances();
+
+		/** Returns the next chip channel after a step that has at least one target, or -1*/
+		int getNextStep(int fromStep) const;
+
+		DeviceThread* board;
+
+		Rhd2000Registers zcheckRegisters;
+
+		std::atomic<bool> enabled;
+		std::atomic<int> intervalMs;
+
+		bool active;
+
+		/** Guarded by DeviceThread::digOutLock*/
+		bool zcheckBankSelected;
+
+		State state;
+		int countdown;
+
+		double sampleRate;
+		double frequency;
+		int period;
+		int numPeriods;
+		int commandListLength;
+		int intervalSamples;
+		int regularAuxCmd3Bank;
+
+		/** Frames of a block read, recorded before a bank switch but decoded after it*/
+		int blockReadFrames;
+
+		/** Last sample that may have been recorded before the latest bank switch*/
+		int64 switchTimestamp;
+
+		std::vector<int> commandList;
+
+		int step;
+		int bankSet;
+		int capRange;
+		int sampleCount;
+
+		std::vector<std::vector<Target>> targets;
+		std::vector<std::vector<double>> windowData;
+		std::vector<std::array<double, 3>> measuredMagnitude;
+		std::vector<std::array<double, 3>> measuredPhase;
+
+		/** Step uploaded to each bank set (-1 while it is being written)*/
+		std::array<std::atomic<int>, 2> uploadedStep;
+
+		/** Upload requested by the acquisition thread: bankSet * MAX_ZCHECK_CHANNELS + step, or -1*/
+		std::atomic<int> uploadRequest;
+
+		/** Held while a bank set is uploaded*/
+		CriticalSection uploadLock;
+
+		std::vector<int> uploadCommandList;
+
+		CriticalSection resultLock;
+		Array<Result> pendingResults;
+
+		JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(ImpedanceMonitor);
+	};
+
+}
+#endif  // __IMPEDANCEMONITOR_H_2C4CBD67__
@@ -0,0 +1,124 @@
+/*
+    ------------------------------------------------------------------
+
+    This file is part of the Open Ephys GUI
+    Copyright (C) 2020 Open Ephys
+
+    ------------------------------------------------------------------
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __MPSCQUEUE_H_2C4CBD67__
+#define __MPSCQUEUE_H_2C4CBD67__
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+namespace ONIRhythmNode
+{
+
+	/**
+		Bounded lock-free queue with any number of producers and a single consumer.
+
+		Each slot carries a sequence number telling whether it is free for the
+		producer of the current lap or holds an item for the consumer, so neither
+		side ever blocks. push() fails when the queue is full.
+
+		Size must be a power of two.
+	*/
+	template <typename T, uint32_t Size>
+	class MpscQueue
+	{
+		static_assert((Size & (Size - 1)) == 0, "MpscQueue size must be a power of two");
+
+	public:
+
+		/** Constructor*/
+		MpscQueue() : pushPosition(0), popPosition(0)
+		{
+			for (uint32_t i = 0; i < Size; i++)
+				slots[i].sequence = i;
+		}
+
+		/** Adds an item. Safe from any thread. Returns false if the queue is full.*/
+		bool push(const T& item)
+		{
+			uint32_t position = pushPosition.load(std::memory_order_relaxed);
+			Slot* slot;
+
+			for (;;)
+			{
+				slot = &slots[position & (Size - 1)];
+				const int32_t diff = int32_t(slot->sequence.load(std::memory_order_acquire) - position);
+
+				if (diff == 0)
+				{
+					if (pushPosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+						break;
+				}
+				else if (diff < 0)
+				{
+					return false;
+				}
+				else
+				{
+					position = pushPosition.load(std::memory_order_relaxed);
+				}
+			}
+
+			slot->item = item;
+			slot->sequence.store(position + 1, std::memory_order_release);
+
+			return true;
+		}
+
+		/** Takes the oldest item. Consumer thread only. Returns false if the queue is empty.*/
+		bool pop(T& item)
+		{
+			Slot& slot = slots[popPosition & (Size - 1)];
+
+			if (slot.sequence.load(std::memory_order_acquire) != popPosition + 1)
+				return false;
+
+			item = slot.item;
+			slot.sequence.store(popPosition + Size, std::memory_order_release);
+			popPosition++;
+
+			return true;
+		}
+
+		/** Discards all items. Consumer thread only.*/
+		void clear()
+		{
+			T item;
+			while (pop(item));
+		}
+
+	private:
+
+		struct Slot
+		{
+			std::atomic<uint32_t> sequence;
+			T item;
+		};
+
+		std::array<Slot, Size> slots;
+		std::atomic<uint32_t> pushPosition;
+		uint32_t popPosition;
+	};
+
+}
+#endif  // __MPSCQUEUE_H_2C4CBD67__
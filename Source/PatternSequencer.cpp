@@ -0,0 +1,231 @@
+/*
+    ------------------------------------------------------------------
+
+    This file is part of the Open Ephys GUI
+    Copyright (C) 2021 Open Ephys
+
+    ------------------------------------------------------------------
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+#include "PatternSequencer.h"
+
+#include <algorithm>
+
+using namespace ONIRhythmNode;
+
+PatternSequencer::PatternSequencer() :
+    numEdges(0),
+    trainLength(0),
+    interval(0),
+    repetitions(0),
+    request(REQUEST_NONE),
+    requestedStart(-1),
+    playing(false),
+    running(false),
+    stopAfterTrain(false),
+    trainStart(0),
+    trainsLeft(0),
+    nextEdge(0),
+    state(0),
+    finishedAborted(false)
+{
+}
+
+PatternSequencer::~PatternSequencer()
+{
+    cancelPendingUpdate();
+}
+
+bool PatternSequencer::load(const Array<TtlPatternPulse>& pulses, int repetitions_, int64 interval_, int64 trainLength_)
+{
+    const ScopedLock lock(controlLock);
+
+    if (playing || pulses.size() == 0 || pulses.size() * 2 > MAX_PATTERN_EDGES
+        || repetitions_ < 1 || interval_ < 0)
+        return false;
+
+    Array<TtlPatternPulse> sorted(pulses);
+
+    std::sort(sorted.begin(), sorted.end(), [](const TtlPatternPulse& a, const TtlPatternPulse& b)
+        {
+            return a.line != b.line ? a.line < b.line : a.on < b.on;
+        });
+
+    int64 end = 0;
+
+    for (int i = 0; i < sorted.size(); i++)
+    {
+        const TtlPatternPulse& p = sorted.getReference(i);
+
+        if (p.line < 0 || p.line >= NUM_TTL_OUTPUT_LINES || p.on < 0 || p.off <= p.on)
+            return false;
+
+        if (i > 0 && sorted[i - 1].line == p.line && sorted[i - 1].off > p.on)
+            return false;
+
+        end = jmax(end, p.off);
+    }
+
+    numEdges = 0;
+
+    for (const TtlPatternPulse& p : sorted)
+    {
+        edges[numEdges++] = { p.on, 1u << p.line, 1u << p.line };
+        edges[numEdges++] = { p.off, 1u << p.line, 0 };
+    }
+
+    // a line lowered and raised at the same sample stays high
+    std::sort(edges.begin(), edges.begin() + numEdges, [](const Edge& a, const Edge& b)
+        {
+            return a.offset != b.offset ? a.offset < b.offset : a.value < b.value;
+        });
+
+    trainLength = jmax(end, trainLength_);
+    interval = interval_;
+    repetitions = repetitions_;
+
+    return true;
+}
+
+bool PatternSequencer::start(int64 startSample)
+{
+    const ScopedLock lock(controlLock);
+
+    if (playing || numEdges == 0)
+        return false;
+
+    requestedStart = startSample;
+    playing = true;
+    request = REQUEST_START;
+
+    return true;
+}
+
+void PatternSequencer::stop()
+{
+    const ScopedLock lock(controlLock);
+
+    if (playing)
+        request = REQUEST_STOP;
+}
+
+void PatternSequencer::abort()
+{
+    const ScopedLock lock(controlLock);
+
+    if (playing)
+        request = REQUEST_ABORT;
+}
+
+void PatternSequencer::acquisitionStopped()
+{
+    const ScopedLock lock(controlLock);
+
+    request = REQUEST_NONE;
+    running = false;
+    state = 0;
+
+    if (playing)
+    {
+        playing = false;
+        finishedAborted = true;
+        triggerAsyncUpdate();
+    }
+}
+
+uint32 PatternSequencer::process(int64 sampleNumber)
+{
+    if (request.load(std::memory_order_relaxed) != REQUEST_NONE)
+    {
+        switch (request.exchange(REQUEST_NONE))
+        {
+        case REQUEST_START:
+            running = true;
+            stopAfterTrain = false;
+            trainStart = jmax(sampleNumber, requestedStart.load());
+            trainsLeft = repetitions;
+            nextEdge = 0;
+            state = 0;
+            break;
+        case REQUEST_STOP:
+            if (running)
+                stopAfterTrain = true;
+            else if (playing)
+                finish(true);
+            break;
+        case REQUEST_ABORT:
+            if (playing)
+                finish(true);
+            break;
+        default:
+            break;
+        }
+    }
+
+    while (running && sampleNumber >= trainStart)
+    {
+        const int64 offset = sampleNumber - trainStart;
+
+        while (nextEdge < numEdges && edges[nextEdge].offset <= offset)
+        {
+            const Edge& edge = edges[nextEdge++];
+            state = (state & ~edge.mask) | edge.value;
+        }
+
+        if (offset < trainLength)
+            break;
+
+        if (--trainsLeft == 0 || stopAfterTrain)
+        {
+            finish(trainsLeft > 0);
+            break;
+        }
+
+        trainStart += trainLength + interval;
+        nextEdge = 0;
+    }
+
+    return state;
+}
+
+void PatternSequencer::finish(bool aborted)
+{
+    running = false;
+    state = 0;
+    finishedAborted = aborted;
+    playing = false;
+
+    triggerAsyncUpdate();
+}
+
+void PatternSequencer::addListener(TtlPatternListener* listener)
+{
+    listeners.add(listener);
+}
+
+void PatternSequencer::removeListener(TtlPatternListener* listener)
+{
+    listeners.remove(listener);
+}
+
+void PatternSequencer::handleAsyncUpdate()
+{
+    const bool aborted = finishedAborted;
+
+    LOGC("TTL pattern ", aborted ? "aborted" : "finished");
+
+    listeners.call([aborted](TtlPatternListener& l) { l.ttlPatternFinished(aborted); });
+}
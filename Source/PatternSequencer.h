@@ -0,0 +1,140 @@
+/*
+    ------------------------------------------------------------------
+
+    This file is part of the Open Ephys GUI
+    Copyright (C) 2020 Open Ephys
+
+    ------------------------------------------------------------------
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __PATTERNSEQUENCER_H_2C4CBD67__
+#define __PATTERNSEQUENCER_H_2C4CBD67__
+
+#include <DataThreadHeaders.h>
+
+#include <array>
+#include <atomic>
+
+#include "DeviceThread.h"
+
+namespace ONIRhythmNode
+{
+
+	/**
+		Plays a preloaded TTL output pattern in Rhythm sample time.
+
+		A pattern is a train of pulses on any of the output lines, repeated a
+		number of times with a fixed interval between the end of a train and the
+		start of the next. It is converted to a table of edges when loaded, and
+		played by the acquisition thread, which calls process() with the timestamp
+		of every frame it decodes.
+
+		Playing can be stopped after the current train or aborted at once. When the
+		pattern ends, for either reason, the listeners are notified on the message thread.
+
+		@see DeviceThread::loadTtlPattern
+	*/
+	class PatternSequencer : public AsyncUpdater
+	{
+	public:
+
+		/** Constructor*/
+		PatternSequencer();
+
+		/** Destructor*/
+		~PatternSequencer();
+
+		/** Loads a pattern. Pulses on the same line must not overlap. trainLength is
+		    the duration of one train (at least the end of its last pulse).
+		    Returns false while a pattern is playing or if the pattern is invalid.*/
+		bool load(const Array<TtlPatternPulse>& pulses, int repetitions, int64 interval, int64 trainLength = 0);
+
+		/** Starts playing the loaded pattern at startSample (or at the next sample if negative)*/
+		bool start(int64 startSample);
+
+		/** Stops at the end of the current train*/
+		void stop();
+
+		/** Stops immediately, clearing the pattern's lines*/
+		void abort();
+
+		/** Returns true from start() until the pattern has ended*/
+		bool isPlaying() const { return playing; }
+
+		/** Must be called once acquisition has stopped; a pattern still playing is reported as aborted*/
+		void acquisitionStopped();
+
+		/** Plays the edges due at a sample (acquisition thread). Returns the state of the pattern's lines.*/
+		uint32 process(int64 sampleNumber);
+
+		void addListener(TtlPatternListener* listener);
+		void removeListener(TtlPatternListener* listener);
+
+		/** Notifies the listeners (message thread)*/
+		void handleAsyncUpdate() override;
+
+	private:
+
+		enum Request
+		{
+			REQUEST_NONE = 0,
+			REQUEST_START,
+			REQUEST_STOP,
+			REQUEST_ABORT
+		};
+
+		struct Edge
+		{
+			int64 offset;
+			uint32 mask;
+			uint32 value;
+		};
+
+		/** Ends playing and schedules the notification (acquisition thread)*/
+		void finish(bool aborted);
+
+		static const int MAX_PATTERN_EDGES = 1024;
+
+		std::array<Edge, MAX_PATTERN_EDGES> edges;
+		int numEdges;
+		int64 trainLength;
+		int64 interval;
+		int repetitions;
+
+		/** Serializes load/start/stop/abort; never taken by the acquisition thread*/
+		CriticalSection controlLock;
+
+		std::atomic<int> request;
+		std::atomic<int64> requestedStart;
+		std::atomic<bool> playing;
+
+		// playback state, acquisition thread only
+		bool running;
+		bool stopAfterTrain;
+		int64 trainStart;
+		int trainsLeft;
+		int nextEdge;
+		uint32 state;
+
+		std::atomic<bool> finishedAborted;
+
+		ListenerList<TtlPatternListener> listeners;
+
+		JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(PatternSequencer);
+	};
+
+}
+#endif  // __PATTERNSEQUENCER_H_2C4CBD67__
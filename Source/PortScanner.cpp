@@ -0,0 +1,77 @@
+/*
+    ------------------------------------------------------------------
+
+    This file is part of the Open Ephys GUI
+    Copyright (C) 2021 Open Ephys
+
+    ------------------------------------------------------------------
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "PortScanner.h"
+
+using namespace ONIRhythmNode;
+
+PortScanner::PortScanner(DeviceThread* board_) :
+    Thread("Port Scanner"),
+    board(board_),
+    fullScan(false)
+{
+}
+
+PortScanner::~PortScanner()
+{
+    cancel();
+
+    if (!stopThread(5000))
+        LOGE("Port scan did not exit.");
+}
+
+bool PortScanner::startScan(bool fullScan_)
+{
+    if (isThreadRunning())
+        return false;
+
+    fullScan = fullScan_;
+    board->portScanCancelled = false;
+    board->portScanProgress = 0.0f;
+    board->portScanRunning = true;
+
+    startThread();
+
+    return true;
+}
+
+void PortScanner::cancel()
+{
+    board->portScanCancelled = true;
+    signalThreadShouldExit();
+}
+
+void PortScanner::run()
+{
+    LOGD("Starting port scan");
+
+    board->scanPorts(false, fullScan);
+
+    LOGD("Port scan finished");
+
+    board->portScanProgress = 1.0f;
+    board->portScanRunning = false;
+
+    // posted to the message thread, where the editor updates the signal chain
+    board->sendChangeMessage();
+}
@@ -0,0 +1,72 @@
+/*
+    ------------------------------------------------------------------
+
+    This file is part of the Open Ephys GUI
+    Copyright (C) 2020 Open Ephys
+
+    ------------------------------------------------------------------
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef __PORTSCANNER_H_2C4CBD67__
+#define __PORTSCANNER_H_2C4CBD67__
+
+#include <DataThreadHeaders.h>
+
+#include "DeviceThread.h"
+
+namespace ONIRhythmNode
+{
+
+	/**
+		Runs DeviceThread::scanPorts() on a background thread, so the
+		editor stays responsive while headstages are detected.
+
+		Progress and completion are reported through the DeviceThread's
+		change messages.
+
+		@see DeviceThread
+	*/
+	class PortScanner : public Thread
+	{
+	public:
+
+		/** Constructor*/
+		PortScanner(DeviceThread* b);
+
+		/** Destructor*/
+		~PortScanner();
+
+		/** Starts a scan. Returns false if a scan is already running.*/
+		bool startScan(bool fullScan);
+
+		/** Asks a running scan to stop at the next delay step*/
+		void cancel();
+
+		/** Scans the ports*/
+		void run() override;
+
+	private:
+
+		DeviceThread* board;
+
+		bool fullScan;
+
+		JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(PortScanner);
+	};
+
+}
+#endif  // __PORTSCANNER_H_2C4CBD67__
@@ -0,0 +1,176 @@
+/*
+    ------------------------------------------------------------------
+
+    This file is part of the Open Ephys GUI
+    Copyright (C) 2021 Open Ephys
+
+    ------------------------------------------------------------------
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+#include "PulseScheduler.h"
+
+using namespace ONIRhythmNode;
+
+PulseScheduler::PulseScheduler() :
+    numPending(0),
+    levels(0),
+    state(0),
+    nextEdge(std::numeric_limits<int64>::max()),
+    lastSample(-1),
+    numLate(0)
+{
+    activeCount.fill(0);
+}
+
+bool PulseScheduler::schedule(int ttlLine, int64 startSample, int64 numSamples, int64 period, int count)
+{
+    if (numSamples < 1 || count < 1 || (count > 1 && period <= numSamples))
+        return false;
+
+    Pulse pulse;
+    pulse.line = ttlLine;
+    pulse.start = startSample;
+    pulse.length = numSamples;
+    pulse.period = period;
+    pulse.count = count;
+    pulse.level = -1;
+
+    return push(pulse);
+}
+
+bool PulseScheduler::setLevel(int ttlLine, bool high, int64 startSample)
+{
+    Pulse pulse;
+    pulse.line = ttlLine;
+    pulse.start = startSample;
+    pulse.length = 0;
+    pulse.period = 0;
+    pulse.count = 1;
+    pulse.level = high ? 1 : 0;
+
+    return push(pulse);
+}
+
+bool PulseScheduler::push(const Pulse& pulse)
+{
+    if (pulse.line < 0 || pulse.line >= NUM_TTL_OUTPUT_LINES)
+        return false;
+
+    Pulse p = pulse;
+    p.end = 0;
+    p.raised = false;
+
+    return requests.push(p);
+}
+
+void PulseScheduler::reset()
+{
+    requests.clear();
+
+    numPending = 0;
+    activeCount.fill(0);
+    levels = 0;
+    state = 0;
+    nextEdge = std::numeric_limits<int64>::max();
+    lastSample = -1;
+    numLate = 0;
+}
+
+uint32 PulseScheduler::process(int64 sampleNumber)
+{
+    lastSample = sampleNumber;
+
+    Pulse pulse;
+
+    while (requests.pop(pulse))
+    {
+        if (numPending == MAX_PENDING_PULSES)
+        {
+            LOGE("Too many pending TTL pulses, request on line ", pulse.line + 1, " dropped");
+            continue;
+        }
+
+        if (pulse.start < sampleNumber)
+        {
+            if (pulse.start >= 0)
+                numLate++;
+
+            pulse.start = sampleNumber;
+        }
+
+        pending[numPending++] = pulse;
+        nextEdge = jmin(nextEdge, pulse.start);
+    }
+
+    if (sampleNumber < nextEdge)
+        return state;
+
+    nextEdge = std::numeric_limits<int64>::max();
+
+    uint32 pulses = 0;
+
+    for (int i = 0; i < numPending; i++)
+    {
+        Pulse& p = pending[i];
+        const uint32 bit = 1u << p.line;
+
+        if (p.level >= 0)
+        {
+            if (sampleNumber >= p.start)
+            {
+                levels = p.level ? (levels | bit) : (levels & ~bit);
+                pending[i--] = pending[--numPending];
+                continue;
+            }
+        }
+        else
+        {
+            if (!p.raised && sampleNumber >= p.start)
+            {
+                p.raised = true;
+                p.end = sampleNumber + p.length;
+                activeCount[p.line]++;
+            }
+
+            if (p.raised && sampleNumber >= p.end)
+            {
+                activeCount[p.line]--;
+
+                if (--p.count == 0)
+                {
+                    pending[i--] = pending[--numPending];
+                    continue;
+                }
+
+                // the next pulse of a train keeps its period from the one that just ended
+                p.raised = false;
+                p.start = p.end - p.length + p.period;
+            }
+        }
+
+        nextEdge = jmin(nextEdge, p.raised ? p.end : p.start);
+    }
+
+    for (int line = 0; line < NUM_TTL_OUTPUT_LINES; line++)
+    {
+        if (activeCount[line] > 0)
+            pulses |= 1u << line;
+    }
+
+    state = levels | pulses;
+
+    return state;
+}
@@ -0,0 +1,120 @@
+/*
+    ------------------------------------------------------------------
+
+    This file is part of the Open Ephys GUI
+    Copyright (C) 2020 Open Ephys
+
+    ------------------------------------------------------------------
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __PULSESCHEDULER_H_2C4CBD67__
+#define __PULSESCHEDULER_H_2C4CBD67__
+
+#include <DataThreadHeaders.h>
+
+#include <array>
+#include <atomic>
+
+#include "DeviceThread.h"
+#include "MpscQueue.h"
+
+namespace ONIRhythmNode
+{
+
+	/**
+		Generates TTL output pulses in Rhythm sample time.
+
+		A pulse raises an output line at a given sample number and lowers it
+		after a given number of samples; a train repeats it count times, once
+		every period. Lines can also be set to a fixed level from a given sample.
+		Requests can be made from any thread; they are executed by the acquisition
+		thread, which calls process() with the timestamp of every frame it decodes.
+		A line is high while it is set high or any pulse on it is active.
+
+		Sample numbers restart from zero with every acquisition.
+
+		@see DeviceThread::executeTtlCommand
+	*/
+	class PulseScheduler
+	{
+	public:
+
+		/** Constructor*/
+		PulseScheduler();
+
+		/** Requests a pulse on an output line (0-7), starting at startSample
+		    (or at the next sample if negative) and lasting numSamples. With count > 1,
+		    the pulse is repeated every period samples. Returns false if the request was rejected.*/
+		bool schedule(int ttlLine, int64 startSample, int64 numSamples, int64 period = 0, int count = 1);
+
+		/** Sets an output line (0-7) high or low from startSample on (or from the next sample if negative)*/
+		bool setLevel(int ttlLine, bool high, int64 startSample);
+
+		/** Drops all pulses. Must not be called during acquisition.*/
+		void reset();
+
+		/** Executes the pulse edges due at a sample (acquisition thread). Returns the state of the output lines.*/
+		uint32 process(int64 sampleNumber);
+
+		/** Returns the last sample number processed*/
+		int64 getLastSampleNumber() const { return lastSample; }
+
+		/** Number of pulses started after their requested sample*/
+		int64 getNumLatePulses() const { return numLate; }
+
+	private:
+
+		struct Pulse
+		{
+			int line;
+			int64 start;
+			int64 length;
+			int64 period;
+			int count;
+			int level;    // -1 for a pulse
+			int64 end;
+			bool raised;
+		};
+
+		bool push(const Pulse& pulse);
+
+		static const int MAX_PENDING_PULSES = 64;
+
+		MpscQueue<Pulse, 256> requests;
+
+		/** Pulses taken from the queue, owned by the acquisition thread*/
+		std::array<Pulse, MAX_PENDING_PULSES> pending;
+		int numPending;
+
+		/** Number of raised pulses on each line*/
+		std::array<int, NUM_TTL_OUTPUT_LINES> activeCount;
+
+		/** Lines set high by level requests*/
+		uint32 levels;
+
+		uint32 state;
+
+		/** Earliest sample at which a pending pulse changes*/
+		int64 nextEdge;
+
+		std::atomic<int64> lastSample;
+		std::atomic<int64> numLate;
+
+		JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(PulseScheduler);
+	};
+
+}
+#endif  // __PULSESCHEDULER_H_2C4CBD67__
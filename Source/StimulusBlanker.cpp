@@ -0,0 +1,221 @@
+/*
+    ------------------------------------------------------------------
+
+    This file is part of the Open Ephys GUI
+    Copyright (C) 2021 Open Ephys
+
+    ------------------------------------------------------------------
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+#include "StimulusBlanker.h"
+#include "DeviceThread.h"
+
+using namespace ONIRhythmNode;
+
+StimulusBlanker::StimulusBlanker(DeviceThread* board_) :
+    board(board_),
+    enabled(false),
+    outputTriggerLines(0),
+    inputTriggerLines(0),
+    window(30),
+    mode(HOLD),
+    numWindows(0),
+    active(false),
+    activeMode(HOLD),
+    numChannels(0),
+    lastInputs(0),
+    lastOutputs(0),
+    remaining(0),
+    numHeld(0)
+{
+}
+
+void StimulusBlanker::setEnabled(bool enabled_)
+{
+    enabled = enabled_;
+}
+
+void StimulusBlanker::setTriggerLines(uint32 outputLines, uint32 inputLines)
+{
+    outputTriggerLines = outputLines & ((1u << NUM_TTL_OUTPUT_LINES) - 1);
+    inputTriggerLines = inputLines & ((1u << NUM_TTL_INPUT_LINES) - 1);
+}
+
+void StimulusBlanker::setWindow(int samples)
+{
+    window = jlimit(1, MAX_BLANKING_SAMPLES, samples);
+}
+
+void StimulusBlanker::setMode(Mode mode_)
+{
+    mode = mode_;
+}
+
+void StimulusBlanker::setChannels(const Array<int>& channels_)
+{
+    const ScopedLock lock(channelLock);
+    channels = channels_;
+}
+
+Array<int> StimulusBlanker::getChannels() const
+{
+    const ScopedLock lock(channelLock);
+    return channels;
+}
+
+bool StimulusBlanker::prepare()
+{
+    active = false;
+    remaining = 0;
+    numHeld = 0;
+    lastInputs = 0;
+    lastOutputs = 0;
+    numWindows = 0;
+
+    if (!enabled || (outputTriggerLines == 0 && inputTriggerLines == 0))
+        return false;
+
+    const int numAmplifierChannels = board->getNumDataOutputs(ContinuousChannel::ELECTRODE);
+
+    activeChannels.clear();
+
+    {
+        const ScopedLock lock(channelLock);
+
+        if (channels.isEmpty())
+        {
+            for (int channel = 0; channel < numAmplifierChannels; channel++)
+                activeChannels.push_back(channel);
+        }
+        else
+        {
+            for (int channel : channels)
+            {
+                if (channel >= 0 && channel < numAmplifierChannels)
+                    activeChannels.push_back(channel);
+            }
+        }
+    }
+
+    if (activeChannels.empty())
+        return false;
+
+    activeMode = mode;
+    numChannels = board->getNumChannels();
+    anchor.assign(activeChannels.size(), 0.0f);
+
+    if (activeMode == INTERPOLATE)
+    {
+        heldSamples.resize((size_t) MAX_BLANKING_SAMPLES * numChannels);
+        heldSampleNumbers.resize(MAX_BLANKING_SAMPLES);
+        heldTimestamps.resize(MAX_BLANKING_SAMPLES);
+        heldEvents.resize(MAX_BLANKING_SAMPLES);
+    }
+
+    active = true;
+
+    LOGD("Stimulus blanking: ", (int) activeChannels.size(), " channels, ", (int) window, " samples, ",
+         activeMode == INTERPOLATE ? "interpolate" : "hold");
+
+    return true;
+}
+
+void StimulusBlanker::process(DataBuffer* buffer, float* sample, int64 sampleNumber, double* timestamp,
+                              uint64 eventWord, uint32 inputState, uint32 outputState)
+{
+    const uint32 edges = (outputState & ~lastOutputs & outputTriggerLines)
+                       | (inputState & ~lastInputs & inputTriggerLines);
+
+    lastOutputs = outputState;
+    lastInputs = inputState;
+
+    if (remaining > 0)
+    {
+        if (activeMode == HOLD)
+        {
+            for (size_t i = 0; i < activeChannels.size(); i++)
+                sample[activeChannels[i]] = anchor[i];
+
+            buffer->addToBuffer(sample, &sampleNumber, timestamp, &eventWord, 1);
+        }
+        else
+        {
+            memcpy(&heldSamples[(size_t) numHeld * numChannels], sample, numChannels * sizeof(float));
+            heldSampleNumbers[numHeld] = sampleNumber;
+            heldTimestamps[numHeld] = *timestamp;
+            heldEvents[numHeld] = eventWord;
+            numHeld++;
+        }
+
+        remaining--;
+
+        if (edges != 0)
+        {
+            remaining = jmax(remaining, (int) window);
+
+            // the held samples must fit the buffer
+            if (activeMode == INTERPOLATE)
+                remaining = jmin(remaining, MAX_BLANKING_SAMPLES - numHeld);
+
+            numWindows++;
+        }
+
+        return;
+    }
+
+    if (numHeld > 0)
+        flush(buffer, sample);
+
+    buffer->addToBuffer(sample, &sampleNumber, timestamp, &eventWord, 1);
+
+    // the edge sample itself is kept and anchors the window
+    if (edges != 0)
+    {
+        for (size_t i = 0; i < activeChannels.size(); i++)
+            anchor[i] = sample[activeChannels[i]];
+
+        remaining = window;
+        numWindows++;
+    }
+}
+
+void StimulusBlanker::flush(DataBuffer* buffer, const float* end)
+{
+    const float step = 1.0f / float(numHeld + 1);
+
+    for (int n = 0; n < numHeld; n++)
+    {
+        float* held = &heldSamples[(size_t) n * numChannels];
+        const float t = step * float(n + 1);
+
+        for (size_t i = 0; i < activeChannels.size(); i++)
+            held[activeChannels[i]] = anchor[i] + (end[activeChannels[i]] - anchor[i]) * t;
+
+        buffer->addToBuffer(held, &heldSampleNumbers[n], &heldTimestamps[n], &heldEvents[n], 1);
+    }
+
+    numHeld = 0;
+}
+
+void StimulusBlanker::finish()
+{
+    if (numHeld > 0)
+        LOGD("Stimulus blanking: dropped ", numHeld, " samples held at stop");
+
+    active = false;
+    remaining = 0;
+    numHeld = 0;
+}
@@ -0,0 +1,145 @@
+/*
+    ------------------------------------------------------------------
+
+    This file is part of the Open Ephys GUI
+    Copyright (C) 2020 Open Ephys
+
+    ------------------------------------------------------------------
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __STIMULUSBLANKER_H_2C4CBD67__
+#define __STIMULUSBLANKER_H_2C4CBD67__
+
+#include <DataThreadHeaders.h>
+
+#include <atomic>
+#include <vector>
+
+/** Longest blanking window, in samples (sizes the interpolation buffer)*/
+#define MAX_BLANKING_SAMPLES 3000
+
+namespace ONIRhythmNode
+{
+
+	class DeviceThread;
+
+	/**
+		Blanks stimulation artifacts before samples enter the DataBuffer.
+
+		A rising edge on one of the selected TTL output or input lines starts a
+		window of samples in which the selected amplifier channels are replaced,
+		either by their value at the edge (hold) or by a straight line from that
+		value to the first sample after the window (interpolate). Output edges are
+		taken from the output state the board reports in each frame, so a window
+		starts at the sample the stimulus was applied, not when it was computed. Interpolated
+		samples are held back until the window ends, so they reach the buffer late
+		by up to the window length. A new edge inside the window extends it.
+
+		Outside of a window, a sample only costs an edge check.
+
+		@see DeviceThread::updateBuffer
+	*/
+	class StimulusBlanker
+	{
+	public:
+
+		enum Mode
+		{
+			HOLD = 0,
+			INTERPOLATE = 1
+		};
+
+		/** Constructor*/
+		StimulusBlanker(DeviceThread* b);
+
+		/** Enables or disables blanking (takes effect at the next acquisition start)*/
+		void setEnabled(bool enabled);
+
+		bool isEnabled() const { return enabled; }
+
+		/** Selects the TTL output and input lines whose rising edges start a window (bit n = line n)*/
+		void setTriggerLines(uint32 outputLines, uint32 inputLines);
+
+		uint32 getOutputTriggerLines() const { return outputTriggerLines; }
+
+		uint32 getInputTriggerLines() const { return inputTriggerLines; }
+
+		/** Sets the number of samples blanked after each edge*/
+		void setWindow(int samples);
+
+		int getWindow() const { return window; }
+
+		/** Sets how blanked samples are replaced*/
+		void setMode(Mode mode);
+
+		Mode getMode() const { return mode; }
+
+		/** Sets the blanked amplifier channels; all amplifier channels if empty (takes effect at the next acquisition start)*/
+		void setChannels(const Array<int>& channels);
+
+		Array<int> getChannels() const;
+
+		/** Number of windows started since acquisition started*/
+		int64 getNumWindows() const { return numWindows; }
+
+		/** Prepares blanking. Must be called before acquisition starts; returns true if active.*/
+		bool prepare();
+
+		/** Blanks one decoded sample if needed and adds it to the buffer (acquisition thread)*/
+		void process(DataBuffer* buffer, float* sample, int64 sampleNumber, double* timestamp,
+					 uint64 eventWord, uint32 inputState, uint32 outputState);
+
+		/** Drops samples still held back. Must be called once the acquisition thread has exited.*/
+		void finish();
+
+	private:
+
+		/** Interpolates the held samples towards end and adds them to the buffer*/
+		void flush(DataBuffer* buffer, const float* end);
+
+		DeviceThread* board;
+
+		std::atomic<bool> enabled;
+		std::atomic<uint32> outputTriggerLines;
+		std::atomic<uint32> inputTriggerLines;
+		std::atomic<int> window;
+		std::atomic<Mode> mode;
+		std::atomic<int64> numWindows;
+
+		CriticalSection channelLock;
+		Array<int> channels;
+
+		// acquisition thread only
+		bool active;
+		Mode activeMode;
+		int numChannels;
+		std::vector<int> activeChannels;
+		std::vector<float> anchor;
+		uint32 lastInputs;
+		uint32 lastOutputs;
+		int remaining;
+
+		int numHeld;
+		std::vector<float> heldSamples;
+		std::vector<int64> heldSampleNumbers;
+		std::vector<double> heldTimestamps;
+		std::vector<uint64> heldEvents;
+
+		JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(StimulusBlanker);
+	};
+
+}
+#endif  // __STIMULUSBLANKER_H_2C4CBD67__
@@ -0,0 +1,90 @@
+/*
+    ------------------------------------------------------------------
+
+    This file is part of the Open Ephys GUI
+    Copyright (C) 2020 Open Ephys
+
+    ------------------------------------------------------------------
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __TTLCOMMAND_H_2C4CBD67__
+#define __TTLCOMMAND_H_2C4CBD67__
+
+#include <cstdint>
+
+namespace ONIRhythmNode
+{
+
+	enum TtlCommandType : uint8_t
+	{
+		TTL_PULSE = 0,        // one pulse of the given duration
+		TTL_PULSE_TRAIN = 1,  // count pulses, one every period
+		TTL_LEVEL = 2,        // sets the line high or low until changed
+		TTL_PATTERN_START = 3, // plays the loaded pattern from start
+		TTL_PATTERN_STOP = 4,  // stops the pattern after the current train
+		TTL_PATTERN_ABORT = 5  // stops the pattern immediately
+	};
+
+	enum TtlTimeUnit : uint8_t
+	{
+		TTL_SAMPLES = 0,
+		TTL_MICROSECONDS = 1
+	};
+
+	/**
+		Pre-parsed command for the TTL outputs, accepted by
+		DeviceThread::executeTtlCommand() and, in host byte order,
+		by the local command socket.
+
+		Start is always a Rhythm sample number (-1 for the next sample);
+		duration and period are in the given time unit.
+
+		@see PulseScheduler
+	*/
+	struct TtlCommand
+	{
+		uint8_t type = TTL_PULSE;
+		uint8_t line = 0;          // output line, 0-7
+		uint8_t level = 1;         // TTL_LEVEL only
+		uint8_t timeUnit = TTL_SAMPLES;
+		uint32_t count = 1;        // TTL_PULSE_TRAIN only
+		int64_t start = -1;
+		int64_t duration = 0;
+		int64_t period = 0;        // TTL_PULSE_TRAIN only
+	};
+
+	static_assert(sizeof(TtlCommand) == 32, "TtlCommand is sent over the command socket as is");
+
+	/** One pulse of a TTL pattern, in samples from the start of its train*/
+	struct TtlPatternPulse
+	{
+		int line;       // output line, 0-7
+		int64_t on;
+		int64_t off;
+	};
+
+	/** Receives the end of TTL patterns, see DeviceThread::loadTtlPattern()*/
+	class TtlPatternListener
+	{
+	public:
+		virtual ~TtlPatternListener() { }
+
+		/** Called on the message thread when a pattern has ended; aborted is true unless all trains were played*/
+		virtual void ttlPatternFinished(bool aborted) = 0;
+	};
+
+}
+#endif  // __TTLCOMMAND_H_2C4CBD67__
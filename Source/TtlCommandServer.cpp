@@ -0,0 +1,122 @@
+/*
+    ------------------------------------------------------------------
+
+    This file is part of the Open Ephys GUI
+    Copyright (C) 2021 Open Ephys
+
+    ------------------------------------------------------------------
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+#include "TtlCommandServer.h"
+
+using namespace ONIRhythmNode;
+
+TtlCommandServer::TtlCommandServer(DeviceThread* board_) :
+    Thread("TTL Command Server"),
+    board(board_),
+    port(0)
+{
+}
+
+TtlCommandServer::~TtlCommandServer()
+{
+    stop();
+}
+
+bool TtlCommandServer::setPort(int port_)
+{
+    if (port_ == port)
+        return true;
+
+    stop();
+
+    if (port_ <= 0)
+        return true;
+
+    if (!listener.createListener(port_, "127.0.0.1"))
+    {
+        LOGE("Could not open TTL command port ", port_);
+        return false;
+    }
+
+    port = port_;
+    startThread();
+
+    LOGC("Listening for TTL commands on port ", port_);
+
+    return true;
+}
+
+void TtlCommandServer::stop()
+{
+    signalThreadShouldExit();
+
+    // unblocks waitForNextConnection()
+    listener.close();
+
+    if (!stopThread(1000))
+        LOGE("TTL command server did not exit.");
+
+    port = 0;
+}
+
+void TtlCommandServer::run()
+{
+    while (!threadShouldExit())
+    {
+        std::unique_ptr<StreamingSocket> client(listener.waitForNextConnection());
+
+        if (client == nullptr)
+            break;
+
+        serve(client.get());
+    }
+}
+
+void TtlCommandServer::serve(StreamingSocket* client)
+{
+    TtlCommand command;
+    int received = 0;
+
+    while (!threadShouldExit())
+    {
+        // wake up regularly to check whether the server is stopping
+        int ready = client->waitUntilReady(true, 100);
+
+        if (ready < 0)
+            return;
+
+        if (ready == 0)
+            continue;
+
+        int n = client->read(reinterpret_cast<char*>(&command) + received, sizeof(command) - received, false);
+
+        if (n <= 0)
+            return;
+
+        received += n;
+
+        if (received < int(sizeof(command)))
+            continue;
+
+        received = 0;
+
+        const uint8 accepted = board->executeTtlCommand(command) ? 1 : 0;
+
+        if (client->write(&accepted, 1) != 1)
+            return;
+    }
+}
@@ -0,0 +1,81 @@
+/*
+    ------------------------------------------------------------------
+
+    This file is part of the Open Ephys GUI
+    Copyright (C) 2020 Open Ephys
+
+    ------------------------------------------------------------------
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __TTLCOMMANDSERVER_H_2C4CBD67__
+#define __TTLCOMMANDSERVER_H_2C4CBD67__
+
+#include <DataThreadHeaders.h>
+
+#include <atomic>
+
+#include "DeviceThread.h"
+#include "TtlCommand.h"
+
+namespace ONIRhythmNode
+{
+
+	/**
+		Accepts TTL output commands from other processes on the local machine.
+
+		Listens on a TCP port of the loopback interface. A client sends TtlCommand
+		structs back to back, in host byte order; every command is answered with
+		one byte, 1 if it was accepted and 0 otherwise. One client is served at a time.
+
+		@see DeviceThread::executeTtlCommand
+	*/
+	class TtlCommandServer : public Thread
+	{
+	public:
+
+		/** Constructor*/
+		TtlCommandServer(DeviceThread* b);
+
+		/** Destructor*/
+		~TtlCommandServer();
+
+		/** Starts listening on a port, or stops the server if port is 0.
+		    Returns false if the port could not be opened.*/
+		bool setPort(int port);
+
+		/** Returns the port the server listens on (0 if stopped)*/
+		int getPort() const { return port; }
+
+		/** Serves clients*/
+		void run() override;
+
+	private:
+
+		/** Reads commands from a client until it disconnects or the server stops*/
+		void serve(StreamingSocket* client);
+
+		void stop();
+
+		DeviceThread* board;
+
+		StreamingSocket listener;
+		std::atomic<int> port;
+
+		JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(TtlCommandServer);
+	};
+
+}
+#endif  // __TTLCOMMANDSERVER_H_2C4CBD67__
@@ -0,0 +1,168 @@
+/*
+    ------------------------------------------------------------------
+
+    This file is part of the Open Ephys GUI
+    Copyright (C) 2021 Open Ephys
+
+    ------------------------------------------------------------------
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+#include "TtlOutputWriter.h"
+
+using namespace ONIRhythmNode;
+
+TtlOutputWriter::TtlOutputWriter(DeviceThread* board_) :
+    Thread("TTL Output Writer"),
+    board(board_),
+    outputState(0),
+    lastLatencyUs(0.0),
+    maxLatencyUs(0.0),
+    totalLatencyUs(0.0),
+    numWritten(0),
+    numDropped(0),
+    numFailed(0),
+    writeFailing(false)
+{
+}
+
+TtlOutputWriter::~TtlOutputWriter()
+{
+    stop();
+}
+
+bool TtlOutputWriter::setLine(int ttlLine, bool state)
+{
+    if (ttlLine < 0 || ttlLine > 15)
+        return false;
+
+    return push(1u << ttlLine, state ? 1u << ttlLine : 0);
+}
+
+bool TtlOutputWriter::push(uint32 mask, uint32 value)
+{
+    Command command;
+    command.mask = mask;
+    command.value = value;
+    command.pushTicks = Time::getHighResolutionTicks();
+
+    if (!commands.push(command))
+    {
+        numDropped++;
+        return false;
+    }
+
+    return true;
+}
+
+void TtlOutputWriter::start()
+{
+    if (isThreadRunning())
+        return;
+
+    commands.clear();
+
+    outputState = 0;
+    lastLatencyUs = 0.0;
+    maxLatencyUs = 0.0;
+    totalLatencyUs = 0.0;
+    numWritten = 0;
+    numDropped = 0;
+    numFailed = 0;
+    writeFailing = false;
+
+    board->evalBoard->clearTtlOut();
+
+    startThread(9);
+}
+
+void TtlOutputWriter::stop()
+{
+    signalThreadShouldExit();
+    notify();
+
+    if (!stopThread(500))
+        LOGE("TTL output writer did not exit.");
+}
+
+void TtlOutputWriter::run()
+{
+    while (!threadShouldExit())
+    {
+        // producers do not signal, so that pushing stays lock-free; only stop() wakes the writer
+        wait(1);
+
+        writePending();
+    }
+}
+
+void TtlOutputWriter::writePending()
+{
+    std::array<int64, QUEUE_SIZE> pushTicks;
+    int numCommands = 0;
+
+    uint32 state = outputState;
+    Command command;
+
+    while (numCommands < int(QUEUE_SIZE) && commands.pop(command))
+    {
+        state = (state & ~command.mask) | (command.value & command.mask);
+        pushTicks[numCommands++] = command.pushTicks;
+    }
+
+    if (numCommands == 0)
+        return;
+
+    if (!board->evalBoard->writeTtlOut(state))
+    {
+        numFailed += numCommands;
+
+        if (!writeFailing)
+            LOGE("Could not write TTL outputs ", String::toHexString(int(state)), ", ", numCommands, " commands lost");
+
+        writeFailing = true;
+        return;
+    }
+
+    writeFailing = false;
+
+    const int64 writtenTicks = Time::getHighResolutionTicks();
+
+    outputState = state;
+
+    double maxUs = maxLatencyUs;
+    double totalUs = 0.0;
+    double latencyUs = 0.0;
+
+    for (int i = 0; i < numCommands; i++)
+    {
+        latencyUs = Time::highResolutionTicksToSeconds(writtenTicks - pushTicks[i]) * 1.0e6;
+        maxUs = jmax(maxUs, latencyUs);
+        totalUs += latencyUs;
+    }
+
+    lastLatencyUs = latencyUs;
+    maxLatencyUs = maxUs;
+    totalLatencyUs = totalLatencyUs + totalUs;
+    numWritten += numCommands;
+
+    LOGB("TTL output state: ", String::toHexString(int(state)), " (", latencyUs, " us)");
+}
+
+double TtlOutputWriter::getMeanLatencyUs() const
+{
+    const int64 n = numWritten;
+    return n > 0 ? totalLatencyUs / double(n) : 0.0;
+}
@@ -0,0 +1,132 @@
+/*
+    ------------------------------------------------------------------
+
+    This file is part of the Open Ephys GUI
+    Copyright (C) 2020 Open Ephys
+
+    ------------------------------------------------------------------
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __TTLOUTPUTWRITER_H_2C4CBD67__
+#define __TTLOUTPUTWRITER_H_2C4CBD67__
+
+#include <DataThreadHeaders.h>
+
+#include <array>
+#include <atomic>
+
+#include "DeviceThread.h"
+#include "MpscQueue.h"
+
+namespace ONIRhythmNode
+{
+
+	/**
+		Sends TTL output changes to the board as soon as they are requested.
+
+		Commands are pushed into a bounded lock-free queue by any number of
+		threads (broadcast messages, the pulse scheduler) and drained by a dedicated writer
+		thread, which applies them to the current output state and writes a
+		single TTL frame per batch. Pushing never signals the writer: it polls the
+		queue every millisecond, so producers never take a lock. The time between
+		a push and the end of the write is measured for every command.
+
+		The writer only runs during acquisition. Commands pushed while it is
+		stopped are discarded when it starts.
+
+		@see DeviceThread::handleBroadcastMessage
+	*/
+	class TtlOutputWriter : public Thread
+	{
+	public:
+
+		/** Constructor*/
+		TtlOutputWriter(DeviceThread* b);
+
+		/** Destructor*/
+		~TtlOutputWriter();
+
+		/** Queues a change of a single output line (0-15). Returns false if the queue is full.*/
+		bool setLine(int ttlLine, bool state);
+
+		/** Queues a change of the lines selected by mask. Returns false if the queue is full.*/
+		bool push(uint32 mask, uint32 value);
+
+		/** Clears the outputs and pending commands, and starts writing*/
+		void start();
+
+		/** Stops writing. Commands still queued are dropped.*/
+		void stop();
+
+		/** Writes queued commands*/
+		void run() override;
+
+		/** Returns the output state last written to the board*/
+		uint32 getOutputState() const { return outputState; }
+
+		/** Push to write latency of the last command, in microseconds*/
+		double getLastLatencyUs() const { return lastLatencyUs; }
+
+		/** Longest push to write latency since the writer started, in microseconds*/
+		double getMaxLatencyUs() const { return maxLatencyUs; }
+
+		/** Mean push to write latency since the writer started, in microseconds*/
+		double getMeanLatencyUs() const;
+
+		/** Number of commands written since the writer started*/
+		int64 getNumCommandsWritten() const { return numWritten; }
+
+		/** Number of commands rejected because the queue was full*/
+		int64 getNumCommandsDropped() const { return numDropped; }
+
+		/** Number of commands lost because the TTL frame could not be written*/
+		int64 getNumCommandsFailed() const { return numFailed; }
+
+	private:
+
+		struct Command
+		{
+			uint32 mask;
+			uint32 value;
+			int64 pushTicks;
+		};
+
+		/** Applies all queued commands and writes the new state*/
+		void writePending();
+
+		DeviceThread* board;
+
+		static const uint32 QUEUE_SIZE = 256;
+
+		MpscQueue<Command, QUEUE_SIZE> commands;
+
+		std::atomic<uint32> outputState;
+
+		std::atomic<double> lastLatencyUs;
+		std::atomic<double> maxLatencyUs;
+		std::atomic<double> totalLatencyUs;
+		std::atomic<int64> numWritten;
+		std::atomic<int64> numDropped;
+		std::atomic<int64> numFailed;
+
+		/** True after a failed write, until a write succeeds again (writer thread)*/
+		bool writeFailing;
+
+		JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(TtlOutputWriter);
+	};
+
+}
+#endif  // __TTLOUTPUTWRITER_H_2C4CBD67__
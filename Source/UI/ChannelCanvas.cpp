@@ -60,6 +60,9 @@ void ChannelCanvas::paint(Graphics& g)
 
 void ChannelCanvas::refresh()
 {
+    if (board->isImpedanceMonitorEnabled())
+        channelList->refreshImpedances();
+
     repaint();
 }
 
@@ -77,10 +80,15 @@ void ChannelCanvas::update()
 void ChannelCanvas::beginAnimation()
 {
     channelList->disableAll();
+
+    if (board->isImpedanceMonitorEnabled())
+        startCallbacks();
 }
 
 void ChannelCanvas::endAnimation()
 {
+    stopCallbacks();
+
     channelList->enableAll();
 }
 
@@ -37,7 +37,8 @@ ChannelComponent::ChannelComponent(ChannelList* cl,
     channelList(cl), 
     channel(ch), 
     name(name_), 
-    gainIndex(gainIndex_)
+    gainIndex(gainIndex_),
+    selected(false)
 {
     Font f = Font("Small Text", 13, Font::plain);
 
@@ -51,6 +52,7 @@ ChannelComponent::ChannelComponent(ChannelList* cl,
     editName->setEditable(false);
     editName->setColour(Label::backgroundColourId,juce::Colours::lightgrey);
     editName->addListener(this);
+    editName->addMouseListener(this, false);
     addAndMakeVisible(editName);
 
     if (type == ContinuousChannel::ELECTRODE)
@@ -96,6 +98,28 @@ void ChannelComponent::setImpedanceValues(float mag, float phase)
     }
 }
 
+void ChannelComponent::setImpedanceTrend(const String& description)
+{
+    if (impedance != nullptr)
+    {
+        impedance->setTooltip(description);
+    }
+}
+
+void ChannelComponent::setSelected(bool selected_)
+{
+    selected = selected_;
+
+    editName->setColour(Label::backgroundColourId,
+        selected ? juce::Colours::orange : juce::Colours::lightgrey);
+}
+
+void ChannelComponent::mouseDown(const MouseEvent& event)
+{
+    if (type == ContinuousChannel::ELECTRODE && editName->isEnabled())
+        setSelected(!selected);
+}
+
 void ChannelComponent::comboBoxChanged(ComboBox* comboBox)
 {
     if (comboBox == rangeComboBox)
@@ -51,6 +51,11 @@ namespace ONIRhythmNode
 
 		Colour getDefaultColor(int ID);
 		void setImpedanceValues(float mag, float phase);
+		void setImpedanceTrend(const String& description);
+
+		/** Marks the channel for the next impedance measurement*/
+		void setSelected(bool selected);
+		bool isSelected() const { return selected; }
 		void disableEdit();
 		void enableEdit();
 
@@ -65,6 +70,9 @@ namespace ONIRhythmNode
 		void comboBoxChanged(ComboBox* comboBox);
 		void labelTextChanged(Label* lbl);
 
+		/** Toggles the selection when the channel name is clicked*/
+		void mouseDown(const MouseEvent& event) override;
+
 		void resized();
 
 		const ContinuousChannel::Type type;
@@ -83,6 +91,7 @@ namespace ONIRhythmNode
 		int userDefinedData;
 		Font font;
 		bool isEnabled;
+		bool selected;
 
 		JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(ChannelComponent);
 
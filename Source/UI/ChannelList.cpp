@@ -55,6 +55,7 @@ ChannelList::ChannelList(DeviceThread* board_, DeviceEditor* editor_) :
     impedanceButton = new UtilityButton("Measure Impedances", Font("Default", 13, Font::plain));
     impedanceButton->setRadius(3);
     impedanceButton->setBounds(280,10,140,25);
+    impedanceButton->setTooltip("Measure all channels, or only the selected ones (click a channel name to select it)");
     impedanceButton->addListener(this);
     addAndMakeVisible(impedanceButton);
 
@@ -65,6 +66,21 @@ ChannelList::ChannelList(DeviceThread* board_, DeviceEditor* editor_) :
     saveImpedanceButton->setEnabled(false);
     addAndMakeVisible(saveImpedanceButton);
 
+    monitorImpedanceButton = new UtilityButton("Monitor Impedances", Font("Default", 13, Font::plain));
+    monitorImpedanceButton->setRadius(3);
+    monitorImpedanceButton->setBounds(590,10,150,25);
+    monitorImpedanceButton->setClickingTogglesState(true);
+    monitorImpedanceButton->setTooltip("Measure one channel at a time in the background during acquisition");
+    monitorImpedanceButton->addListener(this);
+    addAndMakeVisible(monitorImpedanceButton);
+
+    exportHistoryButton = new UtilityButton("Export History", Font("Default", 13, Font::plain));
+    exportHistoryButton->setRadius(3);
+    exportHistoryButton->setBounds(750,10,120,25);
+    exportHistoryButton->setTooltip("Save all stored impedance measurements of the connected headstages");
+    exportHistoryButton->addListener(this);
+    addAndMakeVisible(exportHistoryButton);
+
     gains.clear();
     gains.add(0.01);
     gains.add(0.1);
@@ -87,8 +103,8 @@ void ChannelList::buttonClicked(Button* btn)
 
     if (btn == impedanceButton)
     {
-        editor->measureImpedance();
-        saveImpedanceButton->setEnabled(true);
+        editor->measureImpedance(getSelectedChannels());
+        saveImpedanceButton->setEnabled(board->hasImpedanceData());
     }
     else if (btn == saveImpedanceButton)
     {
@@ -104,6 +120,24 @@ void ChannelList::buttonClicked(Button* btn)
             editor->saveImpedance(impedenceFile);
         }
     }
+    else if (btn == exportHistoryButton)
+    {
+        FileChooser chooseOutputFile("Please select the location to save...",
+            File(),
+            "*.xml");
+
+        if (chooseOutputFile.browseForFileToSave(true))
+        {
+            File historyFile = chooseOutputFile.getResult();
+            board->exportImpedanceHistory(historyFile);
+        }
+    }
+    else if (btn == monitorImpedanceButton)
+    {
+        board->setImpedanceMonitorEnabled(btn->getToggleState());
+
+        CoreServices::updateSignalChain(editor); // adds or removes the Zcheck event line
+    }
 }
 
 void ChannelList::update()
@@ -118,6 +152,10 @@ void ChannelList::update()
     staticLabels.clear();
     channelComponents.clear();
     impedanceButton->setEnabled(true);
+    saveImpedanceButton->setEnabled(board->hasImpedanceData());
+    monitorImpedanceButton->setEnabled(true);
+    exportHistoryButton->setEnabled(true);
+    monitorImpedanceButton->setToggleState(board->isImpedanceMonitorEnabled(), dontSendNotification);
 
     const int columnWidth = 250;
 
@@ -161,6 +199,7 @@ void ChannelList::update()
                 comp->setImpedanceValues(
                     hs->getImpedanceMagnitude(ch),
                     hs->getImpedancePhase(ch));
+                comp->setImpedanceTrend(getImpedanceTrend(hs, ch));
             }
             //comp->setUserDefinedData(k);
             channelComponents.add(comp);
@@ -172,6 +211,7 @@ void ChannelList::update()
     if (column == -1) // no headstages found
     {
         impedanceButton->setEnabled(false);
+        monitorImpedanceButton->setEnabled(false);
     }
 
     //if (board->enableAdcs())
@@ -189,6 +229,8 @@ void ChannelList::disableAll()
 
     impedanceButton->setEnabled(false);
     saveImpedanceButton->setEnabled(false);
+    monitorImpedanceButton->setEnabled(false);
+    exportHistoryButton->setEnabled(false);
     numberingScheme->setEnabled(false);
 }
 
@@ -200,6 +242,8 @@ void ChannelList::enableAll()
     }
     impedanceButton->setEnabled(true);
     saveImpedanceButton->setEnabled(true);
+    monitorImpedanceButton->setEnabled(true);
+    exportHistoryButton->setEnabled(true);
     numberingScheme->setEnabled(true);
 }
 
@@ -253,3 +297,63 @@ void ChannelList::updateImpedance(Array<int> streams, Array<int> channels, Array
     }
 
 }
+
+Array<int> ChannelList::getSelectedChannels()
+{
+    Array<int> selectedChannels;
+
+    for (int i = 0; i < channelComponents.size(); i++)
+    {
+        if (channelComponents[i]->type == ContinuousChannel::ELECTRODE && channelComponents[i]->isSelected())
+            selectedChannels.add(i);
+    }
+
+    return selectedChannels;
+}
+
+void ChannelList::refreshImpedances()
+{
+    int i = 0;
+
+    for (auto hs : board->getConnectedHeadstages())
+    {
+        for (int ch = 0; ch < hs->getNumActiveChannels(); ch++)
+        {
+            if (i >= channelComponents.size())
+                return;
+
+            if (hs->hasImpedanceData())
+            {
+                channelComponents[i]->setImpedanceValues(
+                    hs->getImpedanceMagnitude(ch),
+                    hs->getImpedancePhase(ch));
+            }
+
+            i++;
+        }
+    }
+}
+
+String ChannelList::getImpedanceTrend(const Headstage* hs, int channel)
+{
+    Array<ImpedanceRecord> trend = board->getImpedanceHistory(hs, channel);
+
+    if (trend.size() == 0)
+        return String();
+
+    const ImpedanceRecord& first = trend.getReference(0);
+    const ImpedanceRecord& last = trend.getReference(trend.size() - 1);
+
+    String description = "Last measured " + Time(last.timestamp).toString(true, true, false);
+
+    if (trend.size() > 1 && first.magnitude > 0)
+    {
+        float change = 100.0f * (last.magnitude - first.magnitude) / first.magnitude;
+
+        description += "\n" + String(trend.size()) + " measurements since "
+            + Time(first.timestamp).toString(true, false) + ", "
+            + (change >= 0 ? "+" : "") + String(change, 1) + "% magnitude change";
+    }
+
+    return description;
+}
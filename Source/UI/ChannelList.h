@@ -32,6 +32,7 @@ namespace ONIRhythmNode
 	class DeviceThread;
 	class DeviceEditor;
 	class ChannelComponent;
+	class Headstage;
 
 	class ChannelList : public Component,
 					    public Button::Listener, 
@@ -57,6 +58,15 @@ namespace ONIRhythmNode
 		void comboBoxChanged(ComboBox* b);
 		void updateImpedance(Array<int> streams, Array<int> channels, Array<float> magnitude, Array<float> phase);
 
+		/** Re-reads impedance values from the headstages (used while background measurements run)*/
+		void refreshImpedances();
+
+		/** Describes the stored impedance history of a channel (used as a tooltip)*/
+		String getImpedanceTrend(const Headstage* hs, int channel);
+
+		/** Returns the channels selected for impedance measurement, indexed across all connected headstages*/
+		Array<int> getSelectedChannels();
+
 
 	private:
 
@@ -70,6 +80,8 @@ namespace ONIRhythmNode
 
 		ScopedPointer<UtilityButton> impedanceButton;
 		ScopedPointer<UtilityButton> saveImpedanceButton;
+		ScopedPointer<UtilityButton> monitorImpedanceButton;
+		ScopedPointer<UtilityButton> exportHistoryButton;
 
 		ScopedPointer<ComboBox> numberingScheme;
 		ScopedPointer<Label> numberingSchemeLabel;
@@ -3,6 +3,9 @@
 #include <iomanip>
 #include <cmath>
 #include <cstring>
+#include <algorithm>
+#include <chrono>
+#include <thread>
 
 Rhd2000ONIBoard::Rhd2000ONIBoard()
 {
@@ -11,6 +14,7 @@ Rhd2000ONIBoard::Rhd2000ONIBoard()
     int i;
     sampleRate = SampleRate30000Hz; // Rhythm FPGA boots up with 30.0 kS/s/channel sampling rate
     numDataStreams = 0;
+    readsCancelled = false;
 
     MAX_NUM_DATA_STREAMS = MAX_NUM_DATA_STREAMS_USB3;
 
@@ -300,11 +304,7 @@ bool Rhd2000ONIBoard::setSampleRate(AmplifierSampleRate newSampleRate)
     int res;
     res = oni_write_reg(ctx, RHYTHM_HUB_MANAGER, HUB_CLOCK_SEL, val);
     if (res != ONI_ESUCCESS) return false;
-    do
-    {
-        res = oni_read_reg(ctx, RHYTHM_HUB_MANAGER, HUB_CLOCK_BUSY, &val);
-        if (res != ONI_ESUCCESS) return false;
-    } while (val != 0);
+    if (waitForRegister(RHYTHM_HUB_MANAGER, HUB_CLOCK_BUSY, 0, CLOCK_BUSY_TIMEOUT_MS) != WAIT_DONE) return false;
 
     sampleRate = newSampleRate;
     return true;
@@ -364,6 +364,12 @@ double Rhd2000ONIBoard::getSampleRate() const
     }
 }
 
+// Returns the current per-channel sampling rate as an AmplifierSampleRate enumeration.
+Rhd2000ONIBoard::AmplifierSampleRate Rhd2000ONIBoard::getSampleRateEnum() const
+{
+    return sampleRate;
+}
+
 // Print a command list to the console in readable form.
 void Rhd2000ONIBoard::printCommandList(const std::vector<int>& commandList) const
 {
@@ -531,7 +537,41 @@ void Rhd2000ONIBoard::resetBoard()
 {
     uint32_t val = 1;
     oni_set_opt(ctx, ONI_OPT_RESET, &val, sizeof(val));
-    oni_set_opt(ctx, ONI_OPT_BLOCKREADSIZE, &usbReadBlockSize, sizeof(usbReadBlockSize));
+
+    updateBlockReadSize();
+}
+
+void Rhd2000ONIBoard::updateBlockReadSize()
+{
+    // A read only returns once a whole block has been transferred, so the block size bounds
+    // how long the data thread can stay blocked. It must hold at least one frame of every device.
+    oni_size_t maxFrameSize = 0;
+    size_t size = sizeof(maxFrameSize);
+    bool frameSizeKnown = oni_get_opt(ctx, ONI_OPT_MAXREADFRAMESIZE, &maxFrameSize, &size) == ONI_ESUCCESS && maxFrameSize > 0;
+    if (!frameSizeKnown)
+        maxFrameSize = MAX_BLOCK_READ_SIZE;
+
+    oni_size_t frames = oni_size_t(getSampleRate() * BLOCK_READ_LATENCY_MS / 1000.0);
+    oni_size_t readSize = std::max(std::min(frames * maxFrameSize, MAX_BLOCK_READ_SIZE), maxFrameSize);
+
+    if (oni_set_opt(ctx, ONI_OPT_BLOCKREADSIZE, &readSize, sizeof(readSize)) == ONI_ESUCCESS)
+    {
+        blockReadSize = readSize;
+        // the Rhythm frames are the largest ones, so a block holds at most this many
+        blockReadFrames = std::max(frameSizeKnown ? readSize / maxFrameSize : frames, oni_size_t(1));
+    }
+    else
+        std::cerr << "Error in Rhd2000ONIBoard::updateBlockReadSize: could not set block read size.\n";
+}
+
+oni_size_t Rhd2000ONIBoard::getBlockReadSize() const
+{
+    return blockReadSize;
+}
+
+oni_size_t Rhd2000ONIBoard::getBlockReadFrames() const
+{
+    return blockReadFrames;
 }
 
 void Rhd2000ONIBoard::setContinuousRunMode(bool continuousMode)
@@ -566,6 +606,30 @@ bool Rhd2000ONIBoard::isRunning() const
     return val;
 }
 
+Rhd2000ONIBoard::WaitStatus Rhd2000ONIBoard::waitForSpiCompletion(int timeoutMs) const
+{
+    return waitForRegister(DEVICE_RHYTHM, SPI_RUNNING, 0, timeoutMs);
+}
+
+Rhd2000ONIBoard::WaitStatus Rhd2000ONIBoard::waitForRegister(oni_dev_idx_t dev_idx, oni_reg_addr_t addr, oni_reg_val_t value, int timeoutMs) const
+{
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs);
+    int pollUs = WAIT_MIN_POLL_US;
+
+    while (true)
+    {
+        oni_reg_val_t val;
+        if (oni_read_reg(ctx, dev_idx, addr, &val) != ONI_ESUCCESS) return WAIT_ERROR;
+        if (val == value) return WAIT_DONE;
+
+        if (std::chrono::steady_clock::now() >= deadline) return WAIT_TIMEOUT;
+
+        // each register read is a USB transaction, so back off while waiting
+        std::this_thread::sleep_for(std::chrono::microseconds(pollUs));
+        pollUs = std::min(pollUs * 2, WAIT_MAX_POLL_US);
+    }
+}
+
 // Set the delay for sampling the MISO line on a particular SPI port (PortA - PortD), in integer clock
 // steps, where each clock step is 1/2800 of a per-channel sampling period.
 // Note: Cable delay must be updated after sampleRate is changed, since cable delay calculations are
@@ -958,6 +1022,7 @@ int Rhd2000ONIBoard::readFrame(oni_frame_t** frame)
     bool found = false;
     do
     {
+        if (readsCancelled) return READ_CANCELLED;
         res = oni_read_frame(ctx, frame);
         if (res < ONI_ESUCCESS) return res;
         if ((*frame)->dev_idx == DEVICE_RHYTHM)
@@ -974,6 +1039,11 @@ int Rhd2000ONIBoard::readFrame(oni_frame_t** frame)
 }
 
 
+void Rhd2000ONIBoard::cancelReads(bool cancel)
+{
+    readsCancelled = cancel;
+}
+
 //TODO: This method is outdated and uses unncessary buffering, but it's required for the legacy datablock structure. Fortunately, it's only
 //used for initialization and headstage search. A further rework should eliminate the need for it.
 bool Rhd2000ONIBoard::readDataBlock(Rhd2000DataBlock* dataBlock, int nSamples)
@@ -1043,23 +1113,34 @@ bool Rhd2000ONIBoard::readDataBlocks(int numBlocks, std::queue<Rhd2000DataBlock>
 
 void Rhd2000ONIBoard::setTtlOut(int ttlOutArray[16])
 {
-    int32_t ttlOut = 0;
+    uint32_t ttlOut = 0;
 
     for (int i = 0; i < 16; ++i) {
         if (ttlOutArray[i] > 0)
             ttlOut += 1 << i;
     }
 
-   oni_frame_t* frame;
+    writeTtlOut(ttlOut);
+}
+
+bool Rhd2000ONIBoard::writeTtlOut(uint32_t ttlOut)
+{
+    oni_frame_t* frame;
+
+    int res = oni_create_frame(ctx, &frame, DEVICE_TTL, &ttlOut, sizeof(ttlOut));
+    if (res <= ONI_ESUCCESS)
+    {
+        std::cerr << "Error creating frame for TTL writing " << res << ": " << oni_error_str(res) << std::endl;
+        return false;
+    }
 
-   int res = oni_create_frame(ctx, &frame, DEVICE_TTL, &ttlOut, sizeof(ttlOut));
-   if (res > ONI_ESUCCESS)
-   {
-       oni_write_frame(ctx, frame);
-       oni_destroy_frame(frame);
-   }
-   else std::cerr << "Error creating frame for TTL writing "<<  res << ": " << oni_error_str(res) << std::endl;
+    {
+        std::lock_guard<std::mutex> lock(writeMutex);
+        res = oni_write_frame(ctx, frame);
+    }
+    oni_destroy_frame(frame);
 
+    return res >= ONI_ESUCCESS;
 }
 
 void Rhd2000ONIBoard::clearTtlOut()
@@ -1071,7 +1152,10 @@ void Rhd2000ONIBoard::clearTtlOut()
     int res = oni_create_frame(ctx, &frame, DEVICE_TTL, &ttlOut, sizeof(ttlOut));
     if (res > ONI_ESUCCESS)
     {
-        oni_write_frame(ctx, frame);
+        {
+            std::lock_guard<std::mutex> lock(writeMutex);
+            oni_write_frame(ctx, frame);
+        }
         oni_destroy_frame(frame);
     }
     else std::cerr << "Error creating frame for TTL clearing " << res << ": " << oni_error_str(res) << std::endl;
@@ -1084,20 +1168,42 @@ void Rhd2000ONIBoard::setDacManual(int value)
         std::cerr << "Error in Rhd2000ONIBoard::setDacManual: value out of range." << std::endl;
         return;
     }
-    value = value & 0xFFFF;
-    oni_size_t values[4];
-    for (int i = 0; i < 4; i++)
+    uint16_t values[8];
+    for (int i = 0; i < 8; i++)
+    {
+        values[i] = value & 0xFFFF;
+    }
+    oni_frame_t* frame = createDacFrame();
+    if (frame != nullptr)
     {
-        values[i] = value + (value << 16);
+        writeDacFrame(frame, values);
+        oni_destroy_frame(frame);
     }
+}
+
+oni_frame_t* Rhd2000ONIBoard::createDacFrame()
+{
+    oni_size_t values[4] = { 0, 0, 0, 0 };
     oni_frame_t* frame;
     int res = oni_create_frame(ctx, &frame, DEVICE_DAC, values, 4 * sizeof(oni_size_t));
-    if (res > ONI_ESUCCESS)
+    if (res <= ONI_ESUCCESS)
     {
-        oni_write_frame(ctx, frame);
-        oni_destroy_frame(frame);
+        std::cerr << "Error creating frame for DAC writing " << res << ": " << oni_error_str(res) << std::endl;
+        return nullptr;
+    }
+    return frame;
+}
+
+bool Rhd2000ONIBoard::writeDacFrame(oni_frame_t* frame, const uint16_t values[8])
+{
+    // two channels per word, lower channel in the low half
+    oni_size_t* words = (oni_size_t*)frame->data;
+    for (int i = 0; i < 4; i++)
+    {
+        words[i] = oni_size_t(values[2 * i]) + (oni_size_t(values[2 * i + 1]) << 16);
     }
-    else std::cerr << "Error creating frame for DAC writing " << res << ": " << oni_error_str(res) << std::endl;
+    std::lock_guard<std::mutex> lock(writeMutex);
+    return oni_write_frame(ctx, frame) >= ONI_ESUCCESS;
 }
 
 bool Rhd2000ONIBoard::getFirmwareVersion(int* major, int* minor) const
@@ -1110,6 +1216,13 @@ bool Rhd2000ONIBoard::getFirmwareVersion(int* major, int* minor) const
     return true;
 }
 
+bool Rhd2000ONIBoard::getHardwareAddress(oni_size_t* address) const
+{
+    if (!ctx) return false;
+    size_t size = sizeof(oni_size_t);
+    return (oni_get_opt(ctx, ONI_OPT_HWADDRESS, address, &size) == ONI_ESUCCESS);
+}
+
 Rhd2000ONIBoard::BoardMemState Rhd2000ONIBoard::getBoardMemState() const
 {
     if (!ctx) return BOARDMEM_INVALID;
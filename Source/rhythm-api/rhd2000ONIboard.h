@@ -4,6 +4,8 @@
 #include "rhd2000datablock.h"
 #include <vector>
 #include <queue>
+#include <atomic>
+#include <mutex>
 
 
 #define MAX_NUM_DATA_STREAMS_USB3 16
@@ -86,6 +88,17 @@ public:
     void stop();
 
     bool isRunning() const;
+
+    enum WaitStatus
+    {
+        WAIT_DONE = 0,
+        WAIT_TIMEOUT = 1,
+        WAIT_ERROR = 2
+    };
+
+    // Waits for a run started with continuous run mode off to finish. The SPI_RUNNING
+    // register is polled with exponential backoff until the deadline.
+    WaitStatus waitForSpiCompletion(int timeoutMs = 1000) const;
     int getNumEnabledDataStreams() const;
 
     void setDataSource(int stream, BoardDataSource dataSource);
@@ -97,6 +110,7 @@ public:
 
     bool setSampleRate(AmplifierSampleRate newSampleRate);
     double getSampleRate() const;
+    AmplifierSampleRate getSampleRateEnum() const;
 
     void setDspSettle(bool enabled);
     
@@ -120,16 +134,45 @@ public:
     bool readDataBlock(Rhd2000DataBlock* dataBlock, int nSamples = -1);
     bool readDataBlocks(int numBlocks, std::queue<Rhd2000DataBlock>& dataqueue);
     
+    // Returned by readFrame() when reads were cancelled between transfers
+    static const int READ_CANCELLED = ONI_MINERRORNUM - 1;
+
     int readFrame(oni_frame_t** frame);
 
+    // While set, readFrame() returns READ_CANCELLED instead of starting another read,
+    // so a blocked reader can leave after the transfer in progress.
+    void cancelReads(bool cancel);
+
+    // Sizes the driver's block reads to hold about BLOCK_READ_LATENCY_MS of frames
+    // at the current sample rate. Done at each reset; must be repeated after a sample
+    // rate change, before the board is run.
+    void updateBlockReadSize();
+
+    // Size of the driver's block reads
+    oni_size_t getBlockReadSize() const;
+    // Upper bound on the number of Rhythm frames delivered by one block read. Frames the host
+    // has not decoded yet were recorded before any command written now takes effect.
+    oni_size_t getBlockReadFrames() const;
+
     void setTtlOut(int ttlOutArray[16]);
+    // Writes all 16 TTL outputs at once (bit i = output i). Returns false if the frame could not be written.
+    bool writeTtlOut(uint32_t ttlOut);
     void clearTtlOut();
 
     void enableDac(int dacChannel, bool enabled);
     void setDacManual(int value);
+
+    // DAC channels routed to this stream output the values written in DAC frames
+    static const int DAC_MANUAL_STREAM = MAX_NUM_DATA_STREAMS_USB3;
+
+    // Creates a DAC frame that can be written repeatedly; destroy it with oni_destroy_frame()
+    oni_frame_t* createDacFrame();
+    // Writes one value to each of the eight DAC channels, reusing a frame from createDacFrame()
+    bool writeDacFrame(oni_frame_t* frame, const uint16_t values[8]);
      void setDacGain(int gain);
 
     bool getFirmwareVersion(int* major, int* minor) const;
+    bool getHardwareAddress(oni_size_t* address) const;
 
     void getONIVersion(int* major, int* minor, int* patch);
     void getONIDriverInfo(const oni_driver_info_t** driverInfo);
@@ -147,10 +190,25 @@ public:
     BoardMemState getBoardMemState() const;
 
 private:
-    const oni_size_t usbReadBlockSize = 24 * 1024;
+    const oni_size_t MAX_BLOCK_READ_SIZE = 24 * 1024;
+    const int BLOCK_READ_LATENCY_MS = 10;
+
+    oni_size_t blockReadSize = MAX_BLOCK_READ_SIZE;
+    oni_size_t blockReadFrames = 1;
+    std::atomic<bool> readsCancelled;
+
+    // Serializes frame writes; TTL and DAC frames are written from different threads
+    std::mutex writeMutex;
 
     static int oni_write_reg_mask(const oni_ctx ctx, oni_dev_idx_t dev_idx, oni_reg_addr_t addr, oni_reg_val_t value, unsigned int mask);
 
+    // Polls a register with exponential backoff until it reads the given value or the deadline passes
+    WaitStatus waitForRegister(oni_dev_idx_t dev_idx, oni_reg_addr_t addr, oni_reg_val_t value, int timeoutMs) const;
+
+    const int WAIT_MIN_POLL_US = 50;
+    const int WAIT_MAX_POLL_US = 5000;
+    const int CLOCK_BUSY_TIMEOUT_MS = 500;
+
     enum Rhythm_Registers
     {
         ENABLE = 0,